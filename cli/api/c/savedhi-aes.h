@@ -0,0 +1,50 @@
+// =============================================================================
+// Created by Maarten Billemont on 2026-10-16.
+// Copyright (c) 2011, Maarten Billemont.
+//
+// This file is part of savedhi.
+// savedhi is free software. You can modify it under the terms of
+// the GNU General Public License, either version 3 or any later version.
+// See the LICENSE file for details or consult <http://www.gnu.org/licenses/>.
+//
+// Note: this grant does not include any rights for use of savedhi's trademarks.
+// =============================================================================
+
+#ifndef _savedhi_AES_H
+#define _savedhi_AES_H
+
+#include "savedhi-types.h"
+
+savedhi_LIBS_BEGIN
+#include <stddef.h>
+savedhi_LIBS_END
+
+//// AES-128-CBC.
+///
+/// Blocks are encrypted and decrypted with the CPU's AES instructions (x86 AES-NI or ARMv8 crypto extensions) where available,
+/// and with lookup tables otherwise.  CBC decryption has no dependency between blocks, so the AES instruction kernels
+/// decrypt 8 blocks at once.  The choice is made once, by the first thread that needs it, and can be overridden with
+/// the savedhi_AES environment variable: aes-ni, armv8 or portable.
+
+/** The environment variable that overrides the choice of AES implementation. */
+#define savedhi_ENV_aes         "savedhi_AES"
+
+/** @return The name of the implementation that encrypts and decrypts blocks: aes-ni, armv8 or portable. */
+const char *savedhi_aes_name(void);
+/** Select the implementation that encrypts and decrypts blocks by name, as the savedhi_AES environment variable does, eg. to compare them.
+ * Not thread-safe: switch only while no blocks are being encrypted or decrypted.
+ * @return false if the implementation isn't supported on this CPU, leaving the selection unchanged. */
+bool savedhi_aes_set(const char *name);
+
+/** Expand an AES-128 key into its round keys for encryption and decryption. */
+void savedhi_aes_key_init(
+        savedhiAESKey *aesKey, const uint8_t key[static 16]);
+
+/** Encrypt whole 16-byte blocks in place using AES-128-CBC. */
+void savedhi_aes_cbc_encrypt(
+        const savedhiAESKey *aesKey, const uint8_t iv[static 16], uint8_t *blocks, const size_t blocksCount);
+/** Decrypt whole 16-byte blocks in place using AES-128-CBC. */
+void savedhi_aes_cbc_decrypt(
+        const savedhiAESKey *aesKey, const uint8_t iv[static 16], uint8_t *blocks, const size_t blocksCount);
+
+#endif // _savedhi_AES_H
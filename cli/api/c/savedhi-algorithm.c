@@ -16,13 +16,16 @@
 #include "savedhi-algorithm_v2.h"
 #include "savedhi-algorithm_v3.h"
 #include "savedhi-util.h"
+#include "savedhi-aes.h"
+#include "savedhi-sha256.h"
 
 savedhi_LIBS_BEGIN
 #include <string.h>
+#include <errno.h>
 savedhi_LIBS_END
 
-const savedhiUserKey *savedhi_user_key(
-        const char *userName, const char *userSecret, const savedhiAlgorithm algorithmVersion) {
+bool savedhi_user_key_into(
+        savedhiUserKey *userKey, const char *userName, const char *userSecret, const savedhiAlgorithm algorithmVersion) {
 
     if (userName && !strlen( userName ))
         userName = NULL;
@@ -32,17 +35,20 @@ const savedhiUserKey *savedhi_user_key(
     trc( "-- savedhi_user_key (algorithm: %u)", algorithmVersion );
     trc( "userName: %s", userName );
     trc( "userSecret.id: %s", userSecret? savedhi_id_buf( (uint8_t *)userSecret, strlen( userSecret ) ).hex: NULL );
+    if (!userKey) {
+        err( "Missing userKey" );
+        return false;
+    }
     if (!userName) {
         err( "Missing userName" );
-        return NULL;
+        return false;
     }
     if (!userSecret) {
         err( "Missing userSecret" );
-        return NULL;
+        return false;
     }
 
-    savedhiUserKey *userKey = memcpy( malloc( sizeof( savedhiUserKey ) ),
-            &(savedhiUserKey){ .algorithm = algorithmVersion }, sizeof( savedhiUserKey ) );
+    memcpy( userKey, &(savedhiUserKey){ .algorithm = algorithmVersion }, sizeof( savedhiUserKey ) );
 
     bool success = false;
     switch (algorithmVersion) {
@@ -62,27 +68,73 @@ const savedhiUserKey *savedhi_user_key(
             err( "Unsupported version: %d", algorithmVersion );
     }
 
+    // Key the site key HMAC-SHA-256 states ahead of time, each having absorbed its purpose's scope.
+    for (savedhiKeyPurpose keyPurpose = savedhiKeyPurposeAuthentication; success && keyPurpose <= savedhiKeyPurposeRecovery; ++keyPurpose) {
+        const char *keyScope = savedhi_purpose_scope( keyPurpose );
+        if (!(success = savedhi_hash_hmac_sha256_init( (savedhiHMACState *)&userKey->purposeStates[keyPurpose],
+                userKey->bytes, sizeof( userKey->bytes ), (const uint8_t *)keyScope, strlen( keyScope ) )))
+            err( "Could not key site key state for purpose: %s", savedhi_purpose_name( keyPurpose ) );
+    }
+
+    // Expand the AES key for stateful results ahead of time.
     if (success)
-        return userKey;
+        savedhi_aes_key_init( (savedhiAESKey *)&userKey->aesKey, userKey->bytes );
 
-    savedhi_free( &userKey, sizeof( savedhiUserKey ) );
-    return NULL;
+    if (!success)
+        savedhi_zero( userKey, sizeof( savedhiUserKey ) );
+    return success;
 }
 
-const savedhiSiteKey *savedhi_site_key(
-        const savedhiUserKey *userKey, const char *siteName,
-        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+const savedhiUserKey *savedhi_user_key(
+        const char *userName, const char *userSecret, const savedhiAlgorithm algorithmVersion) {
 
-    if (keyContext && !strlen( keyContext ))
-        keyContext = NULL;
+    savedhiUserKey *userKey = malloc( sizeof( savedhiUserKey ) );
     if (!userKey) {
-        err( "Missing userKey" );
-        return NULL;
-    }
-    if (!siteName) {
-        err( "Missing siteName" );
+        err( "Could not allocate user key: %s", strerror( errno ) );
         return NULL;
     }
+    if (savedhi_user_key_into( userKey, userName, userSecret, algorithmVersion ))
+        return userKey;
+
+    savedhi_free( &userKey, sizeof( savedhiUserKey ) );
+    return NULL;
+}
+
+bool savedhi_user_key_share_into(
+        savedhiUserKey *sharedKey, const savedhiUserKey *userKey, const char *userName, const savedhiAlgorithm algorithmVersion) {
+
+    if (!sharedKey || !userKey || !userName || algorithmVersion < savedhiAlgorithmFirst || algorithmVersion > savedhiAlgorithmLast)
+        return false;
+
+    // V0-V2 salt the user key with the user name's length in characters, V3 with its length in bytes.
+    // Other than that, all versions use the same user key salt and key stretch parameters.
+    size_t userNameSize;
+    if ((userKey->algorithm < savedhiAlgorithmV3) != (algorithmVersion < savedhiAlgorithmV3) &&
+        savedhi_utf8_measure( userName, &userNameSize ) != userNameSize)
+        return false;
+
+    trc( "-- savedhi_user_key_share (algorithm: %u => %u)", userKey->algorithm, algorithmVersion );
+    if (sharedKey != userKey)
+        memcpy( sharedKey, userKey, sizeof( *sharedKey ) );
+    memcpy( (savedhiAlgorithm *)&sharedKey->algorithm, &algorithmVersion, sizeof( sharedKey->algorithm ) );
+
+    return true;
+}
+
+const savedhiUserKey *savedhi_user_key_share(
+        const savedhiUserKey *userKey, const char *userName, const savedhiAlgorithm algorithmVersion) {
+
+    savedhiUserKey *sharedKey = malloc( sizeof( savedhiUserKey ) );
+    if (sharedKey && savedhi_user_key_share_into( sharedKey, userKey, userName, algorithmVersion ))
+        return sharedKey;
+
+    savedhi_free( &sharedKey, sizeof( savedhiUserKey ) );
+    return NULL;
+}
+
+static bool savedhi_site_key_derive(
+        savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
 
     trc( "-- savedhi_site_key (algorithm: %u)", userKey->algorithm );
     trc( "siteName: %s", siteName );
@@ -90,53 +142,106 @@ const savedhiSiteKey *savedhi_site_key(
     trc( "keyPurpose: %d (%s)", keyPurpose, savedhi_purpose_name( keyPurpose ) );
     trc( "keyContext: %s", keyContext );
 
-    savedhiSiteKey *siteKey = memcpy( malloc( sizeof( savedhiSiteKey ) ),
-            &(savedhiSiteKey){ .algorithm = userKey->algorithm }, sizeof( savedhiSiteKey ) );
+    memcpy( siteKey, &(savedhiSiteKey){ .algorithm = userKey->algorithm }, sizeof( savedhiSiteKey ) );
 
-    bool success = false;
     switch (userKey->algorithm) {
         case savedhiAlgorithmV0:
-            success = savedhi_site_key_v0( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
-            break;
+            return savedhi_site_key_v0( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
         case savedhiAlgorithmV1:
-            success = savedhi_site_key_v1( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
-            break;
+            return savedhi_site_key_v1( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
         case savedhiAlgorithmV2:
-            success = savedhi_site_key_v2( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
-            break;
+            return savedhi_site_key_v2( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
         case savedhiAlgorithmV3:
-            success = savedhi_site_key_v3( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
-            break;
+            return savedhi_site_key_v3( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
         default:
             err( "Unsupported version: %d", userKey->algorithm );
+            return false;
     }
-
-    if (success)
-        return siteKey;
-
-    savedhi_free( &siteKey, sizeof( savedhiSiteKey ) );
-    return NULL;
 }
 
-const char *savedhi_site_result(
-        const savedhiUserKey *userKey, const char *siteName,
-        const savedhiResultType resultType, const char *resultParam,
+bool savedhi_site_key_into(
+        savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
         const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
 
     if (keyContext && !strlen( keyContext ))
         keyContext = NULL;
-    if (resultParam && !strlen( resultParam ))
-        resultParam = NULL;
+    if (!siteKey) {
+        err( "Missing siteKey" );
+        return false;
+    }
     if (!userKey) {
         err( "Missing userKey" );
-        return NULL;
+        return false;
+    }
+    if (!siteName) {
+        err( "Missing siteName" );
+        return false;
     }
 
-    const savedhiSiteKey *siteKey = savedhi_site_key( userKey, siteName, keyCounter, keyPurpose, keyContext );
+    if (savedhi_site_key_derive( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext ))
+        return true;
+
+    savedhi_zero( siteKey, sizeof( *siteKey ) );
+    return false;
+}
+
+const savedhiSiteKey *savedhi_site_key(
+        const savedhiUserKey *userKey, const char *siteName,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    savedhiSiteKey *siteKey = malloc( sizeof( savedhiSiteKey ) );
     if (!siteKey) {
-        err( "Missing siteKey" );
+        err( "Could not allocate site key: %s", strerror( errno ) );
         return NULL;
     }
+    if (savedhi_site_key_into( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext ))
+        return siteKey;
+
+    savedhi_free( &siteKey, sizeof( savedhiSiteKey ) );
+    return NULL;
+}
+
+static bool savedhi_site_salt(
+        const savedhiAlgorithm algorithm, savedhiBuffer *siteSalt, const char *keyScope,
+        const char *siteName, const savedhiCounter keyCounter, const char *keyContext) {
+
+    switch (algorithm) {
+        case savedhiAlgorithmV0:
+            return savedhi_site_salt_v0( siteSalt, keyScope, siteName, keyCounter, keyContext );
+        case savedhiAlgorithmV1:
+            return savedhi_site_salt_v1( siteSalt, keyScope, siteName, keyCounter, keyContext );
+        case savedhiAlgorithmV2:
+            return savedhi_site_salt_v2( siteSalt, keyScope, siteName, keyCounter, keyContext );
+        case savedhiAlgorithmV3:
+            return savedhi_site_salt_v3( siteSalt, keyScope, siteName, keyCounter, keyContext );
+        default:
+            err( "Unsupported version: %d", algorithm );
+            return false;
+    }
+}
+
+static bool savedhi_site_template_password(
+        char sitePassword[static 32], const savedhiUserKey *userKey, const savedhiSiteKey *siteKey,
+        const savedhiResultType resultType, const char *resultParam) {
+
+    switch (userKey->algorithm) {
+        case savedhiAlgorithmV0:
+            return savedhi_site_template_password_v0( sitePassword, userKey, siteKey, resultType, resultParam );
+        case savedhiAlgorithmV1:
+            return savedhi_site_template_password_v1( sitePassword, userKey, siteKey, resultType, resultParam );
+        case savedhiAlgorithmV2:
+            return savedhi_site_template_password_v2( sitePassword, userKey, siteKey, resultType, resultParam );
+        case savedhiAlgorithmV3:
+            return savedhi_site_template_password_v3( sitePassword, userKey, siteKey, resultType, resultParam );
+        default:
+            err( "Unsupported version: %d", userKey->algorithm );
+            return false;
+    }
+}
+
+static const char *savedhi_site_key_result(
+        const savedhiUserKey *userKey, const savedhiSiteKey *siteKey,
+        const savedhiResultType resultType, const char *resultParam) {
 
     trc( "-- savedhi_site_result (algorithm: %u)", userKey->algorithm );
     trc( "resultType: %d (%s)", resultType, savedhi_type_short_name( resultType ) );
@@ -147,23 +252,10 @@ const char *savedhi_site_result(
         result = NULL;
     }
     else if (resultType & savedhiResultClassTemplate) {
-        switch (userKey->algorithm) {
-            case savedhiAlgorithmV0:
-                result = savedhi_site_template_password_v0( userKey, siteKey, resultType, resultParam );
-                break;
-            case savedhiAlgorithmV1:
-                result = savedhi_site_template_password_v1( userKey, siteKey, resultType, resultParam );
-                break;
-            case savedhiAlgorithmV2:
-                result = savedhi_site_template_password_v2( userKey, siteKey, resultType, resultParam );
-                break;
-            case savedhiAlgorithmV3:
-                result = savedhi_site_template_password_v3( userKey, siteKey, resultType, resultParam );
-                break;
-            default:
-                err( "Unsupported version: %d", userKey->algorithm );
-                break;
-        }
+        char sitePassword[32];
+        if (savedhi_site_template_password( sitePassword, userKey, siteKey, resultType, resultParam ))
+            result = savedhi_strdup( sitePassword );
+        savedhi_zero( sitePassword, sizeof( sitePassword ) );
     }
     else if (resultType & savedhiResultClassStateful) {
         switch (userKey->algorithm) {
@@ -207,10 +299,201 @@ const char *savedhi_site_result(
         err( "Unsupported password type: %d", resultType );
     }
 
+    return result;
+}
+
+/** Copy a result into a caller's buffer, if it fits. */
+static bool savedhi_site_result_copy(
+        char *result, const size_t resultSize, size_t *resultLength, const char *source) {
+
+    size_t sourceLength = strlen( source );
+    if (resultLength)
+        *resultLength = sourceLength;
+    if (!result || sourceLength >= resultSize)
+        return false;
+
+    memcpy( result, source, sourceLength + 1 );
+    return true;
+}
+
+static bool savedhi_site_key_result_into(
+        char *result, const size_t resultSize, size_t *resultLength,
+        const savedhiUserKey *userKey, const savedhiSiteKey *siteKey,
+        const savedhiResultType resultType, const char *resultParam) {
+
+    // Template results are generated in place; other results are copied over from an allocated result.
+    bool success = false;
+    if (resultType & savedhiResultClassTemplate) {
+        trc( "-- savedhi_site_result (algorithm: %u)", userKey->algorithm );
+        trc( "resultType: %d (%s)", resultType, savedhi_type_short_name( resultType ) );
+
+        char sitePassword[32];
+        if (savedhi_site_template_password( sitePassword, userKey, siteKey, resultType, resultParam ))
+            success = savedhi_site_result_copy( result, resultSize, resultLength, sitePassword );
+        savedhi_zero( sitePassword, sizeof( sitePassword ) );
+    }
+    else {
+        const char *siteResult = savedhi_site_key_result( userKey, siteKey, resultType, resultParam );
+        if (siteResult)
+            success = savedhi_site_result_copy( result, resultSize, resultLength, siteResult );
+        savedhi_free_string( &siteResult );
+    }
+
+    return success;
+}
+
+bool savedhi_site_result_into(
+        char *result, const size_t resultSize, size_t *resultLength,
+        const savedhiUserKey *userKey, const char *siteName,
+        const savedhiResultType resultType, const char *resultParam,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    if (resultLength)
+        *resultLength = 0;
+    if (result && resultSize)
+        *result = '\0';
+    if (resultParam && !strlen( resultParam ))
+        resultParam = NULL;
+    if (!userKey) {
+        err( "Missing userKey" );
+        return false;
+    }
+
+    savedhiSiteKey siteKey;
+    if (!savedhi_site_key_into( &siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext )) {
+        err( "Missing siteKey" );
+        return false;
+    }
+
+    bool success = savedhi_site_key_result_into( result, resultSize, resultLength, userKey, &siteKey, resultType, resultParam );
+    savedhi_zero( &siteKey, sizeof( siteKey ) );
+    return success;
+}
+
+const char *savedhi_site_result(
+        const savedhiUserKey *userKey, const char *siteName,
+        const savedhiResultType resultType, const char *resultParam,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    if (keyContext && !strlen( keyContext ))
+        keyContext = NULL;
+    if (resultParam && !strlen( resultParam ))
+        resultParam = NULL;
+    if (!userKey) {
+        err( "Missing userKey" );
+        return NULL;
+    }
+
+    const savedhiSiteKey *siteKey = savedhi_site_key( userKey, siteName, keyCounter, keyPurpose, keyContext );
+    if (!siteKey) {
+        err( "Missing siteKey" );
+        return NULL;
+    }
+
+    const char *result = savedhi_site_key_result( userKey, siteKey, resultType, resultParam );
+
     savedhi_free( &siteKey, sizeof( savedhiSiteKey ) );
     return result;
 }
 
+/** The amount of site keys of one purpose whose salts are prepared and hashed together, filling the widest SHA-256 kernel twice. */
+#define savedhi_site_results_chunk (savedhi_sha256_lanes_max * 2)
+
+bool savedhi_site_results_batch(
+        char *arena, const size_t arenaSize, size_t *arenaLength, const char *results[],
+        const savedhiUserKey *userKey, const savedhiSiteRequest *requests, const size_t requestsCount) {
+
+    if (arenaLength)
+        *arenaLength = 0;
+    if (!results) {
+        err( "Missing results" );
+        return false;
+    }
+    for (size_t r = 0; r < requestsCount; ++r)
+        results[r] = NULL;
+    if (!userKey) {
+        err( "Missing userKey" );
+        return false;
+    }
+    if (!requests && requestsCount) {
+        err( "Missing requests" );
+        return false;
+    }
+
+    trc( "-- savedhi_site_results_batch (algorithm: %u, requests: %zu)", userKey->algorithm, requestsCount );
+    bool success = true;
+    for (size_t r = 0; r < requestsCount; ++r)
+        if (!requests[r].siteName || !savedhi_purpose_scope( requests[r].keyPurpose )) {
+            err( "Missing siteName or unsupported keyPurpose: %d", requests[r].keyPurpose );
+            success = false;
+        }
+
+    // Derive the site keys of each purpose a chunk at a time, each continuing from the user key's purpose state.
+    size_t arenaUsed = 0;
+    for (savedhiKeyPurpose keyPurpose = savedhiKeyPurposeAuthentication; keyPurpose <= savedhiKeyPurposeRecovery; ++keyPurpose) {
+        for (size_t r = 0; r < requestsCount;) {
+            savedhiBuffer siteSalts[savedhi_site_results_chunk];
+            const uint8_t *siteSaltBytes[savedhi_site_results_chunk];
+            size_t siteSaltSizes[savedhi_site_results_chunk], siteSaltRequests[savedhi_site_results_chunk];
+            size_t siteSaltsCount = 0;
+            for (; r < requestsCount && siteSaltsCount < savedhi_site_results_chunk; ++r) {
+                if (requests[r].keyPurpose != keyPurpose || !requests[r].siteName)
+                    continue;
+
+                const char *keyContext = requests[r].keyContext && strlen( requests[r].keyContext )? requests[r].keyContext: NULL;
+                savedhiBuffer *siteSalt = &siteSalts[siteSaltsCount];
+                if (!savedhi_site_salt( userKey->algorithm, siteSalt, NULL, requests[r].siteName, requests[r].keyCounter, keyContext )) {
+                    success = false;
+                    continue;
+                }
+
+                siteSaltBytes[siteSaltsCount] = siteSalt->bytes;
+                siteSaltSizes[siteSaltsCount] = siteSalt->size;
+                siteSaltRequests[siteSaltsCount++] = r;
+            }
+            if (!siteSaltsCount)
+                continue;
+
+            uint8_t siteKeys[savedhi_site_results_chunk][32];
+            trc( "siteKeys: hmac-sha256( userKey.id=%s, keyScope | siteSalt ) x %zu (%s)",
+                    savedhi_user_key_id( userKey )->hex, siteSaltsCount, savedhi_sha256_lanes_name() );
+            bool derived = savedhi_hash_hmac_sha256_lanes(
+                    siteKeys, &userKey->purposeStates[keyPurpose], siteSaltBytes, siteSaltSizes, siteSaltsCount );
+            if (!derived) {
+                err( "Could not derive site keys." );
+                success = false;
+            }
+
+            // Generate each result into the arena, after the results before it.
+            for (size_t s = 0; s < siteSaltsCount; ++s) {
+                savedhi_buffer_free( &siteSalts[s] );
+                if (!derived)
+                    continue;
+
+                const size_t sr = siteSaltRequests[s];
+                savedhiSiteKey siteKey = { .algorithm = userKey->algorithm };
+                memcpy( (uint8_t *)siteKey.bytes, siteKeys[s], sizeof( siteKey.bytes ) );
+                const char *resultParam = requests[sr].resultParam && strlen( requests[sr].resultParam )? requests[sr].resultParam: NULL;
+                char *result = arena && arenaUsed < arenaSize? arena + arenaUsed: NULL;
+                size_t resultLength = 0;
+                if (savedhi_site_key_result_into( result, result? arenaSize - arenaUsed: 0, &resultLength,
+                        userKey, &siteKey, requests[sr].resultType, resultParam ))
+                    results[sr] = result;
+                else
+                    success = false;
+                if (resultLength)
+                    arenaUsed += resultLength + 1;
+                savedhi_zero( &siteKey, sizeof( siteKey ) );
+            }
+            savedhi_zero( siteKeys, sizeof( siteKeys ) );
+        }
+    }
+
+    if (arenaLength)
+        *arenaLength = arenaUsed;
+    return success;
+}
+
 const char *savedhi_site_state(
         const savedhiUserKey *userKey, const char *siteName,
         const savedhiResultType resultType, const char *resultParam,
@@ -267,6 +550,23 @@ const char *savedhi_site_state(
     return result;
 }
 
+bool savedhi_site_state_into(
+        char *state, const size_t stateSize, size_t *stateLength,
+        const savedhiUserKey *userKey, const char *siteName,
+        const savedhiResultType resultType, const char *resultParam,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    if (stateLength)
+        *stateLength = 0;
+    if (state && stateSize)
+        *state = '\0';
+
+    const char *siteState = savedhi_site_state( userKey, siteName, resultType, resultParam, keyCounter, keyPurpose, keyContext );
+    bool success = siteState && savedhi_site_result_copy( state, stateSize, stateLength, siteState );
+    savedhi_free_string( &siteState );
+    return success;
+}
+
 static const char *savedhi_identicon_leftArms[] = { "╔", "╚", "╰", "═" };
 static const char *savedhi_identicon_bodies[] = { "█", "░", "▒", "▓", "☺", "☻" };
 static const char *savedhi_identicon_rightArms[] = { "╗", "╝", "╯", "═" };
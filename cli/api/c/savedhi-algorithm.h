@@ -15,10 +15,37 @@
 
 #include "savedhi-types.h"
 
+/** The parameters of a single site result, for generating many results from one user key at once. */
+typedef struct {
+    const char *siteName;
+    savedhiResultType resultType;
+    /** A parameter for the resultType.  For stateful result types, the output of savedhi_site_state. */
+    const char *resultParam;
+    savedhiCounter keyCounter;
+    savedhiKeyPurpose keyPurpose;
+    const char *keyContext;
+} savedhiSiteRequest;
+
 /** Derive the user key for a user based on their name and user secret.
  * @return A savedhiUserKey value (allocated) or NULL if the userName or userSecret is missing, the algorithm is unknown, or an algorithm error occurred. */
 const savedhiUserKey *savedhi_user_key(
         const char *userName, const char *userSecret, const savedhiAlgorithm algorithmVersion);
+/** Derive the user key for a user into a caller-supplied user key, eg. one in locked memory.  Does not copy the key through the heap.
+ * @return false if the userKey, userName or userSecret is missing, the algorithm is unknown, or an algorithm error occurred,
+ *         leaving the userKey zeroed. */
+bool savedhi_user_key_into(
+        savedhiUserKey *userKey, const char *userName, const char *userSecret, const savedhiAlgorithm algorithmVersion);
+
+/** Reuse a user key's key stretch for a different algorithm version of the same user.
+ * Algorithm versions whose user key salts are identical for the given userName share their user key bytes,
+ * eg. all versions agree for user names without non-ASCII characters.
+ * @return A new savedhiUserKey value (allocated) or NULL if the algorithm version's user key must be derived with savedhi_user_key. */
+const savedhiUserKey *savedhi_user_key_share(
+        const savedhiUserKey *userKey, const char *userName, const savedhiAlgorithm algorithmVersion);
+/** Reuse a user key's key stretch for a different algorithm version of the same user, into a caller-supplied user key.
+ * @return false if the algorithm version's user key must be derived with savedhi_user_key_into, leaving the sharedKey unchanged. */
+bool savedhi_user_key_share_into(
+        savedhiUserKey *sharedKey, const savedhiUserKey *userKey, const char *userName, const savedhiAlgorithm algorithmVersion);
 
 /** Generate a result token for a user from the user's user key and result parameters.
  * @param resultParam A parameter for the resultType.  For stateful result types, the output of savedhi_site_state.
@@ -28,6 +55,30 @@ const char *savedhi_site_result(
         const savedhiResultType resultType, const char *resultParam,
         const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext);
 
+/** Generate a result token for a user into a caller-supplied buffer.
+ * Template results are generated without any allocation.
+ * @param result A buffer of resultSize bytes to receive the result token as a C-string.
+ * @param resultLength If not NULL, receives the length of the result token, excluding its NUL terminator, even if it does not fit.
+ * @return false if the userKey or siteName is missing, the algorithm is unknown, an algorithm error occurred,
+ *         or the result token does not fit in resultSize bytes. */
+bool savedhi_site_result_into(
+        char *result, const size_t resultSize, size_t *resultLength,
+        const savedhiUserKey *userKey, const char *siteName,
+        const savedhiResultType resultType, const char *resultParam,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext);
+
+/** Generate the result tokens for a batch of sites of a user into a caller-supplied arena.
+ * The site keys of each purpose are derived from the user key's purpose state, hashing as many site salts at once as the CPU allows,
+ * and template results are generated in place.  Only results other than templates allocate, while they are generated.
+ * @param arena A buffer of arenaSize bytes to receive the results, one C-string after another.
+ * @param arenaLength If not NULL, receives the amount of arena bytes the results need, even if they do not all fit.
+ * @param results An array of requestsCount C-strings, receiving each request's result within the arena, or NULL if it has no result,
+ *                failed or did not fit.
+ * @return false if the userKey is missing, or any request is invalid, failed or did not fit in the arena. */
+bool savedhi_site_results_batch(
+        char *arena, const size_t arenaSize, size_t *arenaLength, const char *results[],
+        const savedhiUserKey *userKey, const savedhiSiteRequest *requests, const size_t requestsCount);
+
 /** Encrypt a result token for stateful persistence.
  * @param resultParam A parameter for the resultType.  For stateful result types, the desired savedhi_site_result.
  * @return A C-string (allocated) or NULL if the userKey, siteName or resultType's resultParam is missing, the algorithm is unknown, or an algorithm error occurred. */
@@ -36,11 +87,27 @@ const char *savedhi_site_state(
         const savedhiResultType resultType, const char *resultParam,
         const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext);
 
+/** Encrypt a result token for stateful persistence into a caller-supplied buffer.
+ * @param state A buffer of stateSize bytes to receive the state as a C-string.
+ * @param stateLength If not NULL, receives the length of the state, excluding its NUL terminator, even if it does not fit.
+ * @return false if the userKey, siteName or resultType's resultParam is missing, the algorithm is unknown, an algorithm error occurred,
+ *         or the state does not fit in stateSize bytes. */
+bool savedhi_site_state_into(
+        char *state, const size_t stateSize, size_t *stateLength,
+        const savedhiUserKey *userKey, const char *siteName,
+        const savedhiResultType resultType, const char *resultParam,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext);
+
 /** Derive the result key for a user from the user's user key and result parameters.
  * @return An savedhiSiteKey value (allocated) or NULL if the userKey or siteName is missing, the algorithm is unknown, or an algorithm error occurred. */
 const savedhiSiteKey *savedhi_site_key(
         const savedhiUserKey *userKey, const char *siteName,
         const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext);
+/** Derive the result key for a user into a caller-supplied site key, eg. one held by value.  Does not allocate.
+ * @return false if the siteKey, userKey or siteName is missing, the algorithm is unknown, or an algorithm error occurred. */
+bool savedhi_site_key_into(
+        savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext);
 
 /** @return An identicon (static) that represents the user's identity. */
 const savedhiIdenticon savedhi_identicon(
@@ -25,23 +25,83 @@ savedhi_LIBS_END
 #define savedhi_otp_window       5 * 60 /* s */
 
 // Algorithm version helpers.
+const uint16_t savedhi_seed_v0(const uint8_t seedByte) {
+
+    // V0 incorrectly converts bytes into 16-bit big-endian numbers, sign-extended.
+    return (uint16_t)(seedByte << 8 | (seedByte > 127? 0x00ff: 0x0000));
+}
+
 const char *savedhi_type_template_v0(const savedhiResultType type, uint16_t templateIndex) {
 
     size_t count = 0;
-    const char **templates = savedhi_type_templates( type, &count );
-    char const *template = templates && count? templates[templateIndex % count]: NULL;
-    free( templates );
+    const char *const *templates = savedhi_type_templates_static( type, &count );
 
-    return template;
+    return templates && count? templates[templateIndex % count]: NULL;
 }
 
-const char savedhi_class_character_v0(char characterClass, uint16_t classIndex) {
-
-    const char *classCharacters = savedhi_class_characters( characterClass );
-    if (!classCharacters)
+// For each character class, the class character that encodes each seed byte: characters[savedhi_seed_v0( seedByte ) % strlen( characters )].
+static const char *const savedhi_class_encodings_v0[128] = {
+        ['V'] =
+        "AEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIO"
+        "UAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEI"
+        "OUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAE"
+        "IOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUA",
+        ['C'] =
+        "BGLQVZFKPTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWB"
+        "GLQVZFKPTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBG"
+        "PTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBGLQVZFKP"
+        "TYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBGLQVZFKPTYDJNSXCHMRWBGLQVZFKPT",
+        ['v'] =
+        "aeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeio"
+        "uaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaei"
+        "ouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouae"
+        "iouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeioua",
+        ['c'] =
+        "bglqvzfkptydjnsxchmrwbglqvzfkptydjnsxchmrwbglqvzfkptydjnsxchmrwb"
+        "glqvzfkptydjnsxchmrwbglqvzfkptydjnsxchmrwbglqvzfkptydjnsxchmrwbg"
+        "ptydjnsxchmrwbglqvzfkptydjnsxchmrwbglqvzfkptydjnsxchmrwbglqvzfkp"
+        "tydjnsxchmrwbglqvzfkptydjnsxchmrwbglqvzfkptydjnsxchmrwbglqvzfkpt",
+        ['A'] =
+        "AWRMHCIYTPKFUAWRMHCIYTPKFUAWRMHCIYTPKFUAWRMHCIYTPKFUAWRMHCIYTPKF"
+        "UAWRMHCIYTPKFUAWRMHCIYTPKFUAWRMHCIYTPKFUAWRMHCIYTPKFUAWRMHCIYTPK"
+        "OZVQLGBEXSNJDOZVQLGBEXSNJDOZVQLGBEXSNJDOZVQLGBEXSNJDOZVQLGBEXSNJ"
+        "DOZVQLGBEXSNJDOZVQLGBEXSNJDOZVQLGBEXSNJDOZVQLGBEXSNJDOZVQLGBEXSN",
+        ['a'] =
+        "AwrmhcXSNJDoUAwrmhcXSNJDoUAwrmhcXSNJDoUAwrmhcXSNJDoUAwrmhcXSNJDo"
+        "UAwrmhcXSNJDoUAwrmhcXSNJDoUAwrmhcXSNJDoUAwrmhcXSNJDoUAwrmhcXSNJD"
+        "OzvqlgbWRMHCiOzvqlgbWRMHCiOzvqlgbWRMHCiOzvqlgbWRMHCiOzvqlgbWRMHC"
+        "iOzvqlgbWRMHCiOzvqlgbWRMHCiOzvqlgbWRMHCiOzvqlgbWRMHCiOzvqlgbWRMH",
+        ['n'] =
+        "0628406284062840628406284062840628406284062840628406284062840628"
+        "4062840628406284062840628406284062840628406284062840628406284062"
+        "3951739517395173951739517395173951739517395173951739517395173951"
+        "7395173951739517395173951739517395173951739517395173951739517395",
+        ['o'] =
+        "@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@"
+        "'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'_@'"
+        ".!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!]."
+        "!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!].!",
+        ['x'] =
+        "AmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cA"
+        "mowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAmowJ4S#cAm"
+        "vH3R@b)livH3R@b)livH3R@b)livH3R@b)livH3R@b)livH3R@b)livH3R@b)liv"
+        "H3R@b)livH3R@b)livH3R@b)livH3R@b)livH3R@b)livH3R@b)livH3R@b)livH",
+        [' '] =
+        "                                                                "
+        "                                                                "
+        "                                                                "
+        "                                                                "
+};
+
+const char savedhi_class_character_v0(char characterClass, uint8_t seedByte) {
+
+    const char *encodings = (unsigned char)characterClass < 128? savedhi_class_encodings_v0[(unsigned char)characterClass]: NULL;
+    if (!encodings) {
+        wrn( "Unknown character class: %c", characterClass );
         return '\0';
+    }
 
-    return classCharacters[classIndex % strlen( classCharacters )];
+    return encodings[seedByte];
 }
 
 // Algorithm version overrides.
@@ -52,108 +112,120 @@ bool savedhi_user_key_v0(
     trc( "keyScope: %s", keyScope );
 
     // Calculate the user key salt.
+    size_t userNameSize, userNameChars = savedhi_utf8_measure( userName, &userNameSize );
     trc( "userKeySalt: keyScope=%s | #userName=%s | userName=%s",
-            keyScope, savedhi_hex_l( (uint32_t)savedhi_utf8_char_count( userName ), (char[9]){ 0 } ), userName );
-    size_t userKeySaltSize = 0;
-    uint8_t *userKeySalt = NULL;
-    if (!(savedhi_buf_push( &userKeySalt, &userKeySaltSize, keyScope ) &&
-          savedhi_buf_push( &userKeySalt, &userKeySaltSize, (uint32_t)savedhi_utf8_char_count( userName ) ) &&
-          savedhi_buf_push( &userKeySalt, &userKeySaltSize, userName )) || !userKeySalt) {
-        savedhi_free( &userKeySalt, userKeySaltSize );
+            keyScope, savedhi_hex_l( (uint32_t)userNameChars, (char[9]){ 0 } ), userName );
+    savedhiBuffer userKeySalt;
+    if (!savedhi_buffer_init( &userKeySalt, strlen( keyScope ) + sizeof( uint32_t ) + userNameSize ) ||
+        !(savedhi_buffer_push( &userKeySalt, keyScope ) &&
+          savedhi_buffer_push( &userKeySalt, (uint32_t)userNameChars ) &&
+          savedhi_buffer_push( &userKeySalt, userName ))) {
+        savedhi_buffer_free( &userKeySalt );
         err( "Could not allocate user key salt: %s", strerror( errno ) );
         return false;
     }
-    trc( "  => userKeySalt.id: %s", savedhi_id_buf( userKeySalt, userKeySaltSize ).hex );
+    trc( "  => userKeySalt.id: %s", savedhi_id_buf( userKeySalt.bytes, userKeySalt.size ).hex );
 
     // Calculate the user key.
     trc( "userKey: scrypt( userSecret, userKeySalt, N=%lu, r=%u, p=%u )", savedhi_N, savedhi_r, savedhi_p );
     bool success = savedhi_kdf_scrypt( (uint8_t *)userKey->bytes, sizeof( userKey->bytes ),
-            (uint8_t *)userSecret, strlen( userSecret ), userKeySalt, userKeySaltSize, savedhi_N, savedhi_r, savedhi_p );
-    savedhi_free( &userKeySalt, userKeySaltSize );
+            (uint8_t *)userSecret, strlen( userSecret ), userKeySalt.bytes, userKeySalt.size, savedhi_N, savedhi_r, savedhi_p );
+    savedhi_buffer_free( &userKeySalt );
 
     if (!success)
         err( "Could not derive user key: %s", strerror( errno ) );
-    else {
-        savedhiKeyID keyID = savedhi_id_buf( userKey->bytes, sizeof( userKey->bytes ) );
-        memcpy( (savedhiKeyID *)&userKey->keyID, &keyID, sizeof( userKey->keyID ) );
-        trc( "  => userKey.id: %s (algorithm: %d:0)", userKey->keyID.hex, userKey->algorithm );
-    }
+    else
+        trc( "  => userKey.id: %s (algorithm: %d:0)", savedhi_user_key_id( userKey )->hex, userKey->algorithm );
     return success;
 }
 
-bool savedhi_site_key_v0(
-        const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
-        savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext) {
-
-    const char *keyScope = savedhi_purpose_scope( keyPurpose );
-    trc( "keyScope: %s", keyScope );
+bool savedhi_site_salt_v0(
+        savedhiBuffer *siteSalt, const char *keyScope, const char *siteName, savedhiCounter keyCounter, const char *keyContext) {
 
     // OTP counter value.
     if (keyCounter == savedhiCounterTOTP)
         keyCounter = ((savedhiCounter)time( NULL ) / savedhi_otp_window) * savedhi_otp_window;
 
     // Calculate the site seed.
-    trc( "siteSalt: keyScope=%s | #siteName=%s | siteName=%s | keyCounter=%s | #keyContext=%s | keyContext=%s",
-            keyScope, savedhi_hex_l( (uint32_t)savedhi_utf8_char_count( siteName ), (char[9]){ 0 } ), siteName,
+    size_t siteNameSize, siteNameChars = savedhi_utf8_measure( siteName, &siteNameSize );
+    size_t keyContextSize, keyContextChars = savedhi_utf8_measure( keyContext, &keyContextSize );
+    trc( "siteSalt: #siteName=%s | siteName=%s | keyCounter=%s | #keyContext=%s | keyContext=%s",
+            savedhi_hex_l( (uint32_t)siteNameChars, (char[9]){ 0 } ), siteName,
             savedhi_hex_l( keyCounter, (char[9]){ 0 } ),
-            keyContext? savedhi_hex_l( (uint32_t)savedhi_utf8_char_count( keyContext ), (char[9]){ 0 } ): NULL, keyContext );
-    size_t siteSaltSize = 0;
-    uint8_t *siteSalt = NULL;
-    if (!(savedhi_buf_push( &siteSalt, &siteSaltSize, keyScope ) &&
-          savedhi_buf_push( &siteSalt, &siteSaltSize, (uint32_t)savedhi_utf8_char_count( siteName ) ) &&
-          savedhi_buf_push( &siteSalt, &siteSaltSize, siteName ) &&
-          savedhi_buf_push( &siteSalt, &siteSaltSize, (uint32_t)keyCounter ) &&
+            keyContext? savedhi_hex_l( (uint32_t)keyContextChars, (char[9]){ 0 } ): NULL, keyContext );
+    size_t siteSaltCapacity = (keyScope? strlen( keyScope ): 0) + sizeof( uint32_t ) + siteNameSize + sizeof( uint32_t ) +
+                              (keyContext? sizeof( uint32_t ) + keyContextSize: 0);
+    if (!savedhi_buffer_init( siteSalt, siteSaltCapacity ) ||
+        !((!keyScope || savedhi_buffer_push( siteSalt, keyScope )) &&
+          savedhi_buffer_push( siteSalt, (uint32_t)siteNameChars ) &&
+          savedhi_buffer_push( siteSalt, siteName ) &&
+          savedhi_buffer_push( siteSalt, (uint32_t)keyCounter ) &&
           (!keyContext? true:
-           savedhi_buf_push( &siteSalt, &siteSaltSize, (uint32_t)savedhi_utf8_char_count( keyContext ) ) &&
-           savedhi_buf_push( &siteSalt, &siteSaltSize, keyContext ))) || !siteSalt) {
+           savedhi_buffer_push( siteSalt, (uint32_t)keyContextChars ) &&
+           savedhi_buffer_push( siteSalt, keyContext )))) {
+        savedhi_buffer_free( siteSalt );
         err( "Could not allocate site salt: %s", strerror( errno ) );
         return false;
     }
-    trc( "  => siteSalt.id: %s", savedhi_id_buf( siteSalt, siteSaltSize ).hex );
+    trc( "  => siteSalt.id: %s", savedhi_id_buf( siteSalt->bytes, siteSalt->size ).hex );
 
-    trc( "siteKey: hmac-sha256( userKey.id=%s, siteSalt )", userKey->keyID.hex );
-    bool success = savedhi_hash_hmac_sha256( (uint8_t *)siteKey->bytes,
-            userKey->bytes, sizeof( userKey->bytes ), siteSalt, siteSaltSize );
-    savedhi_free( &siteSalt, siteSaltSize );
+    return true;
+}
+
+bool savedhi_site_key_v0(
+        const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
+        savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    const char *keyScope = savedhi_purpose_scope( keyPurpose );
+    trc( "keyScope: %s", keyScope );
+    if (!keyScope)
+        return false;
+
+    // Calculate the site seed, following the key scope absorbed by the user key's purpose state.
+    savedhiBuffer siteSalt;
+    if (!savedhi_site_salt_v0( &siteSalt, NULL, siteName, keyCounter, keyContext ))
+        return false;
+
+    trc( "siteKey: hmac-sha256( userKey.id=%s, keyScope | siteSalt )", savedhi_user_key_id( userKey )->hex );
+    bool success = savedhi_hash_hmac_sha256_final( (uint8_t *)siteKey->bytes,
+            &userKey->purposeStates[keyPurpose], siteSalt.bytes, siteSalt.size );
+    savedhi_buffer_free( &siteSalt );
 
     if (!success)
         err( "Could not derive site key: %s", strerror( errno ) );
-    else {
-        savedhiKeyID keyID = savedhi_id_buf( siteKey->bytes, sizeof( siteKey->bytes ) );
-        memcpy( (savedhiKeyID *)&siteKey->keyID, &keyID, sizeof( siteKey->keyID ) );
-        trc( "  => siteKey.id: %s (algorithm: %d:0)", siteKey->keyID.hex, siteKey->algorithm );
-    }
+    else
+        trc( "  => siteKey.id: %s (algorithm: %d:0)", savedhi_site_key_id( siteKey )->hex, siteKey->algorithm );
     return success;
 }
 
-const char *savedhi_site_template_password_v0(
-        __unused const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, __unused const char *resultParam) {
-
-    const char *_siteKey = (const char *)siteKey->bytes;
+bool savedhi_site_template_password_v0(
+        char sitePassword[static 32], __unused const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, __unused const char *resultParam) {
 
     // Determine the template.
-    uint16_t seedByte;
-    savedhi_uint16( (uint16_t)_siteKey[0], (uint8_t *)&seedByte );
+    uint16_t seedByte = savedhi_seed_v0( siteKey->bytes[0] );
     const char *template = savedhi_type_template_v0( resultType, seedByte );
     trc( "template: %u => %s", seedByte, template );
     if (!template)
-        return NULL;
-    if (strlen( template ) > sizeof( siteKey->bytes ) - 1) {
-        err( "Template too long for password seed: %zu", strlen( template ) );
-        return NULL;
+        return false;
+    size_t templateLength = strlen( template );
+    if (templateLength > sizeof( siteKey->bytes ) - 1) {
+        err( "Template too long for password seed: %zu", templateLength );
+        return false;
     }
 
     // Encode the password from the seed using the template.
-    char *const sitePassword = calloc( strlen( template ) + 1, sizeof( char ) );
-    for (size_t c = 0; c < strlen( template ); ++c) {
-        savedhi_uint16( (uint16_t)_siteKey[c + 1], (uint8_t *)&seedByte );
-        sitePassword[c] = savedhi_class_character_v0( template[c], seedByte );
-        trc( "  - class: %c, index: %5u (0x%.2hX) => character: %c",
-                template[c], seedByte, seedByte, sitePassword[c] );
-    }
+    for (size_t c = 0; c < templateLength; ++c)
+        sitePassword[c] = savedhi_class_character_v0( template[c], siteKey->bytes[c + 1] );
+    sitePassword[templateLength] = '\0';
+    if (savedhi_verbosity >= savedhiLogLevelTrace)
+        for (size_t c = 0; c < templateLength; ++c) {
+            seedByte = savedhi_seed_v0( siteKey->bytes[c + 1] );
+            trc( "  - class: %c, index: %5u (0x%.2hX) => character: %c",
+                    template[c], seedByte, seedByte, sitePassword[c] );
+        }
     trc( "  => password: %s", sitePassword );
 
-    return sitePassword;
+    return true;
 }
 
 const char *savedhi_site_crypted_password_v0(
@@ -181,19 +253,19 @@ const char *savedhi_site_crypted_password_v0(
     }
     trc( "b64 decoded: %zu bytes = %s", bufSize, hex = savedhi_hex( cipherBuf, bufSize, hex, &hexSize ) );
 
-    // Decrypt
-    const uint8_t *plainBytes = savedhi_aes_decrypt( userKey->bytes, sizeof( userKey->bytes ), cipherBuf, &bufSize );
-    savedhi_free( &cipherBuf, cipherBufSize );
-    const char *plainText = savedhi_strndup( (char *)plainBytes, bufSize );
-    if (!plainText)
+    // Decrypt, in place
+    const char *plainText = NULL;
+    if (!savedhi_aes_decrypt_into( &userKey->aesKey, cipherBuf, &bufSize ))
+        err( "Malformed encrypted state, not AES blocks." );
+    else if (!(plainText = savedhi_strndup( (char *)cipherBuf, bufSize )))
         err( "AES decryption error: %s", strerror( errno ) );
     else if (!savedhi_utf8_char_count( plainText ))
         trc( "decrypted -> plainText: %zu chars = (illegal UTF-8) :: %zu bytes = %s",
-                strlen( plainText ), bufSize, hex = savedhi_hex( plainBytes, bufSize, hex, &hexSize ) );
+                strlen( plainText ), bufSize, hex = savedhi_hex( cipherBuf, bufSize, hex, &hexSize ) );
     else
         trc( "decrypted -> plainText: %zu chars = %s :: %zu bytes = %s",
-                strlen( plainText ), plainText, bufSize, hex = savedhi_hex( plainBytes, bufSize, hex, &hexSize ) );
-    savedhi_free( &plainBytes, bufSize );
+                strlen( plainText ), plainText, bufSize, hex = savedhi_hex( cipherBuf, bufSize, hex, &hexSize ) );
+    savedhi_free( &cipherBuf, cipherBufSize );
     savedhi_free_string( &hex );
 
     return plainText;
@@ -245,12 +317,13 @@ const char *savedhi_site_derived_password_v0(
 const char *savedhi_site_state_v0(
         const savedhiUserKey *userKey, __unused const savedhiSiteKey *siteKey, __unused savedhiResultType resultType, const char *plainText) {
 
-    // Encrypt
+    // Encrypt, in place
     char *hex = NULL;
-    size_t bufSize = strlen( plainText ), hexSize = 0;
-    const uint8_t *cipherBuf = savedhi_aes_encrypt( userKey->bytes, sizeof( userKey->bytes ), (const uint8_t *)plainText, &bufSize );
-    if (!cipherBuf) {
+    size_t bufSize = strlen( plainText ), cipherBufSize = savedhi_aes_encrypt_size( bufSize ), hexSize = 0;
+    uint8_t *cipherBuf = malloc( cipherBufSize );
+    if (!cipherBuf || !memcpy( cipherBuf, plainText, bufSize ) || !savedhi_aes_encrypt_into( &userKey->aesKey, cipherBuf, &bufSize )) {
         err( "AES encryption error: %s", strerror( errno ) );
+        savedhi_free( &cipherBuf, cipherBufSize );
         return NULL;
     }
     trc( "cipherBuf: %zu bytes = %s", bufSize, hex = savedhi_hex( cipherBuf, bufSize, hex, &hexSize ) );
@@ -263,7 +336,7 @@ const char *savedhi_site_state_v0(
     }
     else
         trc( "b64 encoded -> cipherText: %s", cipherText );
-    savedhi_free( &cipherBuf, bufSize );
+    savedhi_free( &cipherBuf, cipherBufSize );
     savedhi_free_string( &hex );
 
     return cipherText;
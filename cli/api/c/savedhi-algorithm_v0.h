@@ -14,18 +14,23 @@
 #define _savedhi_ALGORITHM_V0_H
 
 #include "savedhi-algorithm.h"
+#include "savedhi-util.h"
 
+const uint16_t savedhi_seed_v0(
+        const uint8_t seedByte);
 const char *savedhi_type_template_v0(
         savedhiResultType type, uint16_t templateIndex);
 const char savedhi_class_character_v0(
-        char characterClass, uint16_t classIndex);
+        char characterClass, uint8_t seedByte);
 bool savedhi_user_key_v0(
         const savedhiUserKey *userKey, const char *userName, const char *userSecret);
+bool savedhi_site_salt_v0(
+        savedhiBuffer *siteSalt, const char *keyScope, const char *siteName, savedhiCounter keyCounter, const char *keyContext);
 bool savedhi_site_key_v0(
         const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
         savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext);
-const char *savedhi_site_template_password_v0(
-        const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam);
+bool savedhi_site_template_password_v0(
+        char sitePassword[static 32], const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam);
 const char *savedhi_site_crypted_password_v0(
         const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *cipherText);
 const char *savedhi_site_derived_password_v0(
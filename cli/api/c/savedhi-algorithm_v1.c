@@ -29,6 +29,12 @@ bool savedhi_user_key_v1(
     return savedhi_user_key_v0( userKey, userName, userSecret );
 }
 
+bool savedhi_site_salt_v1(
+        savedhiBuffer *siteSalt, const char *keyScope, const char *siteName, savedhiCounter keyCounter, const char *keyContext) {
+
+    return savedhi_site_salt_v0( siteSalt, keyScope, siteName, keyCounter, keyContext );
+}
+
 bool savedhi_site_key_v1(
         const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
         savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext) {
@@ -36,31 +42,34 @@ bool savedhi_site_key_v1(
     return savedhi_site_key_v0( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
 }
 
-const char *savedhi_site_template_password_v1(
-        __unused const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, __unused const char *resultParam) {
+bool savedhi_site_template_password_v1(
+        char sitePassword[static 32], __unused const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, __unused const char *resultParam) {
 
     // Determine the template.
     uint8_t seedByte = siteKey->bytes[0];
     const char *template = savedhi_type_template( resultType, seedByte );
     trc( "template: %u => %s", seedByte, template );
     if (!template)
-        return NULL;
-    if (strlen( template ) > sizeof( siteKey->bytes ) - 1) {
-        err( "Template too long for password seed: %zu", strlen( template ) );
-        return NULL;
+        return false;
+    size_t templateLength = strlen( template );
+    if (templateLength > sizeof( siteKey->bytes ) - 1) {
+        err( "Template too long for password seed: %zu", templateLength );
+        return false;
     }
 
     // Encode the password from the seed using the template.
-    char *const sitePassword = calloc( strlen( template ) + 1, sizeof( char ) );
-    for (size_t c = 0; c < strlen( template ); ++c) {
-        seedByte = siteKey->bytes[c + 1];
-        sitePassword[c] = savedhi_class_character( template[c], seedByte );
-        trc( "  - class: %c, index: %3u (0x%.2hhX) => character: %c",
-                template[c], seedByte, seedByte, sitePassword[c] );
-    }
+    for (size_t c = 0; c < templateLength; ++c)
+        sitePassword[c] = savedhi_class_character( template[c], siteKey->bytes[c + 1] );
+    sitePassword[templateLength] = '\0';
+    if (savedhi_verbosity >= savedhiLogLevelTrace)
+        for (size_t c = 0; c < templateLength; ++c) {
+            seedByte = siteKey->bytes[c + 1];
+            trc( "  - class: %c, index: %3u (0x%.2hhX) => character: %c",
+                    template[c], seedByte, seedByte, sitePassword[c] );
+        }
     trc( "  => password: %s", sitePassword );
 
-    return sitePassword;
+    return true;
 }
 
 const char *savedhi_site_crypted_password_v1(
@@ -31,54 +31,66 @@ bool savedhi_user_key_v2(
     return savedhi_user_key_v1( userKey, userName, userSecret );
 }
 
-bool savedhi_site_key_v2(
-        const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
-        savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext) {
-
-    const char *keyScope = savedhi_purpose_scope( keyPurpose );
-    trc( "keyScope: %s", keyScope );
+bool savedhi_site_salt_v2(
+        savedhiBuffer *siteSalt, const char *keyScope, const char *siteName, savedhiCounter keyCounter, const char *keyContext) {
 
     // OTP counter value.
     if (keyCounter == savedhiCounterTOTP)
         keyCounter = ((savedhiCounter)time( NULL ) / savedhi_otp_window) * savedhi_otp_window;
 
     // Calculate the site seed.
-    trc( "siteSalt: keyScope=%s | #siteName=%s | siteName=%s | keyCounter=%s | #keyContext=%s | keyContext=%s",
-            keyScope, savedhi_hex_l( (uint32_t)strlen( siteName ), (char[9]){ 0 } ), siteName, savedhi_hex_l( keyCounter, (char[9]){ 0 } ),
+    trc( "siteSalt: #siteName=%s | siteName=%s | keyCounter=%s | #keyContext=%s | keyContext=%s",
+            savedhi_hex_l( (uint32_t)strlen( siteName ), (char[9]){ 0 } ), siteName, savedhi_hex_l( keyCounter, (char[9]){ 0 } ),
             keyContext? savedhi_hex_l( (uint32_t)strlen( keyContext ), (char[9]){ 0 } ): NULL, keyContext );
-    size_t siteSaltSize = 0;
-    uint8_t *siteSalt = NULL;
-    if (!(savedhi_buf_push( &siteSalt, &siteSaltSize, keyScope ) &&
-          savedhi_buf_push( &siteSalt, &siteSaltSize, (uint32_t)strlen( siteName ) ) &&
-          savedhi_buf_push( &siteSalt, &siteSaltSize, siteName ) &&
-          savedhi_buf_push( &siteSalt, &siteSaltSize, (uint32_t)keyCounter ) &&
+    size_t siteSaltCapacity = (keyScope? strlen( keyScope ): 0) + sizeof( uint32_t ) + strlen( siteName ) + sizeof( uint32_t ) +
+                              (keyContext? sizeof( uint32_t ) + strlen( keyContext ): 0);
+    if (!savedhi_buffer_init( siteSalt, siteSaltCapacity ) ||
+        !((!keyScope || savedhi_buffer_push( siteSalt, keyScope )) &&
+          savedhi_buffer_push( siteSalt, (uint32_t)strlen( siteName ) ) &&
+          savedhi_buffer_push( siteSalt, siteName ) &&
+          savedhi_buffer_push( siteSalt, (uint32_t)keyCounter ) &&
           (!keyContext? true:
-           savedhi_buf_push( &siteSalt, &siteSaltSize, (uint32_t)strlen( keyContext ) ) &&
-           savedhi_buf_push( &siteSalt, &siteSaltSize, keyContext ))) || !siteSalt) {
+           savedhi_buffer_push( siteSalt, (uint32_t)strlen( keyContext ) ) &&
+           savedhi_buffer_push( siteSalt, keyContext )))) {
+        savedhi_buffer_free( siteSalt );
         err( "Could not allocate site salt: %s", strerror( errno ) );
         return false;
     }
-    trc( "  => siteSalt.id: %s", savedhi_id_buf( siteSalt, siteSaltSize ).hex );
+    trc( "  => siteSalt.id: %s", savedhi_id_buf( siteSalt->bytes, siteSalt->size ).hex );
+
+    return true;
+}
+
+bool savedhi_site_key_v2(
+        const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
+        savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    const char *keyScope = savedhi_purpose_scope( keyPurpose );
+    trc( "keyScope: %s", keyScope );
+    if (!keyScope)
+        return false;
+
+    // Calculate the site seed, following the key scope absorbed by the user key's purpose state.
+    savedhiBuffer siteSalt;
+    if (!savedhi_site_salt_v2( &siteSalt, NULL, siteName, keyCounter, keyContext ))
+        return false;
 
-    trc( "siteKey: hmac-sha256( userKey.id=%s, siteSalt )", userKey->keyID.hex );
-    bool success = savedhi_hash_hmac_sha256( (uint8_t *)siteKey->bytes,
-            userKey->bytes, sizeof( userKey->bytes ), siteSalt, siteSaltSize );
-    savedhi_free( &siteSalt, siteSaltSize );
+    trc( "siteKey: hmac-sha256( userKey.id=%s, keyScope | siteSalt )", savedhi_user_key_id( userKey )->hex );
+    bool success = savedhi_hash_hmac_sha256_final( (uint8_t *)siteKey->bytes,
+            &userKey->purposeStates[keyPurpose], siteSalt.bytes, siteSalt.size );
+    savedhi_buffer_free( &siteSalt );
 
     if (!success)
         err( "Could not derive site key: %s", strerror( errno ) );
-    else {
-        savedhiKeyID keyID = savedhi_id_buf( siteKey->bytes, sizeof( siteKey->bytes ) );
-        memcpy( (savedhiKeyID *)&siteKey->keyID, &keyID, sizeof( siteKey->keyID ) );
-        trc( "  => siteKey.id: %s (algorithm: %d:2)", siteKey->keyID.hex, siteKey->algorithm );
-    }
+    else
+        trc( "  => siteKey.id: %s (algorithm: %d:2)", savedhi_site_key_id( siteKey )->hex, siteKey->algorithm );
     return success;
 }
 
-const char *savedhi_site_template_password_v2(
-        const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam) {
+bool savedhi_site_template_password_v2(
+        char sitePassword[static 32], const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam) {
 
-    return savedhi_site_template_password_v1( userKey, siteKey, resultType, resultParam );
+    return savedhi_site_template_password_v1( sitePassword, userKey, siteKey, resultType, resultParam );
 }
 
 const char *savedhi_site_crypted_password_v2(
@@ -33,33 +33,36 @@ bool savedhi_user_key_v3(
     // Calculate the user key salt.
     trc( "userKeySalt: keyScope=%s | #userName=%s | userName=%s",
             keyScope, savedhi_hex_l( (uint32_t)strlen( userName ), (char[9]){ 0 } ), userName );
-    size_t userKeySaltSize = 0;
-    uint8_t *userKeySalt = NULL;
-    if (!(savedhi_buf_push( &userKeySalt, &userKeySaltSize, keyScope ) &&
-          savedhi_buf_push( &userKeySalt, &userKeySaltSize, (uint32_t)strlen( userName ) ) &&
-          savedhi_buf_push( &userKeySalt, &userKeySaltSize, userName )) || !userKeySalt) {
-        savedhi_free( &userKeySalt, userKeySaltSize );
+    savedhiBuffer userKeySalt;
+    if (!savedhi_buffer_init( &userKeySalt, strlen( keyScope ) + sizeof( uint32_t ) + strlen( userName ) ) ||
+        !(savedhi_buffer_push( &userKeySalt, keyScope ) &&
+          savedhi_buffer_push( &userKeySalt, (uint32_t)strlen( userName ) ) &&
+          savedhi_buffer_push( &userKeySalt, userName ))) {
+        savedhi_buffer_free( &userKeySalt );
         err( "Could not allocate user key salt: %s", strerror( errno ) );
         return false;
     }
-    trc( "  => userKeySalt.id: %s", savedhi_id_buf( userKeySalt, userKeySaltSize ).hex );
+    trc( "  => userKeySalt.id: %s", savedhi_id_buf( userKeySalt.bytes, userKeySalt.size ).hex );
 
     // Calculate the user key.
     trc( "userKey: scrypt( userSecret, userKeySalt, N=%lu, r=%u, p=%u )", savedhi_N, savedhi_r, savedhi_p );
     bool success = savedhi_kdf_scrypt( (uint8_t *)userKey->bytes, sizeof( userKey->bytes ),
-            (uint8_t *)userSecret, strlen( userSecret ), userKeySalt, userKeySaltSize, savedhi_N, savedhi_r, savedhi_p );
-    savedhi_free( &userKeySalt, userKeySaltSize );
+            (uint8_t *)userSecret, strlen( userSecret ), userKeySalt.bytes, userKeySalt.size, savedhi_N, savedhi_r, savedhi_p );
+    savedhi_buffer_free( &userKeySalt );
 
     if (!success)
         err( "Could not derive user key: %s", strerror( errno ) );
-    else {
-        savedhiKeyID keyID = savedhi_id_buf( userKey->bytes, sizeof( userKey->bytes ) );
-        memcpy( (savedhiKeyID *)&userKey->keyID, &keyID, sizeof( userKey->keyID ) );
-        trc( "  => userKey.id: %s (algorithm: %d:3)", userKey->keyID.hex, userKey->algorithm );
-    }
+    else
+        trc( "  => userKey.id: %s (algorithm: %d:3)", savedhi_user_key_id( userKey )->hex, userKey->algorithm );
     return success;
 }
 
+bool savedhi_site_salt_v3(
+        savedhiBuffer *siteSalt, const char *keyScope, const char *siteName, savedhiCounter keyCounter, const char *keyContext) {
+
+    return savedhi_site_salt_v2( siteSalt, keyScope, siteName, keyCounter, keyContext );
+}
+
 bool savedhi_site_key_v3(
         const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
         savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext) {
@@ -67,10 +70,10 @@ bool savedhi_site_key_v3(
     return savedhi_site_key_v2( siteKey, userKey, siteName, keyCounter, keyPurpose, keyContext );
 }
 
-const char *savedhi_site_template_password_v3(
-        const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam) {
+bool savedhi_site_template_password_v3(
+        char sitePassword[static 32], const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam) {
 
-    return savedhi_site_template_password_v2( userKey, siteKey, resultType, resultParam );
+    return savedhi_site_template_password_v2( sitePassword, userKey, siteKey, resultType, resultParam );
 }
 
 const char *savedhi_site_crypted_password_v3(
@@ -21,11 +21,13 @@ const char savedhi_class_character_v3(
         char characterClass, uint16_t classIndex);
 bool savedhi_user_key_v3(
         const savedhiUserKey *userKey, const char *userName, const char *userSecret);
+bool savedhi_site_salt_v3(
+        savedhiBuffer *siteSalt, const char *keyScope, const char *siteName, savedhiCounter keyCounter, const char *keyContext);
 bool savedhi_site_key_v3(
         const savedhiSiteKey *siteKey, const savedhiUserKey *userKey, const char *siteName,
         savedhiCounter keyCounter, savedhiKeyPurpose keyPurpose, const char *keyContext);
-const char *savedhi_site_template_password_v3(
-        const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam);
+bool savedhi_site_template_password_v3(
+        char sitePassword[static 32], const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *resultParam);
 const char *savedhi_site_crypted_password_v3(
         const savedhiUserKey *userKey, const savedhiSiteKey *siteKey, savedhiResultType resultType, const char *cipherText);
 const char *savedhi_site_derived_password_v3(
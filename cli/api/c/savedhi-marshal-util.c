@@ -170,27 +170,13 @@ void savedhi_set_json_data(
 
     // Object
     if (type == json_type_object) {
+        savedhi_marshal_data_reserve( data, max( data->children_count, (size_t)json_object_object_length( obj ) ) );
         json_object_iter entry;
         json_object_object_foreachC( obj, entry ) {
-            savedhiMarshalledData *child = NULL;
-
-            // Find existing child.
-            for (size_t c = 0; c < data->children_count; ++c)
-                if (data->children[c].obj_key == entry.key ||
-                    (data->children[c].obj_key && entry.key && strcmp( data->children[c].obj_key, entry.key ) == OK)) {
-                    child = &data->children[c];
-                    break;
-                }
-
-            // Create new child.
-            if (!child) {
-                if (!savedhi_realloc( &data->children, NULL, savedhiMarshalledData, ++data->children_count )) {
-                    --data->children_count;
-                    continue;
-                }
-                *(child = &data->children[data->children_count - 1]) = (savedhiMarshalledData){ .obj_key = savedhi_strdup( entry.key ) };
-                savedhi_marshal_data_set_null( child, NULL );
-            }
+            // Find existing child or create new child.
+            savedhiMarshalledData *child = entry.key? savedhi_marshal_data_get( data, entry.key, NULL ): NULL;
+            if (!child)
+                continue;
 
             savedhi_set_json_data( child, entry.val );
         }
@@ -198,6 +184,7 @@ void savedhi_set_json_data(
 
     // Array
     if (type == json_type_array) {
+        savedhi_marshal_data_reserve( data, json_object_array_length( obj ) );
         for (size_t index = 0; index < json_object_array_length( obj ); ++index) {
             savedhiMarshalledData *child = NULL;
 
@@ -205,11 +192,9 @@ void savedhi_set_json_data(
                 child = &data->children[index];
 
             else {
-                if (!savedhi_realloc( &data->children, NULL, savedhiMarshalledData, ++data->children_count )) {
-                    --data->children_count;
+                if (!savedhi_marshal_data_reserve( data, data->children_count + 1 ))
                     continue;
-                }
-                *(child = &data->children[data->children_count - 1]) = (savedhiMarshalledData){ .arr_index = index };
+                *(child = &data->children[data->children_count++]) = (savedhiMarshalledData){ .arr_index = index };
                 savedhi_marshal_data_set_null( child, NULL );
             }
 
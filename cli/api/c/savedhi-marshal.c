@@ -15,17 +15,30 @@
 #include "savedhi-util.h"
 #include "savedhi-marshal-util.h"
 
+#if defined( _WIN32 )
+#define savedhi_MARSHAL_THREADS 0
+#else
+#define savedhi_MARSHAL_THREADS 1
+#endif
+
 savedhi_LIBS_BEGIN
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#if savedhi_MARSHAL_THREADS
+#include <pthread.h>
+#endif
 savedhi_LIBS_END
 
 static savedhiKeyProviderProxy __savedhi_proxy_provider_current = NULL;
-static const savedhiUserKey *__savedhi_proxy_provider_current_key = NULL;
-static savedhiAlgorithm __savedhi_proxy_provider_current_algorithm = (savedhiAlgorithm)ERR;
+static const savedhiUserKey *__savedhi_proxy_provider_current_keys[savedhiAlgorithmLast + 1] = { NULL };
+/** Reset to ERR by __savedhi_proxy_provider_flush, whenever a provider is set. */
+static savedhiAlgorithm __savedhi_proxy_provider_current_algorithms[savedhiAlgorithmLast + 1];
+static const char *__savedhi_proxy_provider_current_userName = NULL;
 static const char *__savedhi_proxy_provider_current_secret = NULL;
+static savedhiKeyProviderStats __savedhi_proxy_provider_current_stats = { 0 };
+static unsigned int savedhi_marshal_threads_count = 1;
 
 static bool __savedhi_proxy_provider_secret(const savedhiUserKey **currentKey, savedhiAlgorithm *currentAlgorithm,
         savedhiAlgorithm algorithm, const char *userName) {
@@ -36,15 +49,49 @@ static bool __savedhi_proxy_provider_secret(const savedhiUserKey **currentKey, s
     return savedhi_update_user_key( currentKey, currentAlgorithm, algorithm, userName, __savedhi_proxy_provider_current_secret );
 }
 
+static void __savedhi_proxy_provider_flush() {
+
+    for (savedhiAlgorithm a = savedhiAlgorithmFirst; a <= savedhiAlgorithmLast; ++a) {
+        savedhi_free( &__savedhi_proxy_provider_current_keys[a], sizeof( *__savedhi_proxy_provider_current_keys[a] ) );
+        __savedhi_proxy_provider_current_algorithms[a] = (savedhiAlgorithm)ERR;
+    }
+    savedhi_free_string( &__savedhi_proxy_provider_current_userName );
+}
+
 static const savedhiUserKey *__savedhi_proxy_provider(savedhiAlgorithm algorithm, const char *userName) {
 
     if (!__savedhi_proxy_provider_current)
         return NULL;
+    if (algorithm < savedhiAlgorithmFirst || algorithm > savedhiAlgorithmLast || !userName) {
+        // Not a key request, the provider is being freed.
+        __savedhi_proxy_provider_flush();
+        return NULL;
+    }
+
+    // Keys are cached per algorithm for a single user; a different user invalidates them all.
+    if (__savedhi_proxy_provider_current_userName && strcmp( __savedhi_proxy_provider_current_userName, userName ) != OK)
+        __savedhi_proxy_provider_flush();
+    if (!__savedhi_proxy_provider_current_userName)
+        __savedhi_proxy_provider_current_userName = savedhi_strdup( userName );
+
+    // Versions whose user key salts agree for this user share one key stretch.
+    for (savedhiAlgorithm a = savedhiAlgorithmFirst; a <= savedhiAlgorithmLast && !__savedhi_proxy_provider_current_keys[algorithm]; ++a)
+        if ((__savedhi_proxy_provider_current_keys[algorithm] = savedhi_user_key_share(
+                __savedhi_proxy_provider_current_keys[a], userName, algorithm )))
+            __savedhi_proxy_provider_current_algorithms[algorithm] = algorithm;
+
+    const savedhiUserKey *cachedKey = __savedhi_proxy_provider_current_keys[algorithm];
     if (!__savedhi_proxy_provider_current(
-            &__savedhi_proxy_provider_current_key, &__savedhi_proxy_provider_current_algorithm, algorithm, userName ))
+            &__savedhi_proxy_provider_current_keys[algorithm], &__savedhi_proxy_provider_current_algorithms[algorithm],
+            algorithm, userName ))
         return NULL;
 
-    return savedhi_memdup( __savedhi_proxy_provider_current_key, sizeof( *__savedhi_proxy_provider_current_key ) );
+    if (cachedKey && cachedKey == __savedhi_proxy_provider_current_keys[algorithm])
+        ++__savedhi_proxy_provider_current_stats.hits;
+    else
+        ++__savedhi_proxy_provider_current_stats.misses;
+
+    return savedhi_memdup( __savedhi_proxy_provider_current_keys[algorithm], sizeof( *__savedhi_proxy_provider_current_keys[algorithm] ) );
 }
 
 savedhiKeyProvider savedhi_proxy_provider_set_secret(const char *userSecret) {
@@ -63,14 +110,19 @@ savedhiKeyProvider savedhi_proxy_provider_set(const savedhiKeyProviderProxy prox
 
 void savedhi_proxy_provider_unset() {
 
-    savedhi_free( &__savedhi_proxy_provider_current_key, sizeof( *__savedhi_proxy_provider_current_key ) );
-    __savedhi_proxy_provider_current_algorithm = (savedhiAlgorithm)ERR;
+    __savedhi_proxy_provider_flush();
+    __savedhi_proxy_provider_current_stats = (savedhiKeyProviderStats){ 0 };
     if (__savedhi_proxy_provider_current) {
         __savedhi_proxy_provider_current( NULL, NULL, (savedhiAlgorithm)ERR, NULL );
         __savedhi_proxy_provider_current = NULL;
     }
 }
 
+savedhiKeyProviderStats savedhi_proxy_provider_stats() {
+
+    return __savedhi_proxy_provider_current_stats;
+}
+
 void savedhi_key_provider_free(savedhiKeyProvider keyProvider) {
 
     if (keyProvider)
@@ -100,6 +152,7 @@ savedhiMarshalledUser *savedhi_marshal_user(
 
             .sites_count = 0,
             .sites = NULL,
+            .sites_capacity = 0,
     };
     return user;
 }
@@ -110,12 +163,10 @@ savedhiMarshalledSite *savedhi_marshal_site(
 
     if (!siteName)
         return NULL;
-    if (!savedhi_realloc( &user->sites, NULL, savedhiMarshalledSite, ++user->sites_count )) {
-        user->sites_count--;
+    if (!savedhi_marshal_sites_reserve( user, user->sites_count + 1 ))
         return NULL;
-    }
 
-    savedhiMarshalledSite *site = &user->sites[user->sites_count - 1];
+    savedhiMarshalledSite *site = &user->sites[user->sites_count++];
     *site = (savedhiMarshalledSite){
             .siteName = savedhi_strdup( siteName ),
             .algorithm = algorithmVersion,
@@ -133,21 +184,26 @@ savedhiMarshalledSite *savedhi_marshal_site(
 
             .questions_count = 0,
             .questions = NULL,
+            .questions_capacity = 0,
     };
     return site;
 }
 
+bool savedhi_marshal_sites_reserve(
+        savedhiMarshalledUser *user, const size_t sites_count) {
+
+    return user && savedhi_reserve( &user->sites, &user->sites_capacity, savedhiMarshalledSite, sites_count );
+}
+
 savedhiMarshalledQuestion *savedhi_marshal_question(
         savedhiMarshalledSite *site, const char *keyword) {
 
-    if (!savedhi_realloc( &site->questions, NULL, savedhiMarshalledQuestion, ++site->questions_count )) {
-        site->questions_count--;
+    if (!savedhi_marshal_questions_reserve( site, site->questions_count + 1 ))
         return NULL;
-    }
     if (!keyword)
         keyword = "";
 
-    savedhiMarshalledQuestion *question = &site->questions[site->questions_count - 1];
+    savedhiMarshalledQuestion *question = &site->questions[site->questions_count++];
     *question = (savedhiMarshalledQuestion){
             .keyword = savedhi_strdup( keyword ),
             .type = savedhiResultTemplatePhrase,
@@ -156,6 +212,12 @@ savedhiMarshalledQuestion *savedhi_marshal_question(
     return question;
 }
 
+bool savedhi_marshal_questions_reserve(
+        savedhiMarshalledSite *site, const size_t questions_count) {
+
+    return site && savedhi_reserve( &site->questions, &site->questions_capacity, savedhiMarshalledQuestion, questions_count );
+}
+
 savedhiMarshalledFile *savedhi_marshal_file(
         savedhiMarshalledFile *file, savedhiMarshalledInfo *info, savedhiMarshalledData *data) {
 
@@ -211,20 +273,21 @@ void savedhi_marshal_user_free(
     if (!user || !*user)
         return;
 
-    savedhi_free_strings( &(*user)->userName, NULL );
+    savedhi_free_strings( &(*user)->userName, &(*user)->loginState, &(*user)->loginContent, NULL );
 
     for (size_t s = 0; s < (*user)->sites_count; ++s) {
         savedhiMarshalledSite *site = &(*user)->sites[s];
-        savedhi_free_strings( &site->siteName, &site->resultState, &site->loginState, &site->url, NULL );
+        savedhi_free_strings( &site->siteName, &site->resultState, &site->resultContent,
+                &site->loginState, &site->loginContent, &site->url, NULL );
 
         for (size_t q = 0; q < site->questions_count; ++q) {
             savedhiMarshalledQuestion *question = &site->questions[q];
-            savedhi_free_strings( &question->keyword, &question->state, NULL );
+            savedhi_free_strings( &question->keyword, &question->state, &question->stateContent, NULL );
         }
-        savedhi_free( &site->questions, sizeof( savedhiMarshalledQuestion ) * site->questions_count );
+        savedhi_free( &site->questions, sizeof( savedhiMarshalledQuestion ) * site->questions_capacity );
     }
 
-    savedhi_free( &(*user)->sites, sizeof( savedhiMarshalledSite ) * (*user)->sites_count );
+    savedhi_free( &(*user)->sites, sizeof( savedhiMarshalledSite ) * (*user)->sites_capacity );
     savedhi_free( user, sizeof( savedhiMarshalledUser ) );
 }
 
@@ -260,30 +323,105 @@ savedhiMarshalledData *savedhi_marshal_data_new() {
     return data;
 }
 
+/** Objects with fewer children than this are searched without an index. */
+#define savedhi_marshal_data_index_min 8
+
+static size_t savedhi_marshal_data_hash(
+        const char *key) {
+
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *k = (const unsigned char *)key; *k; ++k)
+        hash = (hash ^ *k) * 0x100000001b3ULL;
+
+    return (size_t)hash;
+}
+
+static void savedhi_marshal_data_unindex(
+        savedhiMarshalledData *data) {
+
+    savedhi_free( &data->children_index, sizeof( *data->children_index ) * data->children_index_size );
+    data->children_index_size = 0;
+}
+
+static void savedhi_marshal_data_index_child(
+        savedhiMarshalledData *data, const size_t c) {
+
+    const size_t mask = data->children_index_size - 1;
+    size_t slot = savedhi_marshal_data_hash( data->children[c].obj_key ) & mask;
+    while (data->children_index[slot])
+        slot = (slot + 1) & mask;
+    data->children_index[slot] = c + 1;
+}
+
+/** (Re)build the index of the data's keyed children, keeping at least half of its slots empty.
+ * Without an index, lookups fall back to searching the children. */
+static void savedhi_marshal_data_index(
+        savedhiMarshalledData *data) {
+
+    savedhi_marshal_data_unindex( data );
+    if (data->children_count < savedhi_marshal_data_index_min)
+        return;
+
+    size_t size = savedhi_marshal_data_index_min * 2;
+    while (size < data->children_count * 2)
+        size <<= 1;
+    if (!(data->children_index = calloc( size, sizeof( *data->children_index ) )))
+        return;
+
+    data->children_index_size = size;
+    for (size_t c = 0; c < data->children_count; ++c)
+        if (data->children[c].obj_key)
+            savedhi_marshal_data_index_child( data, c );
+}
+
+static savedhiMarshalledData *savedhi_marshal_data_child(
+        const savedhiMarshalledData *data, const char *key) {
+
+    if (!data->children_index_size) {
+        for (size_t c = 0; c < data->children_count; ++c) {
+            const char *childKey = data->children[c].obj_key;
+            if (childKey && strcmp( key, childKey ) == OK)
+                return &data->children[c];
+        }
+
+        return NULL;
+    }
+
+    const size_t mask = data->children_index_size - 1;
+    for (size_t slot = savedhi_marshal_data_hash( key ) & mask; data->children_index[slot]; slot = (slot + 1) & mask) {
+        savedhiMarshalledData *child = &data->children[data->children_index[slot] - 1];
+        if (strcmp( key, child->obj_key ) == OK)
+            return child;
+    }
+
+    return NULL;
+}
+
+bool savedhi_marshal_data_reserve(
+        savedhiMarshalledData *data, const size_t children_count) {
+
+    return data && savedhi_reserve( &data->children, &data->children_capacity, savedhiMarshalledData, children_count );
+}
+
 savedhiMarshalledData *savedhi_marshal_data_vget(
         savedhiMarshalledData *data, va_list nodes) {
 
     savedhiMarshalledData *parent = data, *child = parent;
     for (const char *node; parent && (node = va_arg( nodes, const char * )); parent = child) {
-        child = NULL;
+        if ((child = savedhi_marshal_data_child( parent, node )))
+            continue;
 
-        for (size_t c = 0; c < parent->children_count; ++c) {
-            const char *key = parent->children[c].obj_key;
-            if (key && strcmp( node, key ) == OK) {
-                child = &parent->children[c];
-                break;
-            }
-        }
+        if (!savedhi_marshal_data_reserve( parent, parent->children_count + 1 ))
+            break;
+        *(child = &parent->children[parent->children_count++]) = (savedhiMarshalledData){ .obj_key = savedhi_strdup( node ) };
+        savedhi_marshal_data_set_null( child, NULL );
+        child->is_null = false;
 
-        if (!child) {
-            if (!savedhi_realloc( &parent->children, NULL, savedhiMarshalledData, ++parent->children_count )) {
-                --parent->children_count;
-                break;
-            }
-            *(child = &parent->children[parent->children_count - 1]) = (savedhiMarshalledData){ .obj_key = savedhi_strdup( node ) };
-            savedhi_marshal_data_set_null( child, NULL );
-            child->is_null = false;
-        }
+        if (parent->children_count * 2 > parent->children_index_size)
+            savedhi_marshal_data_index( parent );
+        else
+            savedhi_marshal_data_index_child( parent, parent->children_count - 1 );
     }
 
     return child;
@@ -304,20 +442,9 @@ const savedhiMarshalledData *savedhi_marshal_data_vfind(
         const savedhiMarshalledData *data, va_list nodes) {
 
     const savedhiMarshalledData *parent = data, *child = parent;
-    for (const char *node; parent && (node = va_arg( nodes, const char * )); parent = child) {
-        child = NULL;
-
-        for (size_t c = 0; c < parent->children_count; ++c) {
-            const char *key = parent->children[c].obj_key;
-            if (key && strcmp( node, key ) == OK) {
-                child = &parent->children[c];
-                break;
-            }
-        }
-
-        if (!child)
+    for (const char *node; parent && (node = va_arg( nodes, const char * )); parent = child)
+        if (!(child = savedhi_marshal_data_child( parent, node )))
             break;
-    }
 
     return child;
 }
@@ -363,8 +490,9 @@ bool savedhi_marshal_data_vset_null(
         savedhi_marshal_data_set_null( &child->children[c], NULL );
         savedhi_free_string( &child->children[c].obj_key );
     }
-    savedhi_free( &child->children, sizeof( savedhiMarshalledData ) * child->children_count );
-    child->children_count = 0;
+    savedhi_free( &child->children, sizeof( savedhiMarshalledData ) * child->children_capacity );
+    child->children_count = child->children_capacity = 0;
+    savedhi_marshal_data_unindex( child );
     child->num_value = NAN;
     child->is_bool = false;
     child->is_null = true;
@@ -514,37 +642,28 @@ void savedhi_marshal_data_filter(
         savedhiMarshalledData *data, bool (*filter)(savedhiMarshalledData *, void *), void *args) {
 
     size_t children_count = 0;
-    savedhiMarshalledData *children = NULL;
 
     for (size_t c = 0; c < data->children_count; ++c) {
         savedhiMarshalledData *child = &data->children[c];
         if (filter( child, args )) {
-            // Valid child in this object, keep it.
-            ++children_count;
-
-            if (children) {
-                if (!savedhi_realloc( &children, NULL, savedhiMarshalledData, children_count )) {
-                    --children_count;
-                    continue;
-                }
-                child->arr_index = children_count - 1;
-                children[child->arr_index] = *child;
+            // Valid child in this object, keep it, moving it down over the removed children before it.
+            if (children_count < c) {
+                child->arr_index = children_count;
+                data->children[children_count] = *child;
             }
+            ++children_count;
         }
         else {
             // Not a valid child in this object, remove it.
             savedhi_marshal_data_set_null( child, NULL );
             savedhi_free_string( &child->obj_key );
-
-            if (!children)
-                children = savedhi_memdup( data->children, sizeof( savedhiMarshalledData ) * children_count );
         }
     }
 
-    if (children) {
-        savedhi_free( &data->children, sizeof( savedhiMarshalledData ) * data->children_count );
-        data->children = children;
+    if (children_count < data->children_count) {
+        savedhi_zero( &data->children[children_count], sizeof( savedhiMarshalledData ) * (data->children_count - children_count) );
         data->children_count = children_count;
+        savedhi_marshal_data_index( data );
     }
 }
 
@@ -554,6 +673,289 @@ bool savedhi_marshal_data_filter_empty(
     return false;
 }
 
+static const char *savedhi_marshal_state_key(
+        const savedhiUserKey *userKey, const char **state, const char **content,
+        const char *siteName, const savedhiResultType resultType,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    if (*state || !*content)
+        return *state;
+    if (!userKey) {
+        wrn( "Couldn't derive user key for state of: %s", siteName );
+        return NULL;
+    }
+
+    *state = savedhi_site_state( userKey, siteName, resultType, *content, keyCounter, keyPurpose, keyContext );
+    savedhi_free_string( content );
+
+    return *state;
+}
+
+static const char *savedhi_marshal_state(
+        const savedhiMarshalledUser *user, const savedhiAlgorithm algorithm, const char **state, const char **content,
+        const char *siteName, const savedhiResultType resultType,
+        const savedhiCounter keyCounter, const savedhiKeyPurpose keyPurpose, const char *keyContext) {
+
+    if (*state || !*content)
+        return *state;
+
+    const savedhiUserKey *userKey = user->userKeyProvider? user->userKeyProvider( algorithm, user->userName ): NULL;
+    savedhi_marshal_state_key( userKey, state, content, siteName, resultType, keyCounter, keyPurpose, keyContext );
+    savedhi_free( &userKey, sizeof( *userKey ) );
+
+    return *state;
+}
+
+const char *savedhi_marshal_user_login_state(
+        savedhiMarshalledUser *user) {
+
+    if (!user)
+        return NULL;
+
+    return savedhi_marshal_state( user, user->algorithm, &user->loginState, &user->loginContent,
+            user->userName, user->loginType, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+}
+
+const char *savedhi_marshal_site_result_state(
+        const savedhiMarshalledUser *user, savedhiMarshalledSite *site) {
+
+    if (!user || !site)
+        return NULL;
+
+    return savedhi_marshal_state( user, site->algorithm, &site->resultState, &site->resultContent,
+            site->siteName, site->resultType, site->counter, savedhiKeyPurposeAuthentication, NULL );
+}
+
+const char *savedhi_marshal_site_login_state(
+        const savedhiMarshalledUser *user, savedhiMarshalledSite *site) {
+
+    if (!user || !site)
+        return NULL;
+
+    return savedhi_marshal_state( user, site->algorithm, &site->loginState, &site->loginContent,
+            site->siteName, site->loginType, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+}
+
+const char *savedhi_marshal_question_state(
+        const savedhiMarshalledUser *user, const savedhiMarshalledSite *site, savedhiMarshalledQuestion *question) {
+
+    if (!user || !site || !question)
+        return NULL;
+
+    return savedhi_marshal_state( user, site->algorithm, &question->state, &question->stateContent,
+            site->siteName, question->type, savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword );
+}
+
+void savedhi_marshal_threads_set(
+        const unsigned int threads) {
+
+    savedhi_marshal_threads_count = threads? threads: 1;
+}
+
+static bool savedhi_marshal_site_pending(
+        const savedhiMarshalledSite *site) {
+
+    if (site->resultContent || site->loginContent)
+        return true;
+    for (size_t q = 0; q < site->questions_count; ++q)
+        if (site->questions[q].stateContent)
+            return true;
+
+    return false;
+}
+
+/** Resolve the user keys for the algorithms of the user's sites up front, since key providers aren't safe to share with workers.
+ * @param pending Only resolve the keys of sites that hold clear-text content pending encryption.
+ * @return false if a user key could not be resolved. */
+static bool savedhi_marshal_site_keys(
+        const savedhiUserKey *userKeys[static savedhiAlgorithmLast + 1], const savedhiMarshalledUser *user, const bool pending) {
+
+    for (size_t s = 0; s < user->sites_count; ++s) {
+        const savedhiMarshalledSite *site = &user->sites[s];
+        if (site->algorithm > savedhiAlgorithmLast || userKeys[site->algorithm])
+            continue;
+        if (pending && !savedhi_marshal_site_pending( site ))
+            continue;
+
+        if (!user->userKeyProvider || !(userKeys[site->algorithm] = user->userKeyProvider( site->algorithm, user->userName )))
+            return false;
+
+        // The keyID is computed on first use, don't leave that to racing workers.
+        savedhi_user_key_id( userKeys[site->algorithm] );
+    }
+
+    return true;
+}
+
+static void savedhi_marshal_site_keys_free(
+        const savedhiUserKey *userKeys[static savedhiAlgorithmLast + 1]) {
+
+    for (savedhiAlgorithm a = savedhiAlgorithmFirst; a <= savedhiAlgorithmLast; ++a)
+        savedhi_free( &userKeys[a], sizeof( *userKeys[a] ) );
+}
+
+/** Work on one site, which may only modify that site and the site's own slots in args. */
+typedef void (*savedhiMarshalSiteWork)(
+        savedhiMarshalledUser *user, const size_t s, void *args);
+
+typedef struct savedhiMarshalSitesWork {
+    savedhiMarshalledUser *user;
+    savedhiMarshalSiteWork work;
+    void *args;
+    size_t from, to;
+} savedhiMarshalSitesWork;
+
+static void *savedhi_marshal_sites_worker(
+        void *sitesWork_) {
+
+    savedhiMarshalSitesWork *sitesWork = sitesWork_;
+    for (size_t s = sitesWork->from; s < sitesWork->to; ++s)
+        sitesWork->work( sitesWork->user, s, sitesWork->args );
+
+    return NULL;
+}
+
+/** Perform the work for each of the user's sites, split in contiguous ranges of sites over the configured amount of threads.
+ * The calling thread works the first range and waits for the others, so callers can merge the results in site order. */
+static void savedhi_marshal_sites_work(
+        savedhiMarshalledUser *user, const savedhiMarshalSiteWork work, void *args) {
+
+    savedhiMarshalSitesWork allWork = { .user = user, .work = work, .args = args, .from = 0, .to = user->sites_count };
+#if savedhi_MARSHAL_THREADS
+    size_t threads = min( (size_t)savedhi_marshal_threads_count, user->sites_count );
+    if (threads > 1) {
+        savedhiMarshalSitesWork *sitesWork = calloc( threads, sizeof( *sitesWork ) );
+        pthread_t *workers = calloc( threads, sizeof( *workers ) );
+        bool *working = calloc( threads, sizeof( *working ) );
+        if (sitesWork && workers && working) {
+            trc( "marshal: %zu sites over %zu threads", user->sites_count, threads );
+            for (size_t t = 0; t < threads; ++t) {
+                sitesWork[t] = allWork;
+                sitesWork[t].from = user->sites_count * t / threads;
+                sitesWork[t].to = user->sites_count * (t + 1) / threads;
+                working[t] = t && pthread_create( &workers[t], NULL, savedhi_marshal_sites_worker, &sitesWork[t] ) == OK;
+            }
+
+            // Work the first range here, along with any range whose thread couldn't be started.
+            for (size_t t = 0; t < threads; ++t)
+                if (!working[t])
+                    savedhi_marshal_sites_worker( &sitesWork[t] );
+            for (size_t t = 0; t < threads; ++t)
+                if (working[t])
+                    pthread_join( workers[t], NULL );
+
+            free( sitesWork );
+            free( workers );
+            free( working );
+            return;
+        }
+
+        wrn( "Couldn't allocate marshal workers, continuing on one thread." );
+        free( sitesWork );
+        free( workers );
+        free( working );
+    }
+#endif
+
+    savedhi_marshal_sites_worker( &allWork );
+}
+
+static void savedhi_marshal_states_site(
+        savedhiMarshalledUser *user, const size_t s, void *args) {
+
+    const savedhiUserKey **userKeys = args;
+    savedhiMarshalledSite *site = &user->sites[s];
+    const savedhiUserKey *userKey = site->algorithm <= savedhiAlgorithmLast? userKeys[site->algorithm]: NULL;
+    if (!userKey)
+        return;
+
+    savedhi_marshal_state_key( userKey, &site->resultState, &site->resultContent,
+            site->siteName, site->resultType, site->counter, savedhiKeyPurposeAuthentication, NULL );
+    savedhi_marshal_state_key( userKey, &site->loginState, &site->loginContent,
+            site->siteName, site->loginType, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+    for (size_t q = 0; q < site->questions_count; ++q) {
+        savedhiMarshalledQuestion *question = &site->questions[q];
+        savedhi_marshal_state_key( userKey, &question->state, &question->stateContent,
+                site->siteName, question->type, savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword );
+    }
+}
+
+/** The exported values of a site, produced by the site's worker and set into the data tree in site order. */
+typedef struct savedhiMarshalSiteExport {
+    const char *resultState;
+    const char *loginState;
+    const char **answers;
+} savedhiMarshalSiteExport;
+
+typedef struct savedhiMarshalWriteArgs {
+    const savedhiUserKey **userKeys;
+    savedhiMarshalSiteExport *exports;
+} savedhiMarshalWriteArgs;
+
+static void savedhi_marshal_write_site(
+        savedhiMarshalledUser *user, const size_t s, void *args_) {
+
+    savedhiMarshalWriteArgs *args = args_;
+    savedhiMarshalledSite *site = &user->sites[s];
+    savedhiMarshalSiteExport *export = &args->exports[s];
+    if (!site->siteName || !strlen( site->siteName ))
+        return;
+
+    const savedhiUserKey *userKey = site->algorithm <= savedhiAlgorithmLast? args->userKeys[site->algorithm]: NULL;
+    if (!user->redacted) {
+        // Clear Text, pending clear-text content is written back as-is, it needn't round-trip through its state.
+        if (site->resultContent && !site->resultState && site->resultType & savedhiResultClassStateful)
+            export->resultState = savedhi_strdup( site->resultContent );
+        else
+            export->resultState = savedhi_site_result( userKey, site->siteName, site->resultType,
+                    savedhi_marshal_state_key( userKey, &site->resultState, &site->resultContent,
+                            site->siteName, site->resultType, site->counter, savedhiKeyPurposeAuthentication, NULL ),
+                    site->counter, savedhiKeyPurposeAuthentication, NULL );
+        if (site->loginContent && !site->loginState && site->loginType & savedhiResultClassStateful)
+            export->loginState = savedhi_strdup( site->loginContent );
+        else
+            export->loginState = savedhi_site_result( userKey, site->siteName, site->loginType,
+                    savedhi_marshal_state_key( userKey, &site->loginState, &site->loginContent,
+                            site->siteName, site->loginType, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL ),
+                    savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+    }
+    else {
+        // Redacted
+        const char *resultState = savedhi_marshal_state_key( userKey, &site->resultState, &site->resultContent,
+                site->siteName, site->resultType, site->counter, savedhiKeyPurposeAuthentication, NULL );
+        if (site->resultType & savedhiResultFeatureExportContent && resultState && strlen( resultState ))
+            export->resultState = savedhi_strdup( resultState );
+        const char *loginState = savedhi_marshal_state_key( userKey, &site->loginState, &site->loginContent,
+                site->siteName, site->loginType, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+        if (site->loginType & savedhiResultFeatureExportContent && loginState && strlen( loginState ))
+            export->loginState = savedhi_strdup( loginState );
+    }
+
+    for (size_t q = 0; q < site->questions_count; ++q) {
+        savedhiMarshalledQuestion *question = &site->questions[q];
+        if (!question->keyword)
+            continue;
+
+        if (!user->redacted) {
+            // Clear Text
+            if (question->stateContent && !question->state && question->type & savedhiResultClassStateful)
+                export->answers[q] = savedhi_strdup( question->stateContent );
+            else
+                export->answers[q] = savedhi_site_result( userKey, site->siteName, question->type,
+                        savedhi_marshal_state_key( userKey, &question->state, &question->stateContent,
+                                site->siteName, question->type, savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword ),
+                        savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword );
+        }
+        else {
+            // Redacted
+            const char *state = savedhi_marshal_state_key( userKey, &question->state, &question->stateContent,
+                    site->siteName, question->type, savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword );
+            if (state && strlen( state ) && site->resultType & savedhiResultFeatureExportContent)
+                export->answers[q] = savedhi_strdup( state );
+        }
+    }
+}
+
 static const char *savedhi_marshal_write_flat(
         savedhiMarshalledFile *file) {
 
@@ -695,14 +1097,9 @@ static const char *savedhi_marshal_write_json(
 static bool savedhi_marshal_data_filter_site_exists(
         savedhiMarshalledData *child, void *args) {
 
-    savedhiMarshalledUser *user = args;
+    const savedhiMarshalledData *siteNames = args;
 
-    for (size_t s = 0; s < user->sites_count; ++s) {
-        if (strcmp( (&user->sites[s])->siteName, child->obj_key ) == OK)
-            return true;
-    }
-
-    return false;
+    return child->obj_key && savedhi_marshal_data_find( siteNames, child->obj_key, NULL );
 }
 
 static bool savedhi_marshal_data_filter_question_exists(
@@ -773,13 +1170,18 @@ const char *savedhi_marshal_write(
                 return NULL;
             }
 
-            loginState = savedhi_site_result( userKey, user->userName, user->loginType, user->loginState,
-                    savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+            // Pending clear-text content is written back as-is, it needn't round-trip through its state.
+            if (user->loginContent && !user->loginState && user->loginType & savedhiResultClassStateful)
+                loginState = savedhi_strdup( user->loginContent );
+            else
+                loginState = savedhi_site_result( userKey, user->userName, user->loginType, savedhi_marshal_user_login_state( user ),
+                        savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
         }
         else {
             // Redacted
-            if (user->loginType & savedhiResultFeatureExportContent && user->loginState && strlen( user->loginState ))
-                loginState = savedhi_strdup( user->loginState );
+            const char *userLoginState = savedhi_marshal_user_login_state( user );
+            if (user->loginType & savedhiResultFeatureExportContent && userLoginState && strlen( userLoginState ))
+                loginState = savedhi_strdup( userLoginState );
         }
 
         const char *identiconString = savedhi_identicon_encode( user->identicon );
@@ -796,77 +1198,95 @@ const char *savedhi_marshal_write(
             savedhi_marshal_data_set_str( dateString, data_user, "last_used", NULL );
         savedhi_free_strings( &identiconString, &loginState, NULL );
 
+        savedhi_free( &userKey, sizeof( *userKey ) );
+
         // Section "sites"
+        // The sites' values are produced by workers, then set into the data tree in site order.
+        size_t answersCount = 0;
+        for (size_t s = 0; s < user->sites_count; ++s)
+            answersCount += user->sites[s].questions_count;
+        savedhiMarshalSiteExport *exports = calloc( max( user->sites_count, (size_t)1 ), sizeof( *exports ) );
+        const char **answers = calloc( max( answersCount, (size_t)1 ), sizeof( *answers ) );
+        if (!exports || !answers) {
+            free( exports );
+            free( answers );
+            if (!file_)
+                savedhi_marshal_free( &file );
+            else
+                savedhi_marshal_error( file, savedhiMarshalErrorInternal,
+                        "Couldn't allocate site exports." );
+            return NULL;
+        }
+        answersCount = 0;
+        for (size_t s = 0; s < user->sites_count; ++s) {
+            exports[s].answers = &answers[answersCount];
+            answersCount += user->sites[s].questions_count;
+        }
+
+        const savedhiUserKey *userKeys[savedhiAlgorithmLast + 1] = { NULL };
+        if (!savedhi_marshal_site_keys( userKeys, user, user->redacted ) && !user->redacted) {
+            savedhi_marshal_site_keys_free( userKeys );
+            free( exports );
+            free( answers );
+            if (!file_)
+                savedhi_marshal_free( &file );
+            else
+                savedhi_marshal_error( file, savedhiMarshalErrorInternal,
+                        "Couldn't derive user key." );
+            return NULL;
+        }
+        savedhi_marshal_sites_work( user, savedhi_marshal_write_site,
+                &(savedhiMarshalWriteArgs){ .userKeys = userKeys, .exports = exports } );
+        savedhi_marshal_site_keys_free( userKeys );
+
+        // Index the user's site names, to drop the sites the user no longer has from the data.
+        savedhiMarshalledData *siteNames = savedhi_marshal_data_new();
+        for (size_t s = 0; siteNames && s < user->sites_count; ++s)
+            if (user->sites[s].siteName && strlen( user->sites[s].siteName ))
+                savedhi_marshal_data_get( siteNames, user->sites[s].siteName, NULL );
         savedhiMarshalledData *data_sites = savedhi_marshal_data_get( file->data, "sites", NULL );
-        savedhi_marshal_data_filter( data_sites, savedhi_marshal_data_filter_site_exists, user );
+        if (siteNames)
+            savedhi_marshal_data_filter( data_sites, savedhi_marshal_data_filter_site_exists, siteNames );
+        savedhi_marshal_free( &siteNames );
+        savedhi_marshal_data_reserve( data_sites, data_sites->children_count + user->sites_count );
+
         for (size_t s = 0; s < user->sites_count; ++s) {
             savedhiMarshalledSite *site = &user->sites[s];
+            savedhiMarshalSiteExport *export = &exports[s];
             if (!site->siteName || !strlen( site->siteName ))
                 continue;
 
-            const char *resultState = NULL;
-            if (!user->redacted) {
-                // Clear Text
-                savedhi_free( &userKey, sizeof( *userKey ) );
-                if (!user->userKeyProvider || !(userKey = user->userKeyProvider( site->algorithm, user->userName ))) {
-                    if (!file_)
-                        savedhi_marshal_free( &file );
-                    else
-                        savedhi_marshal_error( file, savedhiMarshalErrorInternal,
-                                "Couldn't derive user key." );
-                    return NULL;
-                }
-
-                resultState = savedhi_site_result( userKey, site->siteName,
-                        site->resultType, site->resultState, site->counter, savedhiKeyPurposeAuthentication, NULL );
-                loginState = savedhi_site_result( userKey, site->siteName,
-                        site->loginType, site->loginState, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
-            }
-            else {
-                // Redacted
-                if (site->resultType & savedhiResultFeatureExportContent && site->resultState && strlen( site->resultState ))
-                    resultState = savedhi_strdup( site->resultState );
-                if (site->loginType & savedhiResultFeatureExportContent && site->loginState && strlen( site->loginState ))
-                    loginState = savedhi_strdup( site->loginState );
-            }
-
-            savedhi_marshal_data_set_num( site->counter, data_sites, site->siteName, "counter", NULL );
-            savedhi_marshal_data_set_num( site->algorithm, data_sites, site->siteName, "algorithm", NULL );
-            savedhi_marshal_data_set_num( site->resultType, data_sites, site->siteName, "type", NULL );
-            savedhi_marshal_data_set_str( resultState, data_sites, site->siteName, "password", NULL );
-            savedhi_marshal_data_set_num( site->loginType, data_sites, site->siteName, "login_type", NULL );
-            savedhi_marshal_data_set_str( loginState, data_sites, site->siteName, "login_name", NULL );
-            savedhi_marshal_data_set_num( site->uses, data_sites, site->siteName, "uses", NULL );
+            savedhiMarshalledData *data_site = savedhi_marshal_data_get( data_sites, site->siteName, NULL );
+            savedhi_marshal_data_set_num( site->counter, data_site, "counter", NULL );
+            savedhi_marshal_data_set_num( site->algorithm, data_site, "algorithm", NULL );
+            savedhi_marshal_data_set_num( site->resultType, data_site, "type", NULL );
+            savedhi_marshal_data_set_str( export->resultState, data_site, "password", NULL );
+            savedhi_marshal_data_set_num( site->loginType, data_site, "login_type", NULL );
+            savedhi_marshal_data_set_str( export->loginState, data_site, "login_name", NULL );
+            savedhi_marshal_data_set_num( site->uses, data_site, "uses", NULL );
             if (strftime( dateString, sizeof( dateString ), "%FT%TZ", gmtime( &site->lastUsed ) ))
-                savedhi_marshal_data_set_str( dateString, data_sites, site->siteName, "last_used", NULL );
+                savedhi_marshal_data_set_str( dateString, data_site, "last_used", NULL );
 
-            savedhiMarshalledData *data_questions = savedhi_marshal_data_get( file->data, "sites", site->siteName, "questions", NULL );
+            savedhiMarshalledData *data_questions = savedhi_marshal_data_get( data_site, "questions", NULL );
             savedhi_marshal_data_filter( data_questions, savedhi_marshal_data_filter_question_exists, site );
+            savedhi_marshal_data_reserve( data_questions, data_questions->children_count + site->questions_count );
             for (size_t q = 0; q < site->questions_count; ++q) {
                 savedhiMarshalledQuestion *question = &site->questions[q];
                 if (!question->keyword)
                     continue;
 
-                const char *answer = NULL;
-                if (!user->redacted) {
-                    // Clear Text
-                    answer = savedhi_site_result( userKey, site->siteName,
-                            question->type, question->state, savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword );
-                }
-                else {
-                    // Redacted
-                    if (question->state && strlen( question->state ) && site->resultType & savedhiResultFeatureExportContent)
-                        answer = savedhi_strdup( question->state );
-                }
-
                 savedhi_marshal_data_set_num( question->type, data_questions, question->keyword, "type", NULL );
-                savedhi_marshal_data_set_str( answer, data_questions, question->keyword, "answer", NULL );
-                savedhi_free_strings( &answer, NULL );
+                savedhi_marshal_data_set_str( export->answers[q], data_questions, question->keyword, "answer", NULL );
             }
 
-            savedhi_marshal_data_set_str( site->url, data_sites, site->siteName, "_ext_savedhi", "url", NULL );
-            savedhi_free_strings( &resultState, &loginState, NULL );
+            savedhi_marshal_data_set_str( site->url, data_site, "_ext_savedhi", "url", NULL );
         }
+        for (size_t s = 0; s < user->sites_count; ++s)
+            savedhi_free_strings( &exports[s].resultState, &exports[s].loginState, NULL );
+        for (size_t a = 0; a < answersCount; ++a)
+            savedhi_free_string( &answers[a] );
+        free( exports );
+        free( answers );
     }
 
     const char *out = NULL;
@@ -1080,15 +1500,16 @@ static void savedhi_marshal_read_flat(
             savedhiResultType siteLoginType = siteLoginState && *siteLoginState? savedhiResultStatePersonal: savedhiResultNone;
 
             char dateString[21];
-            savedhi_marshal_data_set_num( siteAlgorithm, file->data, "sites", siteName, "algorithm", NULL );
-            savedhi_marshal_data_set_num( siteKeyCounter, file->data, "sites", siteName, "counter", NULL );
-            savedhi_marshal_data_set_num( siteResultType, file->data, "sites", siteName, "type", NULL );
-            savedhi_marshal_data_set_str( siteResultState, file->data, "sites", siteName, "password", NULL );
-            savedhi_marshal_data_set_num( siteLoginType, file->data, "sites", siteName, "login_type", NULL );
-            savedhi_marshal_data_set_str( siteLoginState, file->data, "sites", siteName, "login_name", NULL );
-            savedhi_marshal_data_set_num( strtol( str_uses, NULL, 10 ), file->data, "sites", siteName, "uses", NULL );
+            savedhiMarshalledData *data_site = savedhi_marshal_data_get( file->data, "sites", siteName, NULL );
+            savedhi_marshal_data_set_num( siteAlgorithm, data_site, "algorithm", NULL );
+            savedhi_marshal_data_set_num( siteKeyCounter, data_site, "counter", NULL );
+            savedhi_marshal_data_set_num( siteResultType, data_site, "type", NULL );
+            savedhi_marshal_data_set_str( siteResultState, data_site, "password", NULL );
+            savedhi_marshal_data_set_num( siteLoginType, data_site, "login_type", NULL );
+            savedhi_marshal_data_set_str( siteLoginState, data_site, "login_name", NULL );
+            savedhi_marshal_data_set_num( strtol( str_uses, NULL, 10 ), data_site, "uses", NULL );
             if (strftime( dateString, sizeof( dateString ), "%FT%TZ", gmtime( &siteLastUsed ) ))
-                savedhi_marshal_data_set_str( dateString, file->data, "sites", siteName, "last_used", NULL );
+                savedhi_marshal_data_set_str( dateString, data_site, "last_used", NULL );
         }
         else {
             savedhi_marshal_error( file, savedhiMarshalErrorMissing,
@@ -1278,9 +1699,9 @@ savedhiMarshalledUser *savedhi_marshal_auth(
                 "Couldn't derive user key." );
         return NULL;
     }
-    if (userKey && !savedhi_id_equals( &keyID, &userKey->keyID )) {
+    if (userKey && !savedhi_id_equals( &keyID, savedhi_user_key_id( userKey ) )) {
         savedhi_marshal_error( file, savedhiMarshalErrorUserSecret,
-                "User key: %s, doesn't match keyID: %s.", userKey->keyID.hex, keyID.hex );
+                "User key: %s, doesn't match keyID: %s.", savedhi_user_key_id( userKey )->hex, keyID.hex );
         savedhi_free( &userKey, sizeof( *userKey ) );
         return NULL;
     }
@@ -1303,19 +1724,16 @@ savedhiMarshalledUser *savedhi_marshal_auth(
     user->lastUsed = lastUsed;
 
     if (!user->redacted) {
-        // Clear Text
-        savedhi_free( &userKey, sizeof( *userKey ) );
-        if (!userKeyProvider || !(userKey = userKeyProvider( user->algorithm, user->userName ))) {
+        // Clear Text, encrypted when first accessed with the keys of the user's key provider.
+        if (!userKey) {
             savedhi_marshal_error( file, savedhiMarshalErrorInternal,
                     "Couldn't derive user key." );
-            savedhi_free( &userKey, sizeof( *userKey ) );
             savedhi_marshal_free( &user );
             return NULL;
         }
 
-        if (loginState && strlen( loginState ) && userKey)
-            user->loginState = savedhi_site_state( userKey, user->userName, user->loginType, loginState,
-                    savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+        if (loginState && strlen( loginState ))
+            user->loginContent = savedhi_strdup( loginState );
     }
     else {
         // Redacted
@@ -1325,6 +1743,7 @@ savedhiMarshalledUser *savedhi_marshal_auth(
 
     // Section "sites"
     const savedhiMarshalledData *sitesData = savedhi_marshal_data_find( file->data, "sites", NULL );
+    savedhi_marshal_sites_reserve( user, sitesData? sitesData->children_count: 0 );
     for (size_t s = 0; s < (sitesData? sitesData->children_count: 0); ++s) {
         const savedhiMarshalledData *siteData = &sitesData->children[s];
         const char *siteName = siteData->obj_key;
@@ -1395,22 +1814,11 @@ savedhiMarshalledUser *savedhi_marshal_auth(
         site->uses = siteUses;
         site->lastUsed = siteLastUsed;
         if (!user->redacted) {
-            // Clear Text
-            savedhi_free( &userKey, sizeof( *userKey ) );
-            if (!userKeyProvider || !(userKey = userKeyProvider( site->algorithm, user->userName ))) {
-                savedhi_marshal_error( file, savedhiMarshalErrorInternal,
-                        "Couldn't derive user key." );
-                savedhi_free( &userKey, sizeof( *userKey ) );
-                savedhi_marshal_free( &user );
-                return NULL;
-            }
-
-            if (siteResultState && strlen( siteResultState ) && userKey)
-                site->resultState = savedhi_site_state( userKey, site->siteName,
-                        site->resultType, siteResultState, site->counter, savedhiKeyPurposeAuthentication, NULL );
-            if (siteLoginState && strlen( siteLoginState ) && userKey)
-                site->loginState = savedhi_site_state( userKey, site->siteName,
-                        site->loginType, siteLoginState, savedhiCounterInitial, savedhiKeyPurposeIdentification, NULL );
+            // Clear Text, encrypted when first accessed.
+            if (siteResultState && strlen( siteResultState ))
+                site->resultContent = savedhi_strdup( siteResultState );
+            if (siteLoginState && strlen( siteLoginState ))
+                site->loginContent = savedhi_strdup( siteLoginState );
         }
         else {
             // Redacted
@@ -1421,6 +1829,7 @@ savedhiMarshalledUser *savedhi_marshal_auth(
         }
 
         const savedhiMarshalledData *questions = savedhi_marshal_data_find( siteData, "questions", NULL );
+        savedhi_marshal_questions_reserve( site, questions? questions->children_count: 0 );
         for (size_t q = 0; q < (questions? questions->children_count: 0); ++q) {
             const savedhiMarshalledData *questionData = &questions->children[q];
             savedhiMarshalledQuestion *question = savedhi_marshal_question( site, questionData->obj_key );
@@ -1429,10 +1838,9 @@ savedhiMarshalledUser *savedhi_marshal_auth(
                     savedhi_marshal_data_get_num( questionData, "type", NULL ) );
 
             if (!user->redacted) {
-                // Clear Text
-                if (answerState && strlen( answerState ) && userKey)
-                    question->state = savedhi_site_state( userKey, site->siteName,
-                            question->type, answerState, savedhiCounterInitial, savedhiKeyPurposeRecovery, question->keyword );
+                // Clear Text, encrypted when first accessed.
+                if (answerState && strlen( answerState ))
+                    question->stateContent = savedhi_strdup( answerState );
             }
             else {
                 // Redacted
@@ -1443,9 +1851,39 @@ savedhiMarshalledUser *savedhi_marshal_auth(
     }
     savedhi_free( &userKey, sizeof( *userKey ) );
 
+#if savedhi_MARSHAL_EAGER
+    if (!savedhi_marshal_states( user )) {
+        savedhi_marshal_error( file, savedhiMarshalErrorInternal,
+                "Couldn't derive user key." );
+        savedhi_marshal_free( &user );
+        return NULL;
+    }
+#endif
+
     return user;
 }
 
+bool savedhi_marshal_states(
+        savedhiMarshalledUser *user) {
+
+    if (!user)
+        return false;
+
+    savedhi_marshal_user_login_state( user );
+
+    const savedhiUserKey *userKeys[savedhiAlgorithmLast + 1] = { NULL };
+    savedhi_marshal_site_keys( userKeys, user, true );
+    savedhi_marshal_sites_work( user, savedhi_marshal_states_site, userKeys );
+    savedhi_marshal_site_keys_free( userKeys );
+
+    // Content stays pending only if its user key couldn't be resolved.
+    bool success = !user->loginContent;
+    for (size_t s = 0; s < user->sites_count; ++s)
+        success &= !savedhi_marshal_site_pending( &user->sites[s] );
+
+    return success;
+}
+
 const savedhiFormat savedhi_format_named(
         const char *formatName) {
 
@@ -20,6 +20,11 @@ savedhi_LIBS_BEGIN
 #include <stdarg.h>
 savedhi_LIBS_END
 
+/** Whether savedhi_marshal_auth encrypts all clear-text states right away (1), rather than when they're first accessed (0). */
+#ifndef savedhi_MARSHAL_EAGER
+#define savedhi_MARSHAL_EAGER 0
+#endif
+
 //// Types.
 
 typedef savedhi_enum( unsigned int, savedhiFormat ) {
@@ -68,7 +73,7 @@ typedef struct savedhiMarshalError {
 typedef const savedhiUserKey *(*savedhiKeyProvider)(
         savedhiAlgorithm algorithm, const char *userName);
 /** A function that updates the currentKey with the userKey of the given algorithm for the user with the given name.
- * @param currentKey A pointer to where the current userKey (allocated) can be found and a new one can be placed.
+ * @param currentKey A pointer to where the cached userKey (allocated) for this algorithm can be found and a new one can be placed.
  *                   Free the old value if you update it. If NULL, the proxy is invalidated and should free any state it holds.
  * @param currentAlgorithm A pointer to where the algorithm of the current userKey is found and can be updated.
  * @param algorithm The algorithm of the userKey that should be placed in currentKey.
@@ -77,8 +82,17 @@ typedef const savedhiUserKey *(*savedhiKeyProvider)(
 typedef bool (*savedhiKeyProviderProxy)(
         const savedhiUserKey **currentKey, savedhiAlgorithm *currentAlgorithm, savedhiAlgorithm algorithm, const char *userName);
 
+/** Statistics of the proxy provider's user key cache. */
+typedef struct savedhiKeyProviderStats {
+    /** Amount of user key requests that were answered from the cache, including keys shared between algorithm versions. */
+    size_t hits;
+    /** Amount of user key requests that required the proxy to resolve a new user key. */
+    size_t misses;
+} savedhiKeyProviderStats;
+
 /** Create a key provider which handles key generation by proxying the given function.
- * The proxy function receives the currently cached key and its algorithm.  If those are NULL, the proxy function should clean up its state. */
+ * The provider caches one key per algorithm for the requested user, so each algorithm's key is resolved at most once.
+ * The proxy function receives the cached key and its algorithm.  If those are NULL, the proxy function should clean up its state. */
 savedhiKeyProvider savedhi_proxy_provider_set(
         const savedhiKeyProviderProxy proxy);
 /** Create a key provider that computes a user key for the given user secret. */
@@ -88,6 +102,9 @@ savedhiKeyProvider savedhi_proxy_provider_set_secret(
 /** Unset the active proxy and free the proxy provider. */
 void savedhi_proxy_provider_unset(void);
 
+/** @return The cache statistics of the active proxy provider, since it was set. */
+savedhiKeyProviderStats savedhi_proxy_provider_stats(void);
+
 /** Free the key provider's internal state. */
 void savedhi_key_provider_free(
         savedhiKeyProvider keyProvider);
@@ -109,8 +126,16 @@ typedef struct savedhiMarshalledData {
 
     /** Amount of data values references under this value if it represents an object or an array. */
     size_t children_count;
-    /** Array of data values referenced under this value. */
+    /** Array of data values referenced under this value.
+     * The array may move when it grows, a child's position in it is a stable handle to the child. */
     struct savedhiMarshalledData *children;
+    /** Amount of data values the children array has room for. */
+    size_t children_capacity;
+    /** Open-addressing hash index of the children by their obj_key, kept once an object holds enough children to need it.
+     * A slot holds the position of a child in children plus one, or 0 if the slot is empty. */
+    size_t *children_index;
+    /** Amount of slots in children_index (a power of two), or 0 if the children aren't indexed. */
+    size_t children_index_size;
 } savedhiMarshalledData;
 
 typedef struct savedhiMarshalledInfo {
@@ -140,8 +165,11 @@ typedef struct savedhiMarshalledQuestion {
     const char *keyword;
     /** The result type to use for generating an answer. */
     savedhiResultType type;
-    /** State data (base64), if any, necessary for generating the question's answer. */
+    /** State data (base64), if any, necessary for generating the question's answer.
+     * Read it with savedhi_marshal_question_state, which resolves a pending stateContent first. */
     const char *state;
+    /** Clear-text answer read from an unredacted file, pending its encryption into state. */
+    const char *stateContent;
 } savedhiMarshalledQuestion;
 
 typedef struct savedhiMarshalledSite {
@@ -154,13 +182,19 @@ typedef struct savedhiMarshalledSite {
     savedhiCounter counter;
     /** The result type to use for generating a site result. */
     savedhiResultType resultType;
-    /** State data (base64), if any, necessary for generating the site result. */
+    /** State data (base64), if any, necessary for generating the site result.
+     * Read it with savedhi_marshal_site_result_state, which resolves a pending resultContent first. */
     const char *resultState;
+    /** Clear-text result read from an unredacted file, pending its encryption into resultState. */
+    const char *resultContent;
 
     /** The result type to use for generating a site login. */
     savedhiResultType loginType;
-    /** State data (base64), if any, necessary for generating the site login. */
+    /** State data (base64), if any, necessary for generating the site login.
+     * Read it with savedhi_marshal_site_login_state, which resolves a pending loginContent first. */
     const char *loginState;
+    /** Clear-text login read from an unredacted file, pending its encryption into loginState. */
+    const char *loginContent;
 
     /** Site metadata: URL location where the site can be accessed. */
     const char *url;
@@ -171,8 +205,11 @@ typedef struct savedhiMarshalledSite {
 
     /** Amount of security questions associated with this site. */
     size_t questions_count;
-    /** Array of security questions associated with this site. */
+    /** Array of security questions associated with this site.
+     * The array may move when it grows, a question's position in it is a stable handle to the question. */
     savedhiMarshalledQuestion *questions;
+    /** Amount of questions the questions array has room for. */
+    size_t questions_capacity;
 } savedhiMarshalledSite;
 
 typedef struct savedhiMarshalledUser {
@@ -193,15 +230,21 @@ typedef struct savedhiMarshalledUser {
     savedhiResultType defaultType;
     /** The result type to use for generating the user's standard login. */
     savedhiResultType loginType;
-    /** State data (base64), if any, necessary for generating the user's standard login. */
+    /** State data (base64), if any, necessary for generating the user's standard login.
+     * Read it with savedhi_marshal_user_login_state, which resolves a pending loginContent first. */
     const char *loginState;
+    /** Clear-text login read from an unredacted file, pending its encryption into loginState. */
+    const char *loginContent;
     /** User metadata: Date of the most recent action taken by this user. */
     time_t lastUsed;
 
     /** Amount of sites associated to this user. */
     size_t sites_count;
-    /** Array of sites associated to this user. */
+    /** Array of sites associated to this user.
+     * The array may move when it grows, a site's position in it is a stable handle to the site. */
     savedhiMarshalledSite *sites;
+    /** Amount of sites the sites array has room for. */
+    size_t sites_capacity;
 } savedhiMarshalledUser;
 
 typedef struct savedhiMarshalledFile {
@@ -215,6 +258,11 @@ typedef struct savedhiMarshalledFile {
 
 //// Marshalling.
 
+/** Spread the per-site work of marshalling (site results, state encryption) over the given amount of threads.
+ * 0 or 1, the default, keeps all work on the calling thread.  Key providers are still only used from the calling thread. */
+void savedhi_marshal_threads_set(
+        const unsigned int threads);
+
 /** Write the user and all associated data out using the given marshalling format.
  * @param file A pointer to the original file object to update with the user's data or to NULL to make a new.
  *             File object will be updated with state or new (allocated).  May be NULL if not interested in a file object.
@@ -227,9 +275,30 @@ savedhiMarshalledFile *savedhi_marshal_read(
         savedhiMarshalledFile *file, const char *in);
 /** Authenticate as the user identified by the given marshalled file.
  * @note This object stores a reference to the given key provider.
+ * @note Unless built with savedhi_MARSHAL_EAGER, the clear-text states of an unredacted file are kept as content
+ *       and only encrypted when first accessed; see savedhi_marshal_states to encrypt them all right away.
  * @return A user object (allocated), or NULL if the file format provides no marshalling or a format error occurred. */
 savedhiMarshalledUser *savedhi_marshal_auth(
         savedhiMarshalledFile *file, const savedhiKeyProvider userKeyProvider);
+/** Encrypt all of the user's pending clear-text content into their states, as if each state was accessed.
+ * @return false if a user key needed for encrypting pending content could not be resolved. */
+bool savedhi_marshal_states(
+        savedhiMarshalledUser *user);
+
+//// Accessing.
+
+/** @return The user's login state (shared), after encrypting its pending content if needed; or NULL if it has no state. */
+const char *savedhi_marshal_user_login_state(
+        savedhiMarshalledUser *user);
+/** @return The site's result state (shared), after encrypting its pending content if needed; or NULL if it has no state. */
+const char *savedhi_marshal_site_result_state(
+        const savedhiMarshalledUser *user, savedhiMarshalledSite *site);
+/** @return The site's login state (shared), after encrypting its pending content if needed; or NULL if it has no state. */
+const char *savedhi_marshal_site_login_state(
+        const savedhiMarshalledUser *user, savedhiMarshalledSite *site);
+/** @return The question's answer state (shared), after encrypting its pending content if needed; or NULL if it has no state. */
+const char *savedhi_marshal_question_state(
+        const savedhiMarshalledUser *user, const savedhiMarshalledSite *site, savedhiMarshalledQuestion *question);
 
 //// Creating.
 
@@ -238,15 +307,25 @@ savedhiMarshalledUser *savedhi_marshal_auth(
  * @return A user object (allocated), or NULL if the userName is missing or the marshalled user couldn't be allocated. */
 savedhiMarshalledUser *savedhi_marshal_user(
         const char *userName, const savedhiKeyProvider userKeyProvider, const savedhiAlgorithm algorithmVersion);
+/** Make room in the given user object for the given amount of sites, so that creating them doesn't move the user's sites.
+ * @return false if the room couldn't be allocated. */
+bool savedhi_marshal_sites_reserve(
+        savedhiMarshalledUser *user, const size_t sites_count);
 /** Create a new site attached to the given user object, ready for marshalling.
  * @note This object stores copies of the strings assigned to it and manages their deallocation internally.
- * @return A site object (allocated), or NULL if the siteName is missing or the marshalled site couldn't be allocated. */
+ * @return A site object (shared), or NULL if the siteName is missing or the marshalled site couldn't be allocated.
+ *         The pointer is valid until the user outgrows its reserved sites, its position in the user's sites remains valid. */
 savedhiMarshalledSite *savedhi_marshal_site(
         savedhiMarshalledUser *user,
         const char *siteName, const savedhiResultType resultType, const savedhiCounter keyCounter, const savedhiAlgorithm algorithmVersion);
+/** Make room in the given site object for the given amount of questions, so that creating them doesn't move the site's questions.
+ * @return false if the room couldn't be allocated. */
+bool savedhi_marshal_questions_reserve(
+        savedhiMarshalledSite *site, const size_t questions_count);
 /** Create a new question attached to the given site object, ready for marshalling.
  * @note This object stores copies of the strings assigned to it and manages their deallocation internally.
- * @return A question object (allocated), or NULL if the marshalled question couldn't be allocated. */
+ * @return A question object (shared), or NULL if the marshalled question couldn't be allocated.
+ *         The pointer is valid until the site outgrows its reserved questions, its position in the site's questions remains valid. */
 savedhiMarshalledQuestion *savedhi_marshal_question(
         savedhiMarshalledSite *site, const char *keyword);
 /** Create or update a marshal file descriptor.
@@ -284,7 +363,13 @@ void savedhi_marshal_file_free(
 /** Create a null value.
  * @return A new data value (allocated), initialized to a null value, or NULL if the value couldn't be allocated. */
 savedhiMarshalledData *savedhi_marshal_data_new(void);
+/** Make room in the given value for the given amount of children, so that creating them doesn't move its children.
+ * @return false if the room couldn't be allocated. */
+bool savedhi_marshal_data_reserve(
+        savedhiMarshalledData *data, const size_t children_count);
 /** Get or create a value for the given path in the data store.
+ * The value can be used as a cursor, to get and set the values under it without walking its path again,
+ * for as long as its parent doesn't outgrow the children reserved in it.
  * @return The value at this path (shared), or NULL if the value didn't exist and couldn't be created. */
 savedhiMarshalledData *savedhi_marshal_data_get(
         savedhiMarshalledData *data, ...);
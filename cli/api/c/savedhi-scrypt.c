@@ -0,0 +1,730 @@
+// =============================================================================
+// Created by Maarten Billemont on 2026-10-16.
+// Copyright (c) 2011, Maarten Billemont.
+//
+// This file is part of savedhi.
+// savedhi is free software. You can modify it under the terms of
+// the GNU General Public License, either version 3 or any later version.
+// See the LICENSE file for details or consult <http://www.gnu.org/licenses/>.
+//
+// Note: this grant does not include any rights for use of savedhi's trademarks.
+// =============================================================================
+
+#define _DEFAULT_SOURCE
+
+#include "savedhi-scrypt.h"
+#include "savedhi-sha256.h"
+#include "savedhi-util.h"
+
+#if (defined( __x86_64__ ) || defined( __i386__ )) && (defined( __GNUC__ ) || defined( __clang__ ))
+#define savedhi_SCRYPT_X86 1
+#else
+#define savedhi_SCRYPT_X86 0
+#endif
+#if defined( _WIN32 )
+#define savedhi_SCRYPT_THREADS 0
+#define savedhi_SCRYPT_MMAP 0
+#else
+#define savedhi_SCRYPT_THREADS 1
+#define savedhi_SCRYPT_MMAP 1
+#endif
+
+savedhi_LIBS_BEGIN
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#if savedhi_SCRYPT_X86
+#include <immintrin.h>
+#endif
+#if savedhi_SCRYPT_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if savedhi_SCRYPT_MMAP
+#include <sys/mman.h>
+#endif
+savedhi_LIBS_END
+
+//// PBKDF2-HMAC-SHA-256, with a single iteration as scrypt uses it.
+
+static void savedhi_scrypt_pbkdf2(
+        uint8_t *out, size_t outSize, const uint8_t *secret, const size_t secretSize, const uint8_t *salt, const size_t saltSize) {
+
+    savedhiSHA256HMAC salted;
+    savedhi_sha256_hmac_init( &salted, secret, secretSize );
+    savedhi_sha256_hmac_update( &salted, salt, saltSize );
+
+    uint8_t counter[4], block[32];
+    for (uint32_t c = 1; outSize; ++c) {
+        savedhiSHA256HMAC hmac = salted;
+        savedhi_uint32( c, counter );
+        savedhi_sha256_hmac_update( &hmac, counter, sizeof( counter ) );
+        savedhi_sha256_hmac_final( &hmac, block );
+        savedhi_zero( &hmac, sizeof( hmac ) );
+
+        const size_t blockSize = min( outSize, sizeof( block ) );
+        memcpy( out, block, blockSize );
+        out += blockSize;
+        outSize -= blockSize;
+    }
+
+    savedhi_zero( block, sizeof( block ) );
+    savedhi_zero( &salted, sizeof( salted ) );
+}
+
+//// ROMix, portable: over little-endian 32-bit words.
+
+#define savedhi_scrypt_rotl(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void savedhi_scrypt_salsa20_8(
+        uint32_t b[static 16]) {
+
+    uint32_t x[16];
+    memcpy( x, b, sizeof( x ) );
+    for (int i = 0; i < 8; i += 2) {
+        // Columns.
+        x[4] ^= savedhi_scrypt_rotl( x[0] + x[12], 7 );
+        x[8] ^= savedhi_scrypt_rotl( x[4] + x[0], 9 );
+        x[12] ^= savedhi_scrypt_rotl( x[8] + x[4], 13 );
+        x[0] ^= savedhi_scrypt_rotl( x[12] + x[8], 18 );
+        x[9] ^= savedhi_scrypt_rotl( x[5] + x[1], 7 );
+        x[13] ^= savedhi_scrypt_rotl( x[9] + x[5], 9 );
+        x[1] ^= savedhi_scrypt_rotl( x[13] + x[9], 13 );
+        x[5] ^= savedhi_scrypt_rotl( x[1] + x[13], 18 );
+        x[14] ^= savedhi_scrypt_rotl( x[10] + x[6], 7 );
+        x[2] ^= savedhi_scrypt_rotl( x[14] + x[10], 9 );
+        x[6] ^= savedhi_scrypt_rotl( x[2] + x[14], 13 );
+        x[10] ^= savedhi_scrypt_rotl( x[6] + x[2], 18 );
+        x[3] ^= savedhi_scrypt_rotl( x[15] + x[11], 7 );
+        x[7] ^= savedhi_scrypt_rotl( x[3] + x[15], 9 );
+        x[11] ^= savedhi_scrypt_rotl( x[7] + x[3], 13 );
+        x[15] ^= savedhi_scrypt_rotl( x[11] + x[7], 18 );
+
+        // Rows.
+        x[1] ^= savedhi_scrypt_rotl( x[0] + x[3], 7 );
+        x[2] ^= savedhi_scrypt_rotl( x[1] + x[0], 9 );
+        x[3] ^= savedhi_scrypt_rotl( x[2] + x[1], 13 );
+        x[0] ^= savedhi_scrypt_rotl( x[3] + x[2], 18 );
+        x[6] ^= savedhi_scrypt_rotl( x[5] + x[4], 7 );
+        x[7] ^= savedhi_scrypt_rotl( x[6] + x[5], 9 );
+        x[4] ^= savedhi_scrypt_rotl( x[7] + x[6], 13 );
+        x[5] ^= savedhi_scrypt_rotl( x[4] + x[7], 18 );
+        x[11] ^= savedhi_scrypt_rotl( x[10] + x[9], 7 );
+        x[8] ^= savedhi_scrypt_rotl( x[11] + x[10], 9 );
+        x[9] ^= savedhi_scrypt_rotl( x[8] + x[11], 13 );
+        x[10] ^= savedhi_scrypt_rotl( x[9] + x[8], 18 );
+        x[12] ^= savedhi_scrypt_rotl( x[15] + x[14], 7 );
+        x[13] ^= savedhi_scrypt_rotl( x[12] + x[15], 9 );
+        x[14] ^= savedhi_scrypt_rotl( x[13] + x[12], 13 );
+        x[15] ^= savedhi_scrypt_rotl( x[14] + x[13], 18 );
+    }
+    for (int i = 0; i < 16; ++i)
+        b[i] += x[i];
+}
+
+/** Mix the 2 * r 64-byte blocks of in into out: even blocks to the first half, odd blocks to the second. */
+static void savedhi_scrypt_blockmix(
+        const uint32_t *in, uint32_t *out, const uint32_t r) {
+
+    uint32_t x[16];
+    memcpy( x, &in[(2 * r - 1) * 16], sizeof( x ) );
+    for (size_t b = 0; b < 2 * r; ++b) {
+        for (size_t w = 0; w < 16; ++w)
+            x[w] ^= in[b * 16 + w];
+        savedhi_scrypt_salsa20_8( x );
+        memcpy( &out[(b / 2 + (b & 1) * r) * 16], x, sizeof( x ) );
+    }
+}
+
+static uint32_t savedhi_scrypt_load(const uint8_t *bytes) {
+
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void savedhi_scrypt_store(uint8_t *bytes, const uint32_t word) {
+
+    bytes[0] = (uint8_t)word;
+    bytes[1] = (uint8_t)(word >> 8);
+    bytes[2] = (uint8_t)(word >> 16);
+    bytes[3] = (uint8_t)(word >> 24);
+}
+
+/** Mix count lanes of 128 * r bytes in place, each with its own V.
+ * @param tmto Keep only every tmto'th block of V, in N / tmto * 32 * r words (rounded up), and recompute the others when needed.
+ * @param XY Scratch memory for 128 * r words per kernel lane. */
+typedef void (*savedhi_scrypt_romix_kernel)(
+        uint8_t *const lanes[], const size_t count, const uint64_t N, const uint32_t r, const uint32_t tmto,
+        uint32_t *const V[], uint32_t *XY);
+
+static void savedhi_scrypt_romix_portable(
+        uint8_t *const lanes[], const size_t count, const uint64_t N, const uint32_t r, const uint32_t tmto,
+        uint32_t *const V[], uint32_t *XY) {
+
+    const size_t words = 32 * (size_t)r;
+    for (size_t l = 0; l < count; ++l) {
+        uint32_t *X = XY, *Y = XY + words, *T = XY + 2 * words, *U = XY + 3 * words, *swap;
+        for (size_t w = 0; w < words; ++w)
+            X[w] = savedhi_scrypt_load( lanes[l] + w * 4 );
+
+        for (uint64_t i = 0; i < N; ++i) {
+            if (i % tmto == 0)
+                memcpy( &V[l][i / tmto * words], X, words * sizeof( *X ) );
+            savedhi_scrypt_blockmix( X, Y, r );
+            swap = X, X = Y, Y = swap;
+        }
+        for (uint64_t i = 0; i < N; ++i) {
+            const uint32_t *last = &X[(2 * r - 1) * 16];
+            const uint64_t j = ((uint64_t)last[1] << 32 | last[0]) & (N - 1);
+
+            // Recompute block j from the last block of V kept before it.
+            const uint32_t *Vj = &V[l][j / tmto * words];
+            if (j % tmto) {
+                memcpy( T, Vj, words * sizeof( *T ) );
+                for (uint64_t d = 0; d < j % tmto; ++d) {
+                    savedhi_scrypt_blockmix( T, U, r );
+                    swap = T, T = U, U = swap;
+                }
+                Vj = T;
+            }
+            for (size_t w = 0; w < words; ++w)
+                X[w] ^= Vj[w];
+            savedhi_scrypt_blockmix( X, Y, r );
+            swap = X, X = Y, Y = swap;
+        }
+
+        for (size_t w = 0; w < words; ++w)
+            savedhi_scrypt_store( lanes[l] + w * 4, X[w] );
+    }
+}
+
+//// ROMix, vectorized.
+///
+/// The vector kernels keep each 64-byte block's words on its diagonals, in rows (0 5 10 15) (4 9 14 3) (8 13 2 7) (12 1 6 11),
+/// so that Salsa20's column and row rounds both operate on whole rows, with a rotation of the rows' words in between.
+/// A kernel of several lanes places the same row of each lane side by side in one vector, mixing the lanes in lockstep.
+
+/** The position in a block of the word at diagonal position k. */
+#define savedhi_scrypt_diagonal(k)  ((5 * (k)) & 15)
+
+/** Run the Salsa20/8 rounds over the rows of a block on diagonals. */
+#define savedhi_scrypt_salsa20_8_rows(_vector, _shuffle, x0, x1, x2, x3) do { \
+    for (int i = 0; i < 8; i += 2) { \
+        x1 ^= savedhi_scrypt_rotl( x0 + x3, 7 ); \
+        x2 ^= savedhi_scrypt_rotl( x1 + x0, 9 ); \
+        x3 ^= savedhi_scrypt_rotl( x2 + x1, 13 ); \
+        x0 ^= savedhi_scrypt_rotl( x3 + x2, 18 ); \
+        x1 = (__typeof__( x1 ))_shuffle( (_vector)x1, 0x93 ); \
+        x2 = (__typeof__( x2 ))_shuffle( (_vector)x2, 0x4e ); \
+        x3 = (__typeof__( x3 ))_shuffle( (_vector)x3, 0x39 ); \
+        x3 ^= savedhi_scrypt_rotl( x0 + x1, 7 ); \
+        x2 ^= savedhi_scrypt_rotl( x3 + x0, 9 ); \
+        x1 ^= savedhi_scrypt_rotl( x2 + x3, 13 ); \
+        x0 ^= savedhi_scrypt_rotl( x1 + x2, 18 ); \
+        x1 = (__typeof__( x1 ))_shuffle( (_vector)x1, 0x39 ); \
+        x2 = (__typeof__( x2 ))_shuffle( (_vector)x2, 0x4e ); \
+        x3 = (__typeof__( x3 ))_shuffle( (_vector)x3, 0x93 ); \
+    } \
+} while (0)
+
+/** A row of four words of one lane, in memory that is only word-aligned. */
+typedef uint32_t savedhi_scrypt_row __attribute__(( vector_size( 16 ), aligned( 4 ) ));
+
+/** Mix up to _lanes lanes in lockstep; the kernel's remaining lanes mix zeroes. */
+#define savedhi_scrypt_romix_lanes(_lanes, _target, _vector, _shuffle) \
+typedef uint32_t savedhi_scrypt_x##_lanes __attribute__(( vector_size( _lanes * 16 ), aligned( 4 ) )); \
+__attribute__(( target( _target ) )) \
+static void savedhi_scrypt_blockmix_x##_lanes( \
+        const savedhi_scrypt_x##_lanes *in, savedhi_scrypt_x##_lanes *out, const uint32_t r) { \
+    \
+    savedhi_scrypt_x##_lanes x0 = in[(2 * r - 1) * 4], x1 = in[(2 * r - 1) * 4 + 1], \
+            x2 = in[(2 * r - 1) * 4 + 2], x3 = in[(2 * r - 1) * 4 + 3]; \
+    for (size_t b = 0; b < 2 * r; ++b) { \
+        x0 ^= in[b * 4]; \
+        x1 ^= in[b * 4 + 1]; \
+        x2 ^= in[b * 4 + 2]; \
+        x3 ^= in[b * 4 + 3]; \
+        savedhi_scrypt_x##_lanes s0 = x0, s1 = x1, s2 = x2, s3 = x3; \
+        savedhi_scrypt_salsa20_8_rows( _vector, _shuffle, x0, x1, x2, x3 ); \
+        x0 += s0; \
+        x1 += s1; \
+        x2 += s2; \
+        x3 += s3; \
+        \
+        savedhi_scrypt_x##_lanes *o = &out[(b / 2 + (b & 1) * r) * 4]; \
+        o[0] = x0; \
+        o[1] = x1; \
+        o[2] = x2; \
+        o[3] = x3; \
+    } \
+} \
+__attribute__(( target( _target ) )) \
+static void savedhi_scrypt_romix_x##_lanes( \
+        uint8_t *const lanes[], const size_t count, const uint64_t N, const uint32_t r, const uint32_t tmto, \
+        uint32_t *const V[], uint32_t *XY) { \
+    \
+    /* Row v of lane l is at words ((v * _lanes) + l) * 4 of X. */ \
+    const size_t rows = 8 * (size_t)r, words = 32 * (size_t)r; \
+    savedhi_scrypt_x##_lanes *X = (savedhi_scrypt_x##_lanes *)XY, *Y = X + rows, *T = Y + rows, *U = T + rows, *swap; \
+    for (size_t v = 0; v < rows; ++v) \
+        for (size_t l = 0; l < _lanes; ++l) \
+            for (size_t c = 0; c < 4; ++c) \
+                XY[(v * _lanes + l) * 4 + c] = l >= count? 0: savedhi_scrypt_load( \
+                        lanes[l] + ((v / 4) * 16 + savedhi_scrypt_diagonal( (v % 4) * 4 + c )) * 4 ); \
+    \
+    for (uint64_t i = 0; i < N; ++i) { \
+        if (i % tmto == 0) \
+            for (size_t l = 0; l < count; ++l) \
+                for (size_t v = 0; v < rows; ++v) \
+                    *(savedhi_scrypt_row *)&V[l][i / tmto * words + v * 4] = \
+                            *(const savedhi_scrypt_row *)&((const uint32_t *)X)[(v * _lanes + l) * 4]; \
+        savedhi_scrypt_blockmix_x##_lanes( X, Y, r ); \
+        swap = X, X = Y, Y = swap; \
+    } \
+    for (uint64_t i = 0; i < N; ++i) { \
+        uint32_t *Xw = (uint32_t *)X, *Tw = (uint32_t *)T; \
+        uint64_t recompute[_lanes], recomputeMax = 0; \
+        for (size_t l = 0; l < count; ++l) { \
+            /* Integerify: the first two words of the last block, found on its diagonals at 0 and 13. */ \
+            const uint32_t *last = &Xw[((rows - 4) * _lanes + l) * 4]; \
+            const uint64_t j = ((uint64_t)last[3 * _lanes * 4 + 1] << 32 | last[0]) & (N - 1); \
+            const uint32_t *Vj = &V[l][j / tmto * words]; \
+            recompute[l] = j % tmto; \
+            recomputeMax = recompute[l] > recomputeMax? recompute[l]: recomputeMax; \
+            for (size_t v = 0; v < rows; ++v) \
+                if (recompute[l]) \
+                    *(savedhi_scrypt_row *)&Tw[(v * _lanes + l) * 4] = *(const savedhi_scrypt_row *)&Vj[v * 4]; \
+                else \
+                    *(savedhi_scrypt_row *)&Xw[(v * _lanes + l) * 4] ^= *(const savedhi_scrypt_row *)&Vj[v * 4]; \
+        } \
+        /* Recompute the lanes' blocks from the last blocks of V kept before them, in lockstep. */ \
+        for (uint64_t d = 1; d <= recomputeMax; ++d) { \
+            savedhi_scrypt_blockmix_x##_lanes( T, U, r ); \
+            swap = T, T = U, U = swap, Tw = (uint32_t *)T; \
+            for (size_t l = 0; l < count; ++l) \
+                if (recompute[l] == d) \
+                    for (size_t v = 0; v < rows; ++v) \
+                        *(savedhi_scrypt_row *)&Xw[(v * _lanes + l) * 4] ^= *(const savedhi_scrypt_row *)&Tw[(v * _lanes + l) * 4]; \
+        } \
+        savedhi_scrypt_blockmix_x##_lanes( X, Y, r ); \
+        swap = X, X = Y, Y = swap; \
+    } \
+    \
+    for (size_t l = 0; l < count; ++l) \
+        for (size_t v = 0; v < rows; ++v) \
+            for (size_t c = 0; c < 4; ++c) \
+                savedhi_scrypt_store( lanes[l] + ((v / 4) * 16 + savedhi_scrypt_diagonal( (v % 4) * 4 + c )) * 4, \
+                        ((const uint32_t *)X)[(v * _lanes + l) * 4 + c] ); \
+}
+
+#if savedhi_SCRYPT_X86
+savedhi_scrypt_romix_lanes( 1, "sse2", __m128i, _mm_shuffle_epi32 )
+savedhi_scrypt_romix_lanes( 2, "avx2", __m256i, _mm256_shuffle_epi32 )
+savedhi_scrypt_romix_lanes( 4, "avx512f", __m512i, _mm512_shuffle_epi32 )
+#endif
+
+typedef struct {
+    const char *name;
+    /** The amount of lanes the kernel mixes at once. */
+    size_t lanes;
+    savedhi_scrypt_romix_kernel romix;
+} savedhiScryptKernel;
+
+/** The most lanes an in-tree kernel mixes at once. */
+#define savedhi_scrypt_lanes_max 4
+
+/** The in-tree kernels, from widest to narrowest. */
+static const savedhiScryptKernel savedhi_scrypt_kernels[] = {
+#if savedhi_SCRYPT_X86
+        { .name = "avx512", .lanes = 4, .romix = savedhi_scrypt_romix_x4 },
+        { .name = "avx2", .lanes = 2, .romix = savedhi_scrypt_romix_x2 },
+        { .name = "sse2", .lanes = 1, .romix = savedhi_scrypt_romix_x1 },
+#endif
+        { .name = "portable", .lanes = 1, .romix = savedhi_scrypt_romix_portable },
+};
+#define savedhi_scrypt_kernels_count (sizeof( savedhi_scrypt_kernels ) / sizeof( *savedhi_scrypt_kernels ))
+
+static bool savedhi_scrypt_kernel_supported(const savedhiScryptKernel *kernel) {
+
+#if savedhi_SCRYPT_X86
+    __builtin_cpu_init();
+    if (kernel->romix == savedhi_scrypt_romix_x4)
+        return __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx2" );
+    if (kernel->romix == savedhi_scrypt_romix_x2)
+        return __builtin_cpu_supports( "avx2" );
+    if (kernel->romix == savedhi_scrypt_romix_x1)
+        return __builtin_cpu_supports( "sse2" );
+#endif
+    return true;
+}
+
+/** @return The narrowest kernel from the given one down that still mixes count lanes at once. */
+static const savedhiScryptKernel *savedhi_scrypt_kernel_narrowed(const savedhiScryptKernel *kernel, const size_t count) {
+
+    while (kernel + 1 < savedhi_scrypt_kernels + savedhi_scrypt_kernels_count &&
+           kernel[1].lanes >= count && kernel[1].lanes < kernel->lanes)
+        ++kernel;
+    return kernel;
+}
+
+static const savedhiScryptKernel *savedhi_scrypt_kernel_selected = NULL;
+static const char *savedhi_scrypt_name_selected = NULL;
+static uint32_t savedhi_scrypt_tmto_selected = 1;
+
+/** Select the named implementation: one of the in-tree kernels or the crypto backend, or the widest kernel the CPU supports.
+ * @return false if the implementation isn't supported on this CPU. */
+static bool savedhi_scrypt_select_named(const char *name) {
+
+    const savedhiScryptKernel *kernel = NULL;
+    for (size_t k = 0; !kernel && k < savedhi_scrypt_kernels_count; ++k)
+        if ((!name || !strlen( name ) || strcmp( name, savedhi_scrypt_kernels[k].name ) == OK) &&
+            savedhi_scrypt_kernel_supported( &savedhi_scrypt_kernels[k] ))
+            kernel = &savedhi_scrypt_kernels[k];
+    if (!kernel && (!name || strcmp( name, "backend" ) != OK))
+        return false;
+
+    savedhi_scrypt_kernel_selected = kernel;
+    savedhi_scrypt_name_selected = kernel? kernel->name: "backend";
+    trc( "scrypt: %s", savedhi_scrypt_name_selected );
+    return true;
+}
+
+/** Select the implementation and time-memory trade-off requested by the environment, or mix with the widest kernel
+ * the CPU supports, keeping all of V. */
+static void savedhi_scrypt_select_default() {
+
+    const char *requested = getenv( savedhi_ENV_scrypt );
+    if (!savedhi_scrypt_select_named( requested )) {
+        wrn( "Unsupported %s on this CPU: %s", savedhi_ENV_scrypt, requested );
+        savedhi_scrypt_select_named( "backend" );
+    }
+
+    const char *tmto = getenv( savedhi_ENV_scrypt_tmto );
+    char *tmtoEnd = NULL;
+    const unsigned long tmtoValue = tmto && strlen( tmto )? strtoul( tmto, &tmtoEnd, 10 ): 1;
+    if (tmtoEnd && (*tmtoEnd || !tmtoValue || tmtoValue > UINT32_MAX)) {
+        wrn( "Invalid %s: %s", savedhi_ENV_scrypt_tmto, tmto );
+        savedhi_scrypt_tmto_selected = 1;
+    }
+    else
+        savedhi_scrypt_tmto_selected = (uint32_t)tmtoValue;
+    trc( "scrypt tmto: %u", savedhi_scrypt_tmto_selected );
+}
+
+/** Make the default selection exactly once, before any thread gets to use it. */
+static void savedhi_scrypt_select() {
+
+#if savedhi_SCRYPT_THREADS
+    static pthread_once_t savedhi_scrypt_select_once = PTHREAD_ONCE_INIT;
+    pthread_once( &savedhi_scrypt_select_once, savedhi_scrypt_select_default );
+#else
+    if (!savedhi_scrypt_name_selected)
+        savedhi_scrypt_select_default();
+#endif
+}
+
+bool savedhi_scrypt_set(const char *name) {
+
+    savedhi_scrypt_select();
+    return savedhi_scrypt_select_named( name );
+}
+
+const char *savedhi_scrypt_name() {
+
+    savedhi_scrypt_select();
+    return savedhi_scrypt_name_selected;
+}
+
+bool savedhi_scrypt_intree() {
+
+    savedhi_scrypt_select();
+    return savedhi_scrypt_kernel_selected != NULL;
+}
+
+uint32_t savedhi_scrypt_tmto() {
+
+    savedhi_scrypt_select();
+    return savedhi_scrypt_tmto_selected;
+}
+
+void savedhi_scrypt_tmto_set(const uint32_t tmto) {
+
+    savedhi_scrypt_select();
+    savedhi_scrypt_tmto_selected = tmto? tmto: 1;
+}
+
+static uint32_t savedhi_scrypt_threads_selected = 0;
+
+uint32_t savedhi_scrypt_threads() {
+
+    return savedhi_scrypt_threads_selected;
+}
+
+void savedhi_scrypt_threads_set(const uint32_t threads) {
+
+    savedhi_scrypt_threads_selected = threads;
+}
+
+//// Scratch arenas.
+///
+/// Each thread that derives keys keeps an arena of scratch memory for each of its lane workers, to hold their V and XY.
+/// Arenas are kept across derivations so that their pages are faulted in once rather than for every key, and are wiped
+/// after every derivation.
+
+/** The most threads that mix the lanes of one key. */
+#define savedhi_scrypt_workers_max 16
+#define savedhi_scrypt_page_size 4096
+#define savedhi_scrypt_huge_page_size (2 * 1024 * 1024)
+
+typedef struct {
+    uint8_t *memory;
+    size_t size;
+    /** Whether memory was mapped rather than allocated. */
+    bool mapped;
+} savedhiScryptArena;
+
+static void savedhi_scrypt_arena_release(savedhiScryptArena *arena) {
+
+    if (!arena->memory)
+        return;
+
+#if savedhi_SCRYPT_MMAP
+    if (arena->mapped)
+        munmap( arena->memory, arena->size );
+    else
+#endif
+        free( arena->memory );
+    *arena = (savedhiScryptArena){ .memory = NULL, .size = 0, .mapped = false };
+}
+
+/** Make sure the arena holds at least size bytes of faulted-in memory, on huge pages if the system has them. */
+static bool savedhi_scrypt_arena_reserve(savedhiScryptArena *arena, size_t size) {
+
+    if (arena->memory && arena->size >= size)
+        return true;
+    savedhi_scrypt_arena_release( arena );
+
+#if savedhi_SCRYPT_MMAP
+    if (size <= SIZE_MAX - savedhi_scrypt_huge_page_size) {
+        size = (size + savedhi_scrypt_huge_page_size - 1) / savedhi_scrypt_huge_page_size * savedhi_scrypt_huge_page_size;
+
+        // Map reserved huge pages if there are any, otherwise ask for transparent huge pages before faulting the memory in.
+        void *memory = MAP_FAILED;
+#if defined( MAP_HUGETLB ) && defined( MAP_POPULATE )
+        memory = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0 );
+#endif
+        if (memory == MAP_FAILED) {
+            memory = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if (memory != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+                madvise( memory, size, MADV_HUGEPAGE );
+#endif
+#ifdef MADV_POPULATE_WRITE
+                if (madvise( memory, size, MADV_POPULATE_WRITE ) != OK)
+#endif
+                    for (size_t page = 0; page < size; page += savedhi_scrypt_page_size)
+                        ((volatile uint8_t *)memory)[page] = 0;
+            }
+        }
+        if (memory != MAP_FAILED) {
+            *arena = (savedhiScryptArena){ .memory = memory, .size = size, .mapped = true };
+            return true;
+        }
+    }
+#endif
+
+    uint8_t *memory = malloc( size );
+    if (!memory)
+        return false;
+    *arena = (savedhiScryptArena){ .memory = memory, .size = size, .mapped = false };
+    return true;
+}
+
+#if savedhi_SCRYPT_THREADS
+static pthread_key_t savedhi_scrypt_arenas_key;
+static bool savedhi_scrypt_arenas_keyed = false;
+static pthread_once_t savedhi_scrypt_arenas_once = PTHREAD_ONCE_INIT;
+
+static void savedhi_scrypt_arenas_free(void *arenas) {
+
+    for (size_t w = 0; w < savedhi_scrypt_workers_max; ++w)
+        savedhi_scrypt_arena_release( &((savedhiScryptArena *)arenas)[w] );
+    free( arenas );
+}
+
+static void savedhi_scrypt_arenas_init() {
+
+    int error = pthread_key_create( &savedhi_scrypt_arenas_key, savedhi_scrypt_arenas_free );
+    if (!(savedhi_scrypt_arenas_keyed = error == OK))
+        wrn( "Couldn't keep scrypt arenas across derivations: %s", strerror( error ) );
+}
+#else
+static savedhiScryptArena savedhi_scrypt_arenas_static[savedhi_scrypt_workers_max];
+#endif
+
+/** @return The calling thread's arenas, one for each lane worker, or NULL if it has none and create is false
+ *          or they can't be kept for it. */
+static savedhiScryptArena *savedhi_scrypt_arenas(const bool create) {
+
+#if savedhi_SCRYPT_THREADS
+    pthread_once( &savedhi_scrypt_arenas_once, savedhi_scrypt_arenas_init );
+    if (!savedhi_scrypt_arenas_keyed)
+        return NULL;
+    savedhiScryptArena *arenas = pthread_getspecific( savedhi_scrypt_arenas_key );
+    if (!arenas && create && (arenas = calloc( savedhi_scrypt_workers_max, sizeof( *arenas ) )) &&
+        pthread_setspecific( savedhi_scrypt_arenas_key, arenas ) != OK) {
+        free( arenas );
+        arenas = NULL;
+    }
+    return arenas;
+#else
+    return savedhi_scrypt_arenas_static;
+#endif
+}
+
+void savedhi_scrypt_release() {
+
+    savedhiScryptArena *arenas = savedhi_scrypt_arenas( false );
+    if (arenas)
+        for (size_t w = 0; w < savedhi_scrypt_workers_max; ++w)
+            savedhi_scrypt_arena_release( &arenas[w] );
+}
+
+//// Lane workers.
+
+typedef struct {
+    uint8_t *lanes;
+    uint64_t N;
+    uint32_t r, p, tmto;
+    /** The first lane this worker mixes; it mixes every stride'th lane after it. */
+    uint32_t first, stride;
+    const savedhiScryptKernel *kernel;
+    savedhiScryptArena *arena;
+    bool success;
+} savedhiScryptWorker;
+
+static void *savedhi_scrypt_work(void *context) {
+
+    savedhiScryptWorker *worker = context;
+    const size_t laneSize = 128 * (size_t)worker->r, laneWords = laneSize / sizeof( uint32_t );
+    const size_t workerLanes = (worker->p - worker->first + worker->stride - 1) / worker->stride;
+    const size_t kernelLanes = min( worker->kernel->lanes, workerLanes );
+    const size_t VWords = (size_t)((worker->N + worker->tmto - 1) / worker->tmto) * laneWords;
+    const size_t XYWords = 4 * laneWords * worker->kernel->lanes;
+    const size_t memorySize = (kernelLanes * VWords + XYWords) * sizeof( uint32_t );
+    if (!savedhi_scrypt_arena_reserve( worker->arena, memorySize )) {
+        worker->success = false;
+        return NULL;
+    }
+    uint32_t *memory = (uint32_t *)worker->arena->memory;
+
+    uint8_t *lanes[savedhi_scrypt_lanes_max];
+    uint32_t *V[savedhi_scrypt_lanes_max];
+    uint32_t *XY = memory + kernelLanes * VWords;
+    for (size_t l = 0; l < kernelLanes; ++l)
+        V[l] = memory + l * VWords;
+    for (uint32_t l = worker->first; l < worker->p;) {
+        size_t count = 0;
+        for (; count < kernelLanes && l < worker->p; ++count, l += worker->stride)
+            lanes[count] = worker->lanes + l * laneSize;
+
+        // Mix fewer lanes than the kernel's width with the narrowest kernel that still mixes them at once.
+        savedhi_scrypt_kernel_narrowed( worker->kernel, count )->romix( lanes, count, worker->N, worker->r, worker->tmto, V, XY );
+    }
+    worker->success = true;
+
+    savedhi_zero( memory, memorySize );
+    return NULL;
+}
+
+static uint32_t savedhi_scrypt_workers(const uint32_t p) {
+
+    long cpus = savedhi_scrypt_threads_selected;
+#if savedhi_SCRYPT_THREADS && defined( _SC_NPROCESSORS_ONLN )
+    if (!cpus)
+        cpus = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+    return cpus < 1? 1: (uint32_t)min( min( (unsigned long)p, (unsigned long)cpus ), (unsigned long)savedhi_scrypt_workers_max );
+}
+
+const char *savedhi_scrypt_kernel_name(const uint32_t p) {
+
+    savedhi_scrypt_select();
+    if (!savedhi_scrypt_kernel_selected || !p)
+        return savedhi_scrypt_name_selected;
+
+    // The first worker mixes the most lanes, its first kernel call the most of those at once.
+    const uint32_t workersCount = savedhi_scrypt_workers( p );
+    const size_t workerLanes = (p + workersCount - 1) / workersCount;
+    return savedhi_scrypt_kernel_narrowed( savedhi_scrypt_kernel_selected,
+            min( savedhi_scrypt_kernel_selected->lanes, workerLanes ) )->name;
+}
+
+bool savedhi_scrypt(
+        uint8_t *key, const size_t keySize, const uint8_t *secret, const size_t secretSize, const uint8_t *salt, const size_t saltSize,
+        const uint64_t N, const uint32_t r, const uint32_t p) {
+
+    if (!key || !keySize || !secret || !secretSize || !salt || !saltSize ||
+        N < 2 || (N & (N - 1)) || !r || !p || (uint64_t)r * p >= 1 << 30 ||
+        N > SIZE_MAX / 128 / r / savedhi_scrypt_lanes_max - 2 || (size_t)p > SIZE_MAX / 128 / r) {
+        errno = EINVAL;
+        return false;
+    }
+
+    savedhi_scrypt_select();
+    const savedhiScryptKernel *kernel = savedhi_scrypt_kernel_selected;
+    const uint32_t tmto = savedhi_scrypt_tmto_selected;
+    if (!kernel) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    // Without arenas kept for the calling thread, mix in arenas of this derivation's own.
+    savedhiScryptArena callArenas[savedhi_scrypt_workers_max] = { 0 };
+    savedhiScryptArena *arenas = savedhi_scrypt_arenas( true );
+    if (!arenas)
+        arenas = callArenas;
+
+    const size_t lanesSize = 128 * (size_t)r * p;
+    uint8_t *lanes = malloc( lanesSize );
+    if (!lanes)
+        return false;
+    savedhi_scrypt_pbkdf2( lanes, lanesSize, secret, secretSize, salt, saltSize );
+
+    // Mix lanes on the caller's thread and as many worker threads as there are other CPUs, up to one per lane.
+    const uint32_t workersCount = savedhi_scrypt_workers( p );
+    savedhiScryptWorker workers[workersCount];
+#if savedhi_SCRYPT_THREADS
+    pthread_t threads[workersCount];
+    bool started[workersCount];
+#endif
+    for (uint32_t w = 0; w < workersCount; ++w) {
+        workers[w] = (savedhiScryptWorker){
+                .lanes = lanes, .N = N, .r = r, .p = p, .tmto = tmto, .first = w, .stride = workersCount,
+                .kernel = kernel, .arena = &arenas[w], .success = false,
+        };
+#if savedhi_SCRYPT_THREADS
+        // Workers whose thread cannot be started are run on the caller's thread instead.
+        started[w] = w && pthread_create( &threads[w], NULL, savedhi_scrypt_work, &workers[w] ) == OK;
+#endif
+    }
+
+    bool success = true;
+    for (uint32_t w = 0; w < workersCount; ++w) {
+#if savedhi_SCRYPT_THREADS
+        if (started[w])
+            pthread_join( threads[w], NULL );
+        else
+#endif
+            savedhi_scrypt_work( &workers[w] );
+        success &= workers[w].success;
+    }
+
+    if (success)
+        savedhi_scrypt_pbkdf2( key, keySize, secret, secretSize, lanes, lanesSize );
+
+    savedhi_free( &lanes, lanesSize );
+    if (arenas == callArenas)
+        for (uint32_t w = 0; w < workersCount; ++w)
+            savedhi_scrypt_arena_release( &callArenas[w] );
+    return success;
+}
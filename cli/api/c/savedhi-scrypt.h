@@ -0,0 +1,80 @@
+// =============================================================================
+// Created by Maarten Billemont on 2026-10-16.
+// Copyright (c) 2011, Maarten Billemont.
+//
+// This file is part of savedhi.
+// savedhi is free software. You can modify it under the terms of
+// the GNU General Public License, either version 3 or any later version.
+// See the LICENSE file for details or consult <http://www.gnu.org/licenses/>.
+//
+// Note: this grant does not include any rights for use of savedhi's trademarks.
+// =============================================================================
+
+#ifndef _savedhi_SCRYPT_H
+#define _savedhi_SCRYPT_H
+
+#include "savedhi-types.h"
+
+savedhi_LIBS_BEGIN
+#include <stddef.h>
+savedhi_LIBS_END
+
+//// scrypt.
+///
+/// The crypto backend's scrypt (libsodium or cperciva) is only as fast as the distribution compiled it.  The in-tree scrypt
+/// mixes with Salsa20/8 kernels for the CPU's widest vector unit (AVX-512: 4 lanes at once, AVX2: 2, SSE2: 1, otherwise portable),
+/// chosen once, by the first thread that needs it.  It mixes scrypt's p independent lanes concurrently, one thread per lane
+/// (up to the amount of online CPUs), and produces bit-identical keys.  A thread with fewer lanes than its kernel is wide mixes
+/// them with the narrowest kernel that still fits them: for savedhi's p = 2 on two CPUs or more, a single-lane kernel.
+/// The choice can be overridden with the savedhi_SCRYPT environment variable: avx512, avx2, sse2, portable or backend.
+///
+/// The memory for mixing is kept by each deriving thread across derivations, faulted in up front (on huge pages where
+/// the system offers them) and wiped after every derivation.  It is released when the thread exits or calls savedhi_scrypt_release.
+/// Each deriving thread keeps one arena for each thread that mixes its lanes, ie. min(p, online CPUs) arenas of N / k * r * 128
+/// bytes (32 MiB each for savedhi's keys), and doesn't lock them in memory.  Long-lived hosts that derive keys only now and then
+/// should call savedhi_scrypt_release once they're done, rather than keep that memory for the life of the thread.
+///
+/// Where memory is scarcer than CPU, a time-memory trade-off keeps only every k'th block of each lane's V and recomputes
+/// the others when they are needed, dividing the memory for mixing by k at the cost of about (k - 1) / 2 extra blocks
+/// mixed for each block looked up.  Keys are unaffected.  k is 1 unless set with the savedhi_SCRYPT_TMTO environment
+/// variable or savedhi_scrypt_tmto_set.
+
+/** The environment variable that overrides the choice of scrypt implementation. */
+#define savedhi_ENV_scrypt      "savedhi_SCRYPT"
+/** The environment variable that sets the scrypt time-memory trade-off factor. */
+#define savedhi_ENV_scrypt_tmto "savedhi_SCRYPT_TMTO"
+
+/** @return The name of the implementation selected to derive scrypt keys: avx512, avx2, sse2, portable or backend. */
+const char *savedhi_scrypt_name(void);
+/** @return The name of the widest kernel that mixes the lanes of a key with p lanes: the selected kernel, or a narrower one
+ *          where each thread mixes fewer lanes than the selected kernel mixes at once.
+ *          backend if keys are left to the crypto backend. */
+const char *savedhi_scrypt_kernel_name(const uint32_t p);
+/** @return true if scrypt keys should be derived in-tree, false if they should be left to the crypto backend. */
+bool savedhi_scrypt_intree(void);
+/** Select the implementation that derives scrypt keys by name, as the savedhi_SCRYPT environment variable does, eg. to compare them.
+ * NULL selects the widest kernel the CPU supports.
+ * Not thread-safe: switch only while no keys are being derived.
+ * @return false if the implementation isn't supported on this CPU, leaving the selection unchanged. */
+bool savedhi_scrypt_set(const char *name);
+/** @return The time-memory trade-off factor: only every k'th block of V is kept while mixing. */
+uint32_t savedhi_scrypt_tmto(void);
+/** Set the time-memory trade-off factor for the in-tree scrypt, from 1 (keep all of V) up. */
+void savedhi_scrypt_tmto_set(const uint32_t tmto);
+/** @return The most threads that mix the lanes of one key, or 0 for one per online CPU. */
+uint32_t savedhi_scrypt_threads(void);
+/** Set the most threads that mix the lanes of one key: 1 mixes them all on the calling thread, 0 (the default) uses one per online CPU. */
+void savedhi_scrypt_threads_set(const uint32_t threads);
+
+/** Derive a key from the given secret and salt using the scrypt KDF, mixing its p lanes concurrently.
+ * @param N The CPU/memory cost, a power of two greater than 1.  Each lane mixed at once needs N / k * r * 128 bytes.
+ * @return false if the parameters are out of bounds, the crypto backend is selected
+ *         or the memory for mixing could not be allocated. */
+bool savedhi_scrypt(
+        uint8_t *key, const size_t keySize, const uint8_t *secret, const size_t secretSize, const uint8_t *salt, const size_t saltSize,
+        const uint64_t N, const uint32_t r, const uint32_t p);
+
+/** Release the memory the calling thread keeps for mixing. */
+void savedhi_scrypt_release(void);
+
+#endif // _savedhi_SCRYPT_H
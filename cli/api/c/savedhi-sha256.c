@@ -0,0 +1,604 @@
+// =============================================================================
+// Created by Maarten Billemont on 2026-10-16.
+// Copyright (c) 2011, Maarten Billemont.
+//
+// This file is part of savedhi.
+// savedhi is free software. You can modify it under the terms of
+// the GNU General Public License, either version 3 or any later version.
+// See the LICENSE file for details or consult <http://www.gnu.org/licenses/>.
+//
+// Note: this grant does not include any rights for use of savedhi's trademarks.
+// =============================================================================
+
+#include "savedhi-sha256.h"
+#include "savedhi-util.h"
+
+#if (defined( __x86_64__ ) || defined( __i386__ )) && (defined( __GNUC__ ) || defined( __clang__ ))
+#define savedhi_SHA256_X86 1
+#else
+#define savedhi_SHA256_X86 0
+#endif
+#if defined( __aarch64__ ) && (defined( __ARM_FEATURE_SHA2 ) || defined( __ARM_FEATURE_CRYPTO ))
+#define savedhi_SHA256_ARMV8 1
+#else
+#define savedhi_SHA256_ARMV8 0
+#endif
+#if defined( _WIN32 )
+#define savedhi_SHA256_THREADS 0
+#else
+#define savedhi_SHA256_THREADS 1
+#endif
+
+savedhi_LIBS_BEGIN
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#if savedhi_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#elif savedhi_SHA256_ARMV8
+#include <arm_neon.h>
+#endif
+#if savedhi_SHA256_THREADS
+#include <pthread.h>
+#endif
+savedhi_LIBS_END
+
+static const uint32_t savedhi_sha256_iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+static const uint32_t savedhi_sha256_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// The SHA-256 functions are written to apply equally to a uint32_t and to a vector of uint32_t lanes.
+#define savedhi_sha256_rotr(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+#define savedhi_sha256_S0(x)        (savedhi_sha256_rotr( x, 2 ) ^ savedhi_sha256_rotr( x, 13 ) ^ savedhi_sha256_rotr( x, 22 ))
+#define savedhi_sha256_S1(x)        (savedhi_sha256_rotr( x, 6 ) ^ savedhi_sha256_rotr( x, 11 ) ^ savedhi_sha256_rotr( x, 25 ))
+#define savedhi_sha256_s0(x)        (savedhi_sha256_rotr( x, 7 ) ^ savedhi_sha256_rotr( x, 18 ) ^ ((x) >> 3))
+#define savedhi_sha256_s1(x)        (savedhi_sha256_rotr( x, 17 ) ^ savedhi_sha256_rotr( x, 19 ) ^ ((x) >> 10))
+#define savedhi_sha256_ch(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define savedhi_sha256_maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+/** Compress one block of message words w into the state, adding only those lanes selected by mask. */
+#define savedhi_sha256_compress(_type, state, w, mask) do { \
+    _type a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7]; \
+    for (int t = 0; t < 64; ++t) { \
+        if (t >= 16) \
+            w[t & 15] += savedhi_sha256_s1( w[(t - 2) & 15] ) + w[(t - 7) & 15] + savedhi_sha256_s0( w[(t - 15) & 15] ); \
+        _type t1 = h + savedhi_sha256_S1( e ) + savedhi_sha256_ch( e, f, g ) + savedhi_sha256_k[t] + w[t & 15]; \
+        _type t2 = savedhi_sha256_S0( a ) + savedhi_sha256_maj( a, b, c ); \
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2; \
+    } \
+    state[0] += a & (mask); state[1] += b & (mask); state[2] += c & (mask); state[3] += d & (mask); \
+    state[4] += e & (mask); state[5] += f & (mask); state[6] += g & (mask); state[7] += h & (mask); \
+} while (0)
+
+static uint32_t savedhi_sha256_load(const uint8_t *bytes) {
+
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | (uint32_t)bytes[3];
+}
+
+static void savedhi_sha256_store(uint8_t *bytes, const uint32_t word) {
+
+    bytes[0] = (uint8_t)(word >> 24);
+    bytes[1] = (uint8_t)(word >> 16);
+    bytes[2] = (uint8_t)(word >> 8);
+    bytes[3] = (uint8_t)word;
+}
+
+static void savedhi_sha256_blocks_portable(
+        uint32_t state[static 8], const uint8_t *blocks, const size_t blocksCount) {
+
+    for (size_t b = 0; b < blocksCount; ++b, blocks += 64) {
+        uint32_t w[16];
+        for (int t = 0; t < 16; ++t)
+            w[t] = savedhi_sha256_load( blocks + 4 * t );
+
+        savedhi_sha256_compress( uint32_t, state, w, ~(uint32_t)0 );
+    }
+}
+
+#if savedhi_SHA256_X86
+static bool savedhi_sha256_blocks_shani_supported() {
+
+    unsigned int eax, ebx, ecx, edx;
+    return __builtin_cpu_supports( "sse4.1" ) &&
+           __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) && (ebx & (1U << 29) /* SHA */);
+}
+
+__attribute__(( target( "sha,sse4.1" ) ))
+static void savedhi_sha256_blocks_shani(
+        uint32_t state[static 8], const uint8_t *blocks, const size_t blocksCount) {
+
+    const __m128i byteSwap = _mm_set_epi64x( 0x0c0d0e0f08090a0bLL, 0x0405060700010203LL );
+
+    // The SHA extensions hold the state as ABEF and CDGH.
+    __m128i cdab = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)&state[0] ), 0xB1 );
+    __m128i efgh = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)&state[4] ), 0x1B );
+    __m128i abef = _mm_alignr_epi8( cdab, efgh, 8 );
+    __m128i cdgh = _mm_blend_epi16( efgh, cdab, 0xF0 );
+
+    for (size_t b = 0; b < blocksCount; ++b, blocks += 64) {
+        const __m128i abefSaved = abef, cdghSaved = cdgh;
+        __m128i w[4];
+
+        // Four rounds at a time, scheduling the message words of the rounds that follow.
+        for (int g = 0; g < 16; ++g) {
+            if (g < 4)
+                w[g] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)(blocks + 16 * g) ), byteSwap );
+
+            __m128i wk = _mm_add_epi32( w[g % 4], _mm_loadu_si128( (const __m128i *)&savedhi_sha256_k[4 * g] ) );
+            cdgh = _mm_sha256rnds2_epu32( cdgh, abef, wk );
+            if (g >= 3 && g < 15) {
+                w[(g + 1) % 4] = _mm_add_epi32( w[(g + 1) % 4], _mm_alignr_epi8( w[g % 4], w[(g + 3) % 4], 4 ) );
+                w[(g + 1) % 4] = _mm_sha256msg2_epu32( w[(g + 1) % 4], w[g % 4] );
+            }
+            abef = _mm_sha256rnds2_epu32( abef, cdgh, _mm_shuffle_epi32( wk, 0x0E ) );
+            if (g >= 1 && g < 13)
+                w[(g + 3) % 4] = _mm_sha256msg1_epu32( w[(g + 3) % 4], w[g % 4] );
+        }
+
+        abef = _mm_add_epi32( abef, abefSaved );
+        cdgh = _mm_add_epi32( cdgh, cdghSaved );
+    }
+
+    __m128i feba = _mm_shuffle_epi32( abef, 0x1B );
+    __m128i dchg = _mm_shuffle_epi32( cdgh, 0xB1 );
+    _mm_storeu_si128( (__m128i *)&state[0], _mm_blend_epi16( feba, dchg, 0xF0 ) );
+    _mm_storeu_si128( (__m128i *)&state[4], _mm_alignr_epi8( dchg, feba, 8 ) );
+}
+#endif
+
+#if savedhi_SHA256_ARMV8
+static void savedhi_sha256_blocks_armv8(
+        uint32_t state[static 8], const uint8_t *blocks, const size_t blocksCount) {
+
+    uint32x4_t abcd = vld1q_u32( &state[0] ), efgh = vld1q_u32( &state[4] );
+
+    for (size_t b = 0; b < blocksCount; ++b, blocks += 64) {
+        const uint32x4_t abcdSaved = abcd, efghSaved = efgh;
+        uint32x4_t w[4];
+        for (int g = 0; g < 4; ++g)
+            w[g] = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( blocks + 16 * g ) ) );
+
+        // Four rounds at a time, scheduling the message words of the rounds four groups ahead.
+        for (int g = 0; g < 16; ++g) {
+            const uint32x4_t wk = vaddq_u32( w[g % 4], vld1q_u32( &savedhi_sha256_k[4 * g] ) );
+            if (g < 12)
+                w[g % 4] = vsha256su0q_u32( w[g % 4], w[(g + 1) % 4] );
+            const uint32x4_t abcdRound = abcd;
+            abcd = vsha256hq_u32( abcd, efgh, wk );
+            efgh = vsha256h2q_u32( efgh, abcdRound, wk );
+            if (g < 12)
+                w[g % 4] = vsha256su1q_u32( w[g % 4], w[(g + 2) % 4], w[(g + 3) % 4] );
+        }
+
+        abcd = vaddq_u32( abcd, abcdSaved );
+        efgh = vaddq_u32( efgh, efghSaved );
+    }
+
+    vst1q_u32( &state[0], abcd );
+    vst1q_u32( &state[4], efgh );
+}
+#endif
+
+typedef void (*savedhi_sha256_blocks_implementation)(
+        uint32_t state[static 8], const uint8_t *blocks, const size_t blocksCount);
+static savedhi_sha256_blocks_implementation savedhi_sha256_blocks_selected = NULL;
+static const char *savedhi_sha256_name_selected = NULL;
+static bool savedhi_sha256_intree_selected = false;
+static size_t savedhi_sha256_lanes_selected = 0;
+
+/** Select the named implementation: the CPU's SHA-256 instructions, portable or the backend (with the fastest in-tree blocks).
+ * @return false if the implementation isn't supported on this CPU. */
+static bool savedhi_sha256_select_named(const char *name) {
+
+    savedhi_sha256_blocks_implementation hardware = NULL;
+    const char *hardwareName = NULL;
+#if savedhi_SHA256_X86
+    if (savedhi_sha256_blocks_shani_supported()) {
+        hardware = savedhi_sha256_blocks_shani;
+        hardwareName = "sha-ni";
+    }
+#elif savedhi_SHA256_ARMV8
+    hardware = savedhi_sha256_blocks_armv8;
+    hardwareName = "armv8";
+#endif
+
+    if (!name || !strlen( name ))
+        name = hardwareName? hardwareName: "backend";
+    if (hardwareName && strcmp( name, hardwareName ) == OK) {
+        savedhi_sha256_name_selected = hardwareName;
+        savedhi_sha256_intree_selected = true;
+        savedhi_sha256_blocks_selected = hardware;
+    }
+    else if (strcmp( name, "portable" ) == OK) {
+        savedhi_sha256_name_selected = "portable";
+        savedhi_sha256_intree_selected = true;
+        savedhi_sha256_blocks_selected = savedhi_sha256_blocks_portable;
+    }
+    else if (strcmp( name, "backend" ) == OK) {
+        savedhi_sha256_name_selected = "backend";
+        savedhi_sha256_intree_selected = false;
+        savedhi_sha256_blocks_selected = hardware? hardware: savedhi_sha256_blocks_portable;
+    }
+    else
+        return false;
+
+    trc( "SHA-256: %s", savedhi_sha256_name_selected );
+    return true;
+}
+
+/** Select the implementation requested by the environment, or the CPU's SHA-256 instructions if it has them,
+ * otherwise leave single messages to the crypto backend.  Also select the widest SHA-256 kernel of the CPU. */
+static void savedhi_sha256_select_default() {
+
+    const char *requested = getenv( savedhi_ENV_sha256 );
+    if (!savedhi_sha256_select_named( requested )) {
+        wrn( "Unsupported %s on this CPU: %s", savedhi_ENV_sha256, requested );
+        savedhi_sha256_select_named( "backend" );
+    }
+
+#if savedhi_SHA256_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports( "avx512f" ))
+        savedhi_sha256_lanes_selected = 16;
+    else if (__builtin_cpu_supports( "avx2" ))
+        savedhi_sha256_lanes_selected = 8;
+    else
+#endif
+        savedhi_sha256_lanes_selected = 1;
+}
+
+/** Make the default selection exactly once, before any thread gets to use it. */
+static void savedhi_sha256_select() {
+
+#if savedhi_SHA256_THREADS
+    static pthread_once_t savedhi_sha256_select_once = PTHREAD_ONCE_INIT;
+    pthread_once( &savedhi_sha256_select_once, savedhi_sha256_select_default );
+#else
+    if (!savedhi_sha256_blocks_selected)
+        savedhi_sha256_select_default();
+#endif
+}
+
+bool savedhi_sha256_set(const char *name) {
+
+    savedhi_sha256_select();
+    return savedhi_sha256_select_named( name );
+}
+
+const char *savedhi_sha256_name() {
+
+    savedhi_sha256_select();
+    return savedhi_sha256_name_selected;
+}
+
+bool savedhi_sha256_intree() {
+
+    savedhi_sha256_select();
+    return savedhi_sha256_intree_selected;
+}
+
+void savedhi_sha256_blocks(
+        uint32_t state[static 8], const uint8_t *blocks, const size_t blocksCount) {
+
+    savedhi_sha256_select();
+    savedhi_sha256_blocks_selected( state, blocks, blocksCount );
+}
+
+/** Process each lane's blocks into its column of the lane states; lanes with fewer blocks sit out the remaining rounds. */
+#define savedhi_sha256_blocks_lanes(_lanes, _target) \
+typedef uint32_t savedhi_sha256_x##_lanes __attribute__(( vector_size( _lanes * sizeof( uint32_t ) ) )); \
+__attribute__(( target( _target ) )) \
+static void savedhi_sha256_blocks_x##_lanes( \
+        uint32_t states[8][savedhi_sha256_lanes_max], const uint8_t *const blocks[], const size_t blocksCount[]) { \
+    \
+    size_t maxBlocksCount = 0; \
+    for (size_t l = 0; l < _lanes; ++l) \
+        maxBlocksCount = blocksCount[l] > maxBlocksCount? blocksCount[l]: maxBlocksCount; \
+    \
+    savedhi_sha256_x##_lanes state[8]; \
+    for (int i = 0; i < 8; ++i) \
+        memcpy( &state[i], states[i], sizeof( state[i] ) ); \
+    \
+    for (size_t b = 0; b < maxBlocksCount; ++b) { \
+        uint32_t words[16][_lanes], masks[_lanes]; \
+        for (size_t l = 0; l < _lanes; ++l) { \
+            masks[l] = b < blocksCount[l]? ~(uint32_t)0: 0; \
+            for (int t = 0; t < 16; ++t) \
+                words[t][l] = masks[l]? savedhi_sha256_load( blocks[l] + 64 * b + 4 * t ): 0; \
+        } \
+        \
+        savedhi_sha256_x##_lanes w[16], mask; \
+        memcpy( w, words, sizeof( w ) ); \
+        memcpy( &mask, masks, sizeof( mask ) ); \
+        savedhi_sha256_compress( savedhi_sha256_x##_lanes, state, w, mask ); \
+    } \
+    \
+    for (int i = 0; i < 8; ++i) \
+        memcpy( states[i], &state[i], sizeof( state[i] ) ); \
+}
+
+#if savedhi_SHA256_X86
+savedhi_sha256_blocks_lanes( 8, "avx2" )
+savedhi_sha256_blocks_lanes( 16, "avx512f" )
+#endif
+
+size_t savedhi_sha256_lanes() {
+
+    savedhi_sha256_select();
+    return savedhi_sha256_lanes_selected;
+}
+
+const char *savedhi_sha256_lanes_name() {
+
+    switch (savedhi_sha256_lanes()) {
+        case 16:
+            return "avx512f x16";
+        case 8:
+            return "avx2 x8";
+        default:
+            return "scalar";
+    }
+}
+
+bool savedhi_sha256_lanes_set(
+        const size_t lanes) {
+
+    savedhi_sha256_select();
+    switch (lanes) {
+        case 1:
+            break;
+#if savedhi_SHA256_X86
+        case 8:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports( "avx2" ))
+                return false;
+            break;
+        case 16:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports( "avx512f" ))
+                return false;
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    savedhi_sha256_lanes_selected = lanes;
+    return true;
+}
+
+static void savedhi_sha256_blocks_x(
+        const size_t lanes, uint32_t states[8][savedhi_sha256_lanes_max], const uint8_t *const blocks[], const size_t blocksCount[]) {
+
+    switch (lanes) {
+#if savedhi_SHA256_X86
+        case 16:
+            savedhi_sha256_blocks_x16( states, blocks, blocksCount );
+            return;
+        case 8:
+            savedhi_sha256_blocks_x8( states, blocks, blocksCount );
+            return;
+#endif
+        default:
+            for (size_t l = 0; l < lanes; ++l) {
+                uint32_t state[8];
+                for (int i = 0; i < 8; ++i)
+                    state[i] = states[i][l];
+                savedhi_sha256_blocks( state, blocks[l], blocksCount[l] );
+                for (int i = 0; i < 8; ++i)
+                    states[i][l] = state[i];
+            }
+    }
+}
+
+/** Pad a message, preceded by prefixSize bytes that have already been processed, into whole blocks. */
+static size_t savedhi_sha256_pad(
+        uint8_t *blocks, const uint8_t *message, const size_t messageSize, const size_t prefixSize) {
+
+    size_t blocksCount = (messageSize + 1 + 8 + 63) / 64;
+    uint64_t bits = (uint64_t)(prefixSize + messageSize) * 8;
+    memcpy( blocks, message, messageSize );
+    memset( blocks + messageSize, 0, blocksCount * 64 - messageSize );
+    blocks[messageSize] = 0x80;
+    savedhi_sha256_store( blocks + blocksCount * 64 - 8, (uint32_t)(bits >> 32) );
+    savedhi_sha256_store( blocks + blocksCount * 64 - 4, (uint32_t)bits );
+
+    return blocksCount;
+}
+
+void savedhi_sha256_init(
+        savedhiSHA256 *sha256) {
+
+    memcpy( sha256->state, savedhi_sha256_iv, sizeof( sha256->state ) );
+    sha256->size = 0;
+}
+
+void savedhi_sha256_update(
+        savedhiSHA256 *sha256, const uint8_t *message, size_t messageSize) {
+
+    size_t buffered = sha256->size % sizeof( sha256->buffer );
+    sha256->size += messageSize;
+
+    // Complete a partially buffered block first.
+    if (buffered) {
+        size_t filled = sizeof( sha256->buffer ) - buffered < messageSize? sizeof( sha256->buffer ) - buffered: messageSize;
+        memcpy( sha256->buffer + buffered, message, filled );
+        message += filled;
+        messageSize -= filled;
+        if (buffered + filled < sizeof( sha256->buffer ))
+            return;
+
+        savedhi_sha256_blocks( sha256->state, sha256->buffer, 1 );
+    }
+
+    savedhi_sha256_blocks( sha256->state, message, messageSize / 64 );
+    memcpy( sha256->buffer, message + messageSize / 64 * 64, messageSize % 64 );
+}
+
+void savedhi_sha256_final(
+        savedhiSHA256 *sha256, uint8_t digest[static 32]) {
+
+    uint8_t blocks[2 * 64];
+    size_t buffered = sha256->size % sizeof( sha256->buffer );
+    savedhi_sha256_blocks( sha256->state, blocks, savedhi_sha256_pad( blocks, sha256->buffer, buffered, sha256->size - buffered ) );
+    for (int i = 0; i < 8; ++i)
+        savedhi_sha256_store( digest + 4 * i, sha256->state[i] );
+
+    savedhi_zero( blocks, sizeof( blocks ) );
+    savedhi_zero( sha256, sizeof( *sha256 ) );
+}
+
+void savedhi_sha256_hmac_init(
+        savedhiSHA256HMAC *hmac, const uint8_t *key, const size_t keySize) {
+
+    // Keys longer than a block are hashed down to a digest.
+    uint8_t pad[64] = { 0 };
+    if (keySize > sizeof( pad )) {
+        savedhi_sha256_init( &hmac->inner );
+        savedhi_sha256_update( &hmac->inner, key, keySize );
+        savedhi_sha256_final( &hmac->inner, pad );
+    }
+    else if (keySize)
+        memcpy( pad, key, keySize );
+
+    for (size_t i = 0; i < sizeof( pad ); ++i)
+        pad[i] ^= 0x36;
+    savedhi_sha256_init( &hmac->inner );
+    savedhi_sha256_update( &hmac->inner, pad, sizeof( pad ) );
+
+    for (size_t i = 0; i < sizeof( pad ); ++i)
+        pad[i] ^= 0x36 ^ 0x5c;
+    savedhi_sha256_init( &hmac->outer );
+    savedhi_sha256_update( &hmac->outer, pad, sizeof( pad ) );
+
+    savedhi_zero( pad, sizeof( pad ) );
+}
+
+void savedhi_sha256_hmac_update(
+        savedhiSHA256HMAC *hmac, const uint8_t *message, const size_t messageSize) {
+
+    savedhi_sha256_update( &hmac->inner, message, messageSize );
+}
+
+void savedhi_sha256_hmac_final(
+        savedhiSHA256HMAC *hmac, uint8_t mac[static 32]) {
+
+    uint8_t innerHash[32];
+    savedhi_sha256_final( &hmac->inner, innerHash );
+    savedhi_sha256_update( &hmac->outer, innerHash, sizeof( innerHash ) );
+    savedhi_sha256_final( &hmac->outer, mac );
+
+    savedhi_zero( innerHash, sizeof( innerHash ) );
+    savedhi_zero( hmac, sizeof( *hmac ) );
+}
+
+/** The amount of blocks of each lane that are prepared for the SHA-256 kernel at once. */
+#define savedhi_sha256_lanes_window 4
+
+/** Copy the part of a segment that lies within a window of a byte stream, both given by their offset in the stream. */
+static void savedhi_sha256_window(
+        uint8_t *window, const size_t windowOffset, const size_t windowSize,
+        const uint8_t *segment, const size_t segmentOffset, const size_t segmentSize) {
+
+    const size_t from = windowOffset > segmentOffset? windowOffset: segmentOffset;
+    const size_t to = windowOffset + windowSize < segmentOffset + segmentSize? windowOffset + windowSize: segmentOffset + segmentSize;
+    if (from < to)
+        memcpy( window + from - windowOffset, segment + from - segmentOffset, to - from );
+}
+
+bool savedhi_hash_hmac_sha256_lanes(
+        uint8_t macs[][32], const savedhiHMACState *state,
+        const uint8_t *const messages[], const size_t messageSizes[], const size_t count) {
+
+    if (!macs || !state || !messages || !messageSizes)
+        return false;
+    for (size_t m = 0; m < count; ++m)
+        if (!messages[m] || !messageSizes[m])
+            return false;
+
+    // Pick up the keyed state: the inner hash after its key pad and any whole blocks of its prefix, the rest of its prefix,
+    // and the outer hash after its key pad.
+    uint32_t inner[8], outer[8];
+    uint8_t prefix[64];
+    uint64_t prefixSize;
+    if (!savedhi_hash_hmac_sha256_midstate( state, inner, outer, prefix, &prefixSize ))
+        return false;
+    const size_t buffered = prefixSize % sizeof( prefix ), processed = prefixSize - buffered;
+
+    // Hash the messages, a lane-width group at a time.
+    const size_t lanes = savedhi_sha256_lanes();
+    uint32_t states[8][savedhi_sha256_lanes_max];
+    uint8_t laneBlocks[savedhi_sha256_lanes_max][savedhi_sha256_lanes_window * 64];
+    const uint8_t *blocks[savedhi_sha256_lanes_max];
+    size_t blocksCount[savedhi_sha256_lanes_max], laneBlocksCount[savedhi_sha256_lanes_max];
+    for (size_t l = 0; l < lanes; ++l)
+        blocks[l] = laneBlocks[l];
+    for (size_t m = 0; m < count; m += lanes) {
+        const size_t group = count - m < lanes? count - m: lanes;
+
+        // Inner hash: the rest of the prefix, the message and its padding, a window of blocks at a time.
+        size_t maxBlocksCount = 0;
+        for (size_t l = 0; l < lanes; ++l) {
+            laneBlocksCount[l] = l < group? (buffered + messageSizes[m + l] + 1 + 8 + 63) / 64: 0;
+            if (laneBlocksCount[l] > maxBlocksCount)
+                maxBlocksCount = laneBlocksCount[l];
+            for (int i = 0; i < 8; ++i)
+                states[i][l] = inner[i];
+        }
+        for (size_t b = 0; b < maxBlocksCount; b += savedhi_sha256_lanes_window) {
+            for (size_t l = 0; l < lanes; ++l) {
+                blocksCount[l] = laneBlocksCount[l] > b? laneBlocksCount[l] - b: 0;
+                if (blocksCount[l] > savedhi_sha256_lanes_window)
+                    blocksCount[l] = savedhi_sha256_lanes_window;
+                if (!blocksCount[l])
+                    continue;
+
+                const size_t windowOffset = b * 64, windowSize = blocksCount[l] * 64;
+                const size_t messageSize = buffered + messageSizes[m + l];
+                uint8_t trailer[8];
+                savedhi_sha256_store( trailer, (uint32_t)((processed + messageSize) >> 29) );
+                savedhi_sha256_store( trailer + 4, (uint32_t)((processed + messageSize) << 3) );
+                memset( laneBlocks[l], 0, windowSize );
+                savedhi_sha256_window( laneBlocks[l], windowOffset, windowSize, prefix, 0, buffered );
+                savedhi_sha256_window( laneBlocks[l], windowOffset, windowSize, messages[m + l], buffered, messageSizes[m + l] );
+                savedhi_sha256_window( laneBlocks[l], windowOffset, windowSize, (const uint8_t[]){ 0x80 }, messageSize, 1 );
+                savedhi_sha256_window( laneBlocks[l], windowOffset, windowSize, trailer, laneBlocksCount[l] * 64 - 8, 8 );
+            }
+            savedhi_sha256_blocks_x( lanes, states, blocks, blocksCount );
+        }
+
+        // Outer hash: the inner hash after the outer key pad.
+        for (size_t l = 0; l < lanes; ++l) {
+            uint8_t innerHash[32];
+            for (int i = 0; i < 8; ++i) {
+                savedhi_sha256_store( innerHash + 4 * i, states[i][l] );
+                states[i][l] = outer[i];
+            }
+            blocksCount[l] = l < group? savedhi_sha256_pad( laneBlocks[l], innerHash, sizeof( innerHash ), 64 ): 0;
+            savedhi_zero( innerHash, sizeof( innerHash ) );
+        }
+        savedhi_sha256_blocks_x( lanes, states, blocks, blocksCount );
+
+        for (size_t l = 0; l < group; ++l)
+            for (int i = 0; i < 8; ++i)
+                savedhi_sha256_store( macs[m + l] + 4 * i, states[i][l] );
+    }
+
+    savedhi_zero( states, sizeof( states ) );
+    savedhi_zero( laneBlocks, sizeof( laneBlocks ) );
+    savedhi_zero( prefix, sizeof( prefix ) );
+    savedhi_zero( inner, sizeof( inner ) );
+    savedhi_zero( outer, sizeof( outer ) );
+    return true;
+}
@@ -0,0 +1,98 @@
+// =============================================================================
+// Created by Maarten Billemont on 2026-10-16.
+// Copyright (c) 2011, Maarten Billemont.
+//
+// This file is part of savedhi.
+// savedhi is free software. You can modify it under the terms of
+// the GNU General Public License, either version 3 or any later version.
+// See the LICENSE file for details or consult <http://www.gnu.org/licenses/>.
+//
+// Note: this grant does not include any rights for use of savedhi's trademarks.
+// =============================================================================
+
+#ifndef _savedhi_SHA256_H
+#define _savedhi_SHA256_H
+
+#include "savedhi-types.h"
+
+savedhi_LIBS_BEGIN
+#include <stddef.h>
+savedhi_LIBS_END
+
+//// SHA-256.
+///
+/// Single messages are hashed with the CPU's SHA-256 instructions (x86 SHA-NI or ARMv8 crypto extensions) where available,
+/// and by the crypto backend (libsodium or cperciva) otherwise.  The choice is made once, by the first thread that needs it,
+/// and can be overridden with the savedhi_SHA256 environment variable: sha-ni, armv8, portable or backend.
+
+/** The environment variable that overrides the choice of SHA-256 implementation. */
+#define savedhi_ENV_sha256      "savedhi_SHA256"
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t size;
+    uint8_t buffer[64];
+} savedhiSHA256;
+
+typedef struct {
+    savedhiSHA256 inner;
+    savedhiSHA256 outer;
+} savedhiSHA256HMAC;
+
+/** @return The name of the implementation that hashes single messages: sha-ni, armv8, portable or backend. */
+const char *savedhi_sha256_name(void);
+/** @return true if single messages should be hashed in-tree, false if they should be left to the crypto backend. */
+bool savedhi_sha256_intree(void);
+/** Select the implementation that hashes single messages by name, as the savedhi_SHA256 environment variable does, eg. to compare them.
+ * Not thread-safe.  HMAC states already keyed keep being finalized by the implementation (in-tree or backend) that keyed them.
+ * @return false if the implementation isn't supported on this CPU, leaving the selection unchanged. */
+bool savedhi_sha256_set(
+        const char *name);
+
+/** Process whole 64-byte blocks into a SHA-256 state, using the CPU's SHA-256 instructions where available. */
+void savedhi_sha256_blocks(
+        uint32_t state[static 8], const uint8_t *blocks, const size_t blocksCount);
+
+void savedhi_sha256_init(
+        savedhiSHA256 *sha256);
+void savedhi_sha256_update(
+        savedhiSHA256 *sha256, const uint8_t *message, size_t messageSize);
+/** Write out the message digest and wipe the state. */
+void savedhi_sha256_final(
+        savedhiSHA256 *sha256, uint8_t digest[static 32]);
+
+void savedhi_sha256_hmac_init(
+        savedhiSHA256HMAC *hmac, const uint8_t *key, const size_t keySize);
+void savedhi_sha256_hmac_update(
+        savedhiSHA256HMAC *hmac, const uint8_t *message, const size_t messageSize);
+/** Write out the message MAC and wipe the state. */
+void savedhi_sha256_hmac_final(
+        savedhiSHA256HMAC *hmac, uint8_t mac[static 32]);
+
+//// SHA-256 kernels.
+///
+/// The crypto backend hashes a single message at a time.  These kernels hash many independent messages at once,
+/// interleaving them across the lanes of the widest vector unit the CPU offers (AVX-512: 16, AVX2: 8, otherwise 1).
+
+/** The maximum amount of messages a SHA-256 kernel hashes at once. */
+#define savedhi_sha256_lanes_max 16
+
+/** @return The amount of messages the SHA-256 kernel selected for this CPU hashes at once. */
+size_t savedhi_sha256_lanes(void);
+/** @return The name of the SHA-256 kernel selected for this CPU. */
+const char *savedhi_sha256_lanes_name(void);
+
+/** Select the SHA-256 kernel that hashes the given amount of messages at once, eg. to compare kernels.
+ * @return false if this CPU has no kernel of that width. */
+bool savedhi_sha256_lanes_set(
+        const size_t lanes);
+
+/** Calculate the MACs for many messages using SHA256-HMAC, continuing from the same keyed state,
+ * eg. a user key's purpose state, and hashing as many messages at once as the CPU allows.  Does not allocate.
+ * @param macs An array of count 32-byte buffers to receive the MAC of each message.
+ * @return false if the state isn't keyed or any message is missing. */
+bool savedhi_hash_hmac_sha256_lanes(
+        uint8_t macs[][32], const savedhiHMACState *state,
+        const uint8_t *const messages[], const size_t messageSizes[], const size_t count);
+
+#endif // _savedhi_SHA256_H
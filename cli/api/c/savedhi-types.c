@@ -12,6 +12,7 @@
 
 #include "savedhi-types.h"
 #include "savedhi-util.h"
+#include "savedhi-sha256.h"
 
 savedhi_LIBS_BEGIN
 #include <string.h>
@@ -55,13 +56,21 @@ const savedhiKeyID savedhi_id_buf(const uint8_t *buf, const size_t size) {
     if (!buf)
         return keyID;
 
+    if (savedhi_sha256_intree()) {
+        savedhiSHA256 sha256;
+        savedhi_sha256_init( &sha256 );
+        savedhi_sha256_update( &sha256, buf, size );
+        savedhi_sha256_final( &sha256, keyID.bytes );
+    }
+    else {
 #if savedhi_CPERCIVA
-    SHA256_Buf( buf, size, keyID.bytes );
+        SHA256_Buf( buf, size, keyID.bytes );
 #elif savedhi_SODIUM
-    crypto_hash_sha256( keyID.bytes, buf, size );
+        crypto_hash_sha256( keyID.bytes, buf, size );
 #else
 #error No crypto support for savedhi_id_buf.
 #endif
+    }
 
     size_t hexSize = sizeof( keyID.hex );
     if (savedhi_hex( keyID.bytes, sizeof( keyID.bytes ), keyID.hex, &hexSize ) != keyID.hex)
@@ -88,6 +97,32 @@ const savedhiKeyID savedhi_id_str(const char hex[static 65]) {
     return keyID;
 }
 
+const savedhiKeyID *savedhi_user_key_id(const savedhiUserKey *userKey) {
+
+    if (!userKey)
+        return NULL;
+
+    if (!savedhi_id_valid( &userKey->keyID )) {
+        savedhiKeyID keyID = savedhi_id_buf( userKey->bytes, sizeof( userKey->bytes ) );
+        memcpy( (savedhiKeyID *)&userKey->keyID, &keyID, sizeof( userKey->keyID ) );
+    }
+
+    return &userKey->keyID;
+}
+
+const savedhiKeyID *savedhi_site_key_id(const savedhiSiteKey *siteKey) {
+
+    if (!siteKey)
+        return NULL;
+
+    if (!savedhi_id_valid( &siteKey->keyID )) {
+        savedhiKeyID keyID = savedhi_id_buf( siteKey->bytes, sizeof( siteKey->bytes ) );
+        memcpy( (savedhiKeyID *)&siteKey->keyID, &keyID, sizeof( siteKey->keyID ) );
+    }
+
+    return &siteKey->keyID;
+}
+
 const savedhiResultType savedhi_type_named(const char *typeName) {
 
     // Find what password type is represented by the type letter.
@@ -250,7 +285,30 @@ const char *savedhi_type_long_name(const savedhiResultType resultType) {
     }
 }
 
-const char **savedhi_type_templates(const savedhiResultType type, size_t *count) {
+static const char *const savedhi_templates_maximum[] = {
+        "anoxxxxxxxxxxxxxxxxx", "axxxxxxxxxxxxxxxxxno" };
+static const char *const savedhi_templates_long[] = {
+        "CvcvnoCvcvCvcv", "CvcvCvcvnoCvcv", "CvcvCvcvCvcvno",
+        "CvccnoCvcvCvcv", "CvccCvcvnoCvcv", "CvccCvcvCvcvno",
+        "CvcvnoCvccCvcv", "CvcvCvccnoCvcv", "CvcvCvccCvcvno",
+        "CvcvnoCvcvCvcc", "CvcvCvcvnoCvcc", "CvcvCvcvCvccno",
+        "CvccnoCvccCvcv", "CvccCvccnoCvcv", "CvccCvccCvcvno",
+        "CvcvnoCvccCvcc", "CvcvCvccnoCvcc", "CvcvCvccCvccno",
+        "CvccnoCvcvCvcc", "CvccCvcvnoCvcc", "CvccCvcvCvccno" };
+static const char *const savedhi_templates_medium[] = {
+        "CvcnoCvc", "CvcCvcno" };
+static const char *const savedhi_templates_short[] = {
+        "Cvcn" };
+static const char *const savedhi_templates_basic[] = {
+        "aaanaaan", "aannaaan", "aaannaaa" };
+static const char *const savedhi_templates_pin[] = {
+        "nnnn" };
+static const char *const savedhi_templates_name[] = {
+        "cvccvcvcv" };
+static const char *const savedhi_templates_phrase[] = {
+        "cvcc cvc cvccvcv cvc", "cvc cvccvcvcv cvcv", "cv cvccv cvc cvcvccv" };
+
+const char *const *savedhi_type_templates_static(const savedhiResultType type, size_t *count) {
 
     *count = 0;
     if (!(type & savedhiResultClassTemplate)) {
@@ -258,52 +316,64 @@ const char **savedhi_type_templates(const savedhiResultType type, size_t *count)
         return NULL;
     }
 
+    const char *const *templates = NULL;
     switch (type) {
         case savedhiResultTemplateMaximum:
-            return savedhi_strings( count,
-                    "anoxxxxxxxxxxxxxxxxx", "axxxxxxxxxxxxxxxxxno", NULL );
+            templates = savedhi_templates_maximum;
+            *count = sizeof( savedhi_templates_maximum ) / sizeof( *savedhi_templates_maximum );
+            break;
         case savedhiResultTemplateLong:
-            return savedhi_strings( count,
-                    "CvcvnoCvcvCvcv", "CvcvCvcvnoCvcv", "CvcvCvcvCvcvno",
-                    "CvccnoCvcvCvcv", "CvccCvcvnoCvcv", "CvccCvcvCvcvno",
-                    "CvcvnoCvccCvcv", "CvcvCvccnoCvcv", "CvcvCvccCvcvno",
-                    "CvcvnoCvcvCvcc", "CvcvCvcvnoCvcc", "CvcvCvcvCvccno",
-                    "CvccnoCvccCvcv", "CvccCvccnoCvcv", "CvccCvccCvcvno",
-                    "CvcvnoCvccCvcc", "CvcvCvccnoCvcc", "CvcvCvccCvccno",
-                    "CvccnoCvcvCvcc", "CvccCvcvnoCvcc", "CvccCvcvCvccno", NULL );
+            templates = savedhi_templates_long;
+            *count = sizeof( savedhi_templates_long ) / sizeof( *savedhi_templates_long );
+            break;
         case savedhiResultTemplateMedium:
-            return savedhi_strings( count,
-                    "CvcnoCvc", "CvcCvcno", NULL );
+            templates = savedhi_templates_medium;
+            *count = sizeof( savedhi_templates_medium ) / sizeof( *savedhi_templates_medium );
+            break;
         case savedhiResultTemplateShort:
-            return savedhi_strings( count,
-                    "Cvcn", NULL );
+            templates = savedhi_templates_short;
+            *count = sizeof( savedhi_templates_short ) / sizeof( *savedhi_templates_short );
+            break;
         case savedhiResultTemplateBasic:
-            return savedhi_strings( count,
-                    "aaanaaan", "aannaaan", "aaannaaa", NULL );
+            templates = savedhi_templates_basic;
+            *count = sizeof( savedhi_templates_basic ) / sizeof( *savedhi_templates_basic );
+            break;
         case savedhiResultTemplatePIN:
-            return savedhi_strings( count,
-                    "nnnn", NULL );
+            templates = savedhi_templates_pin;
+            *count = sizeof( savedhi_templates_pin ) / sizeof( *savedhi_templates_pin );
+            break;
         case savedhiResultTemplateName:
-            return savedhi_strings( count,
-                    "cvccvcvcv", NULL );
+            templates = savedhi_templates_name;
+            *count = sizeof( savedhi_templates_name ) / sizeof( *savedhi_templates_name );
+            break;
         case savedhiResultTemplatePhrase:
-            return savedhi_strings( count,
-                    "cvcc cvc cvccvcv cvc", "cvc cvccvcvcv cvcv", "cv cvccv cvc cvcvccv", NULL );
+            templates = savedhi_templates_phrase;
+            *count = sizeof( savedhi_templates_phrase ) / sizeof( *savedhi_templates_phrase );
+            break;
         default: {
             wrn( "Unknown generated type: %d", type );
-            return NULL;
+            break;
         }
     }
+
+    return templates;
+}
+
+const char **savedhi_type_templates(const savedhiResultType type, size_t *count) {
+
+    const char *const *templates = savedhi_type_templates_static( type, count );
+    if (!templates)
+        return NULL;
+
+    return savedhi_memdup( templates, *count * sizeof( *templates ) );
 }
 
 const char *savedhi_type_template(const savedhiResultType type, const uint8_t templateIndex) {
 
     size_t count = 0;
-    const char **templates = savedhi_type_templates( type, &count );
-    char const *template = templates && count? templates[templateIndex % count]: NULL;
-    free( templates );
+    const char *const *templates = savedhi_type_templates_static( type, &count );
 
-    return template;
+    return templates && count? templates[templateIndex % count]: NULL;
 }
 
 const char *savedhi_algorithm_short_name(const savedhiAlgorithm algorithm) {
@@ -417,11 +487,67 @@ const char *savedhi_class_characters(const char characterClass) {
     }
 }
 
+// For each character class, the class character that encodes each seed byte: characters[seedByte % strlen( characters )].
+static const char *const savedhi_class_encodings[128] = {
+        ['V'] =
+        "AEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIO"
+        "UAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEI"
+        "OUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAE"
+        "IOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUAEIOUA",
+        ['C'] =
+        "BCDFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZB"
+        "CDFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBC"
+        "DFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBCD"
+        "FGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBCDFGHJKLMNPQRSTVWXYZBCDF",
+        ['v'] =
+        "aeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeio"
+        "uaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaei"
+        "ouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouae"
+        "iouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeiouaeioua",
+        ['c'] =
+        "bcdfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzb"
+        "cdfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbc"
+        "dfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbcd"
+        "fghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbcdfghjklmnpqrstvwxyzbcdf",
+        ['A'] =
+        "AEIOUBCDFGHJKLMNPQRSTVWXYZAEIOUBCDFGHJKLMNPQRSTVWXYZAEIOUBCDFGHJ"
+        "KLMNPQRSTVWXYZAEIOUBCDFGHJKLMNPQRSTVWXYZAEIOUBCDFGHJKLMNPQRSTVWX"
+        "YZAEIOUBCDFGHJKLMNPQRSTVWXYZAEIOUBCDFGHJKLMNPQRSTVWXYZAEIOUBCDFG"
+        "HJKLMNPQRSTVWXYZAEIOUBCDFGHJKLMNPQRSTVWXYZAEIOUBCDFGHJKLMNPQRSTV",
+        ['a'] =
+        "AEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfghjklmnpqrstvwxyzAEIOUaeiouBC"
+        "DFGHJKLMNPQRSTVWXYZbcdfghjklmnpqrstvwxyzAEIOUaeiouBCDFGHJKLMNPQR"
+        "STVWXYZbcdfghjklmnpqrstvwxyzAEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfg"
+        "hjklmnpqrstvwxyzAEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfghjklmnpqrstv",
+        ['n'] =
+        "0123456789012345678901234567890123456789012345678901234567890123"
+        "4567890123456789012345678901234567890123456789012345678901234567"
+        "8901234567890123456789012345678901234567890123456789012345678901"
+        "2345678901234567890123456789012345678901234567890123456789012345",
+        ['o'] =
+        "@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!"
+        "'^~;()/.@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]"
+        "_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!'^~;()/."
+        "@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!'^~;()/.@&%?,=[]_:-+*$#!",
+        ['x'] =
+        "AEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfghjklmnpqrstvwxyz0123456789!@"
+        "#$%^&*()AEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfghjklmnpqrstvwxyz0123"
+        "456789!@#$%^&*()AEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfghjklmnpqrstv"
+        "wxyz0123456789!@#$%^&*()AEIOUaeiouBCDFGHJKLMNPQRSTVWXYZbcdfghjkl",
+        [' '] =
+        "                                                                "
+        "                                                                "
+        "                                                                "
+        "                                                                "
+};
+
 const char savedhi_class_character(const char characterClass, const uint8_t seedByte) {
 
-    const char *classCharacters = savedhi_class_characters( characterClass );
-    if (!classCharacters || !strlen( classCharacters ))
+    const char *encodings = (unsigned char)characterClass < 128? savedhi_class_encodings[(unsigned char)characterClass]: NULL;
+    if (!encodings) {
+        wrn( "Unknown character class: %c", characterClass );
         return '\0';
+    }
 
-    return classCharacters[seedByte % strlen( classCharacters )];
+    return encodings[seedByte];
 }
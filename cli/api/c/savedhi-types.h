@@ -74,33 +74,53 @@ typedef struct {
 } savedhiKeyID;
 extern const savedhiKeyID savedhiKeyIDUnset;
 
+typedef savedhi_enum( uint8_t, savedhiKeyPurpose ) {
+    /** Generate a key for authentication. */
+    savedhiKeyPurposeAuthentication,
+    /** Generate a name for identification. */
+    savedhiKeyPurposeIdentification,
+    /** Generate a recovery token. */
+    savedhiKeyPurposeRecovery,
+};
+
+typedef struct {
+    /** The crypto backend's HMAC-SHA-256 context (opaque), keyed and having absorbed any message prefix. */
+    uint64_t context[256 / 8];
+    /** Whether the context has been keyed. */
+    bool keyed;
+    /** Whether the context was keyed by the in-tree SHA-256 rather than the crypto backend, which lay it out differently. */
+    bool intree;
+} savedhiHMACState;
+
+typedef struct {
+    /** The AES-128 round keys for encryption. */
+    uint8_t encrypt[11 * 16];
+    /** The AES-128 round keys for decryption, in the order of and transformed for the equivalent inverse cipher. */
+    uint8_t decrypt[11 * 16];
+} savedhiAESKey;
+
 typedef struct {
     /** The cryptographic key */
     const uint8_t bytes[512 / 8];
-    /** The key's identity */
+    /** The key's identity, unset until needed (see savedhi_user_key_id) */
     const savedhiKeyID keyID;
     /** The algorithm the key was made by & for */
     const savedhiAlgorithm algorithm;
+    /** HMAC-SHA-256 states keyed by the key, having absorbed the scope of each key purpose */
+    const savedhiHMACState purposeStates[savedhiKeyPurposeRecovery + 1];
+    /** AES-128 round keys expanded from the key, for encrypting and decrypting stateful results */
+    const savedhiAESKey aesKey;
 } savedhiUserKey;
 
 typedef struct {
     /** The cryptographic key */
     const uint8_t bytes[256 / 8]; // HMAC-SHA-256
-    /** The key's identity */
+    /** The key's identity, unset until needed (see savedhi_site_key_id) */
     const savedhiKeyID keyID;
     /** The algorithm the key was made by & for */
     const savedhiAlgorithm algorithm;
 } savedhiSiteKey;
 
-typedef savedhi_enum( uint8_t, savedhiKeyPurpose ) {
-    /** Generate a key for authentication. */
-    savedhiKeyPurposeAuthentication,
-    /** Generate a name for identification. */
-    savedhiKeyPurposeIdentification,
-    /** Generate a recovery token. */
-    savedhiKeyPurposeRecovery,
-};
-
 // bit 4 - 9
 typedef savedhi_opts( uint16_t, savedhiResultClass ) {
     /** Use the site key to generate a result from a template. */
@@ -203,6 +223,12 @@ bool savedhi_id_equals(const savedhiKeyID *id1, const savedhiKeyID *id2);
 const savedhiKeyID savedhi_id_buf(const uint8_t *buf, const size_t size);
 /** Reconstruct a fingerprint from its hexadecimal string representation. */
 const savedhiKeyID savedhi_id_str(const char hex[static 65]);
+/** Fingerprint a user key, computing its keyID the first time it is needed.
+ * @return The user key's keyID or NULL if the userKey is missing. */
+const savedhiKeyID *savedhi_user_key_id(const savedhiUserKey *userKey);
+/** Fingerprint a site key, computing its keyID the first time it is needed.
+ * @return The site key's keyID or NULL if the siteKey is missing. */
+const savedhiKeyID *savedhi_site_key_id(const savedhiSiteKey *siteKey);
 
 /**
  * @return The standard identifying name (static) for the given algorithm or NULL if the algorithm is not known.
@@ -248,6 +274,11 @@ const char *savedhi_type_long_name(const savedhiResultType resultType);
  *         NULL if the type is not known or is not a savedhiResultClassTemplate.
  */
 const char **savedhi_type_templates(const savedhiResultType type, size_t *count);
+/**
+ * @return An array (static, count) of strings (static) that express the templates to use for the given type.
+ *         NULL if the type is not known or is not a savedhiResultClassTemplate.
+ */
+const char *const *savedhi_type_templates_static(const savedhiResultType type, size_t *count);
 /**
  * @return A C-string (static) that contains the result encoding template of the given type for a seed that starts with the given byte.
  *         NULL if the type is not known or is not a savedhiResultClassTemplate.
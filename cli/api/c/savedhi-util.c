@@ -10,12 +10,28 @@
 // Note: this grant does not include any rights for use of savedhi's trademarks.
 // =============================================================================
 
+#define _DEFAULT_SOURCE
+
 #include "savedhi-util.h"
+#include "savedhi-aes.h"
+#include "savedhi-sha256.h"
+#include "savedhi-scrypt.h"
+
+#if defined( _WIN32 ) || defined( __STDC_NO_ATOMICS__ )
+#define savedhi_LOG_RING_THREADS 0
+#else
+#define savedhi_LOG_RING_THREADS 1
+#endif
 
 savedhi_LIBS_BEGIN
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#if savedhi_LOG_RING_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#endif
 
 #if savedhi_CPERCIVA
 #include <scrypt/crypto_scrypt.h>
@@ -23,10 +39,6 @@ savedhi_LIBS_BEGIN
 #elif savedhi_SODIUM
 #include "sodium.h"
 #endif
-#define ECB 0
-#define CBC 1
-#define CTR 0
-#include "aes.h"
 savedhi_LIBS_END
 
 savedhiLogLevel savedhi_verbosity = savedhiLogLevelInfo;
@@ -130,13 +142,13 @@ bool savedhi_elog(savedhiLogEvent *event) {
     return sunk;
 }
 
-bool savedhi_log_sink_file(savedhiLogEvent *event) {
+static void savedhi_log_sink_file_write(savedhiLogLevel level, const char *message) {
 
     if (!savedhi_log_sink_file_target)
         savedhi_log_sink_file_target = stderr;
 
     if (savedhi_verbosity >= savedhiLogLevelDebug) {
-        switch (event->level) {
+        switch (level) {
             case savedhiLogLevelTrace:
                 fprintf( savedhi_log_sink_file_target, "[TRC] " );
                 break;
@@ -161,10 +173,212 @@ bool savedhi_log_sink_file(savedhiLogEvent *event) {
         }
     }
 
-    fprintf( savedhi_log_sink_file_target, "%s\n", event->formatter( event ) );
+    fprintf( savedhi_log_sink_file_target, "%s\n", message );
+}
+
+bool savedhi_log_sink_file(savedhiLogEvent *event) {
+
+    savedhi_log_sink_file_write( event->level, event->formatter( event ) );
     return true;
 }
 
+#if savedhi_LOG_RING_THREADS
+#define savedhi_log_sink_ring_slots 1024
+#define savedhi_log_sink_ring_message 256
+
+/** A ring slot is free for the producer that claims position p when its sequence is p,
+ * and holds a message for the writer at position p when its sequence is p + 1. */
+typedef struct savedhiLogSlot {
+    atomic_size_t sequence;
+    savedhiLogLevel level;
+    char message[savedhi_log_sink_ring_message];
+} savedhiLogSlot;
+
+static savedhiLogSlot savedhi_log_ring[savedhi_log_sink_ring_slots];
+static atomic_size_t savedhi_log_ring_tail, savedhi_log_ring_dropped, savedhi_log_ring_truncated;
+static size_t savedhi_log_ring_head, savedhi_log_ring_reported;
+static pthread_once_t savedhi_log_ring_once = PTHREAD_ONCE_INIT;
+static atomic_bool savedhi_log_ring_running;
+static pthread_t savedhi_log_ring_writer;
+static pthread_mutex_t savedhi_log_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t savedhi_log_ring_signal = PTHREAD_COND_INITIALIZER;
+
+/** Write out all messages in the ring, in order. Only the writer (or whoever stopped it) drains the ring. */
+static void savedhi_log_ring_drain(void) {
+
+    for (;; ++savedhi_log_ring_head) {
+        savedhiLogSlot *slot = &savedhi_log_ring[savedhi_log_ring_head % savedhi_log_sink_ring_slots];
+        if (atomic_load_explicit( &slot->sequence, memory_order_acquire ) != savedhi_log_ring_head + 1)
+            break;
+
+        savedhi_log_sink_file_write( slot->level, slot->message );
+        atomic_store_explicit( &slot->sequence, savedhi_log_ring_head + savedhi_log_sink_ring_slots, memory_order_release );
+    }
+
+    size_t dropped = atomic_load( &savedhi_log_ring_dropped );
+    if (dropped != savedhi_log_ring_reported) {
+        char message[savedhi_log_sink_ring_message];
+        snprintf( message, sizeof( message ), "Log ring full, dropped %zu messages.", dropped - savedhi_log_ring_reported );
+        savedhi_log_sink_file_write( savedhiLogLevelWarning, message );
+        savedhi_log_ring_reported = dropped;
+    }
+    fflush( savedhi_log_sink_file_target );
+}
+
+/** Mark a message that was cut off at the end of its slot with a trailing ellipsis, without splitting a UTF-8 character. */
+static void savedhi_log_ring_truncate(char message[static savedhi_log_sink_ring_message]) {
+
+    static const char ellipsis[] = "\xE2\x80\xA6" /* U+2026 … in UTF-8 */;
+    size_t end = savedhi_log_sink_ring_message - sizeof( ellipsis );
+    while (end && ((uint8_t)message[end] & 0xC0) == 0x80)
+        --end;
+    memcpy( &message[end], ellipsis, sizeof( ellipsis ) );
+    atomic_fetch_add_explicit( &savedhi_log_ring_truncated, 1, memory_order_relaxed );
+}
+
+static void savedhi_log_ring_init(void) {
+
+    for (size_t s = 0; s < savedhi_log_sink_ring_slots; ++s)
+        atomic_init( &savedhi_log_ring[s].sequence, s );
+}
+
+static void *savedhi_log_ring_write(void *context) {
+
+    (void)context;
+    pthread_mutex_lock( &savedhi_log_ring_mutex );
+    while (atomic_load( &savedhi_log_ring_running )) {
+        pthread_mutex_unlock( &savedhi_log_ring_mutex );
+        savedhi_log_ring_drain();
+        pthread_mutex_lock( &savedhi_log_ring_mutex );
+
+        // Producers signal without taking the mutex, so a wake-up may be missed; poll as a fallback.
+        struct timespec poll;
+        clock_gettime( CLOCK_REALTIME, &poll );
+        if ((poll.tv_nsec += 50 * 1000 * 1000) >= 1000 * 1000 * 1000) {
+            poll.tv_nsec -= 1000 * 1000 * 1000;
+            ++poll.tv_sec;
+        }
+        if (atomic_load( &savedhi_log_ring_running ))
+            pthread_cond_timedwait( &savedhi_log_ring_signal, &savedhi_log_ring_mutex, &poll );
+    }
+    pthread_mutex_unlock( &savedhi_log_ring_mutex );
+
+    return NULL;
+}
+#endif
+
+bool savedhi_log_sink_ring(savedhiLogEvent *event) {
+
+#if savedhi_LOG_RING_THREADS
+    // Fatal events abort as soon as the sinks return, so they can't wait for the writer.
+    if (!atomic_load_explicit( &savedhi_log_ring_running, memory_order_relaxed ) || event->level <= savedhiLogLevelFatal)
+        return savedhi_log_sink_file( event );
+
+    // Claim the slot at the ring's tail, unless the writer hasn't freed it yet.
+    savedhiLogSlot *slot;
+    size_t position = atomic_load_explicit( &savedhi_log_ring_tail, memory_order_relaxed );
+    for (;;) {
+        slot = &savedhi_log_ring[position % savedhi_log_sink_ring_slots];
+        size_t sequence = atomic_load_explicit( &slot->sequence, memory_order_acquire );
+        if (sequence == position) {
+            if (atomic_compare_exchange_weak_explicit( &savedhi_log_ring_tail, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed ))
+                break;
+        }
+        else if ((ptrdiff_t)(sequence - position) < 0) {
+            atomic_fetch_add_explicit( &savedhi_log_ring_dropped, 1, memory_order_relaxed );
+            return false;
+        }
+        else
+            position = atomic_load_explicit( &savedhi_log_ring_tail, memory_order_relaxed );
+    }
+
+    // Arguments may reference the caller's stack, so the message is merged here, into the slot, without allocating.
+    int length;
+    slot->level = event->level;
+    if (event->formatted || !event->format || !event->args)
+        length = snprintf( slot->message, sizeof( slot->message ), "%s", event->formatter( event ) );
+    else {
+        va_list args;
+        va_copy( args, *(va_list *)event->args );
+        length = vsnprintf( slot->message, sizeof( slot->message ), event->format, args );
+        va_end( args );
+    }
+    if (length >= (int)sizeof( slot->message ))
+        savedhi_log_ring_truncate( slot->message );
+    atomic_store_explicit( &slot->sequence, position + 1, memory_order_release );
+    pthread_cond_signal( &savedhi_log_ring_signal );
+
+    return true;
+#else
+    return savedhi_log_sink_file( event );
+#endif
+}
+
+bool savedhi_log_sink_ring_start(void) {
+
+#if savedhi_LOG_RING_THREADS
+    if (atomic_load( &savedhi_log_ring_running ))
+        return true;
+
+    if (!savedhi_log_sink_file_target)
+        savedhi_log_sink_file_target = stderr;
+    pthread_once( &savedhi_log_ring_once, savedhi_log_ring_init );
+
+    atomic_store( &savedhi_log_ring_running, true );
+    if (pthread_create( &savedhi_log_ring_writer, NULL, savedhi_log_ring_write, NULL ) != OK) {
+        atomic_store( &savedhi_log_ring_running, false );
+        return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void savedhi_log_sink_ring_stop(void) {
+
+#if savedhi_LOG_RING_THREADS
+    if (!atomic_load( &savedhi_log_ring_running ))
+        return;
+
+    pthread_mutex_lock( &savedhi_log_ring_mutex );
+    atomic_store( &savedhi_log_ring_running, false );
+    pthread_cond_signal( &savedhi_log_ring_signal );
+    pthread_mutex_unlock( &savedhi_log_ring_mutex );
+    pthread_join( savedhi_log_ring_writer, NULL );
+
+    // Producers that claimed a slot before the writer stopped may still be filling it.
+    for (size_t s = 0; s < savedhi_log_sink_ring_slots; ++s) {
+        size_t position = savedhi_log_ring_head + s;
+        if (position == atomic_load( &savedhi_log_ring_tail ))
+            break;
+        while (atomic_load( &savedhi_log_ring[position % savedhi_log_sink_ring_slots].sequence ) == position)
+            sched_yield();
+    }
+    savedhi_log_ring_drain();
+#endif
+}
+
+size_t savedhi_log_sink_ring_dropped(void) {
+
+#if savedhi_LOG_RING_THREADS
+    return atomic_load( &savedhi_log_ring_dropped );
+#else
+    return 0;
+#endif
+}
+
+size_t savedhi_log_sink_ring_truncated(void) {
+
+#if savedhi_LOG_RING_THREADS
+    return atomic_load( &savedhi_log_ring_truncated );
+#else
+    return 0;
+#endif
+}
+
 void savedhi_uint16(const uint16_t number, uint8_t buf[static 2]) {
 
     buf[0] = (uint8_t)((number >> 8L) & UINT8_MAX);
@@ -247,6 +461,61 @@ bool savedhi_buf_push_str(uint8_t **buffer, size_t *bufferSize, const char *push
     return pushString && savedhi_buf_push( buffer, bufferSize, (const uint8_t *)pushString, strlen( pushString ) );
 }
 
+bool savedhi_buffer_init(savedhiBuffer *buffer, const size_t capacity) {
+
+    if (!buffer)
+        return false;
+
+    buffer->size = 0;
+    buffer->capacity = capacity;
+    buffer->bytes = capacity <= sizeof( buffer->storage )? buffer->storage: malloc( capacity );
+    if (!buffer->bytes) {
+        buffer->capacity = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool savedhi_buffer_push_buf(savedhiBuffer *buffer, const uint8_t *pushBuffer, const size_t pushSize) {
+
+    if (!buffer || !buffer->bytes || !pushBuffer || !pushSize)
+        return false;
+    if (pushSize > buffer->capacity - buffer->size)
+        return false;
+
+    memcpy( buffer->bytes + buffer->size, pushBuffer, pushSize );
+    buffer->size += pushSize;
+    return true;
+}
+
+bool savedhi_buffer_push_uint32(savedhiBuffer *buffer, const uint32_t pushInt) {
+
+    if (!buffer || !buffer->bytes || sizeof( pushInt ) > buffer->capacity - buffer->size)
+        return false;
+
+    savedhi_uint32( pushInt, buffer->bytes + buffer->size );
+    buffer->size += sizeof( pushInt );
+    return true;
+}
+
+bool savedhi_buffer_push_str(savedhiBuffer *buffer, const char *pushString) {
+
+    return pushString && savedhi_buffer_push_buf( buffer, (const uint8_t *)pushString, strlen( pushString ) );
+}
+
+void savedhi_buffer_free(savedhiBuffer *buffer) {
+
+    if (!buffer || !buffer->bytes)
+        return;
+
+    savedhi_zero( buffer->bytes, buffer->size );
+    if (buffer->bytes != buffer->storage)
+        free( buffer->bytes );
+    buffer->bytes = NULL;
+    buffer->size = buffer->capacity = 0;
+}
+
 bool savedhi_string_push(char **string, const char *pushString) {
 
     if (!string || !pushString)
@@ -287,6 +556,32 @@ bool __savedhi_realloc(void **buffer, size_t *bufferSize, const size_t targetSiz
     return true;
 }
 
+bool __savedhi_reserve(void **buffer, size_t *capacity, const size_t typeSize, const size_t typeCount) {
+
+    if (!buffer || !capacity || !typeSize)
+        return false;
+    if (typeCount <= *capacity)
+        return true;
+
+    size_t newCapacity = *capacity? *capacity: 4;
+    while (newCapacity < typeCount) {
+        if (newCapacity > SIZE_MAX / 2)
+            return false;
+        newCapacity *= 2;
+    }
+    if (newCapacity > SIZE_MAX / typeSize)
+        return false;
+
+    void *newBuffer = realloc( *buffer, newCapacity * typeSize );
+    if (!newBuffer)
+        return false;
+
+    *buffer = newBuffer;
+    *capacity = newCapacity;
+
+    return true;
+}
+
 void savedhi_zero(void *buffer, size_t bufferSize) {
 
     uint8_t *b = buffer;
@@ -331,6 +626,9 @@ bool savedhi_kdf_scrypt(uint8_t *key, const size_t keySize, const uint8_t *secre
     if (!key || !keySize || !secret || !secretSize || !salt || !saltSize)
         return false;
 
+    if (savedhi_scrypt_intree())
+        return savedhi_scrypt( key, keySize, secret, secretSize, salt, saltSize, N, r, p );
+
 #if savedhi_CPERCIVA
     if (crypto_scrypt( (const void *)secret, strlen( secret ), salt, saltSize, N, r, p, key, keySize ) < 0) {
         return false;
@@ -384,6 +682,14 @@ bool savedhi_hash_hmac_sha256(uint8_t mac[static 32], const uint8_t *key, const
     if (!mac || !key || !keySize || !message || !messageSize)
         return false;
 
+    if (savedhi_sha256_intree()) {
+        savedhiSHA256HMAC hmac;
+        savedhi_sha256_hmac_init( &hmac, key, keySize );
+        savedhi_sha256_hmac_update( &hmac, message, messageSize );
+        savedhi_sha256_hmac_final( &hmac, mac );
+        return true;
+    }
+
 #if savedhi_CPERCIVA
     HMAC_SHA256_Buf( key, keySize, message, messageSize, mac );
     return true;
@@ -397,48 +703,169 @@ bool savedhi_hash_hmac_sha256(uint8_t mac[static 32], const uint8_t *key, const
 #endif
 }
 
-const static uint8_t *savedhi_aes(bool encrypt, const uint8_t *key, const size_t keySize, const uint8_t *buf, size_t *bufSize) {
+#if savedhi_CPERCIVA
+typedef HMAC_SHA256_CTX savedhi_hmac_sha256_context;
+#elif savedhi_SODIUM
+typedef crypto_auth_hmacsha256_state savedhi_hmac_sha256_context;
+#endif
+_Static_assert( sizeof( savedhi_hmac_sha256_context ) <= sizeof( ((savedhiHMACState *)NULL)->context ),
+        "savedhiHMACState too small for the crypto backend's HMAC-SHA-256 context." );
+_Static_assert( sizeof( savedhiSHA256HMAC ) <= sizeof( ((savedhiHMACState *)NULL)->context ),
+        "savedhiHMACState too small for the in-tree HMAC-SHA-256 context." );
 
-    if (!key || keySize < AES_BLOCKLEN || !bufSize || !*bufSize)
-        return NULL;
+bool savedhi_hash_hmac_sha256_init(
+        savedhiHMACState *state, const uint8_t *key, const size_t keySize, const uint8_t *prefix, const size_t prefixSize) {
 
-    // IV = zero
-    static const uint8_t iv[AES_BLOCKLEN] = { 0 };
+    if (!state || !key || !keySize)
+        return false;
 
-    // Add PKCS#7 padding
-    uint32_t aesSize = (uint32_t)*bufSize, blockRemainder = aesSize % AES_BLOCKLEN;
-    if (blockRemainder) // round up to block size.
-        aesSize += AES_BLOCKLEN - blockRemainder;
-    else if (encrypt) // add pad block if plain text fits block size.
-        aesSize += AES_BLOCKLEN;
-//    uint8_t *resultBuf = calloc( aesSize, sizeof( uint8_t ) );
-//    if (!resultBuf)
-//        return NULL;
-    uint8_t *aesBuf = malloc( aesSize );
-    if (!aesBuf) {
-//        savedhi_free( &resultBuf, aesSize );
-        return NULL;
+    // The state is finalized with the implementation that keyed it, even if another is selected in the meantime.
+    if ((state->intree = savedhi_sha256_intree())) {
+        savedhiSHA256HMAC *hmac = (savedhiSHA256HMAC *)state->context;
+        savedhi_sha256_hmac_init( hmac, key, keySize );
+        if (prefix && prefixSize)
+            savedhi_sha256_hmac_update( hmac, prefix, prefixSize );
+        return state->keyed = true;
     }
 
-    memcpy( aesBuf, buf, *bufSize );
-    memset( aesBuf + *bufSize, (int)(aesSize - *bufSize), aesSize - *bufSize );
+    savedhi_hmac_sha256_context *context = (savedhi_hmac_sha256_context *)state->context;
+#if savedhi_CPERCIVA
+    HMAC_SHA256_Init( context, key, keySize );
+    if (prefix && prefixSize)
+        HMAC_SHA256_Update( context, prefix, prefixSize );
+    state->keyed = true;
+#elif savedhi_SODIUM
+    state->keyed = crypto_auth_hmacsha256_init( context, key, keySize ) == OK &&
+                   (!prefix || !prefixSize || crypto_auth_hmacsha256_update( context, prefix, prefixSize ) == OK);
+#else
+#error No crypto support for savedhi_hash_hmac_sha256_init.
+#endif
 
-    struct AES_ctx aes;
-    AES_init_ctx_iv( &aes, key, iv );
+    return state->keyed;
+}
 
-    if (encrypt)
-        AES_CBC_encrypt_buffer( &aes, aesBuf, aesSize );
-    else
-        AES_CBC_decrypt_buffer( &aes, aesBuf, aesSize );
-//    savedhi_free( &aesBuf, aesSize );
+bool savedhi_hash_hmac_sha256_final(
+        uint8_t mac[static 32], const savedhiHMACState *state, const uint8_t *message, const size_t messageSize) {
+
+    if (!mac || !state || !state->keyed || !message || !messageSize)
+        return false;
+
+    // Finalize a copy so the keyed state can be reused for the next message.
+    if (state->intree) {
+        savedhiSHA256HMAC hmac;
+        memcpy( &hmac, state->context, sizeof( hmac ) );
+        savedhi_sha256_hmac_update( &hmac, message, messageSize );
+        savedhi_sha256_hmac_final( &hmac, mac );
+        return true;
+    }
+
+    savedhi_hmac_sha256_context context;
+    memcpy( &context, state->context, sizeof( context ) );
+#if savedhi_CPERCIVA
+    HMAC_SHA256_Update( &context, message, messageSize );
+    HMAC_SHA256_Final( mac, &context );
+    bool success = true;
+#elif savedhi_SODIUM
+    bool success = crypto_auth_hmacsha256_update( &context, message, messageSize ) == OK &&
+                   crypto_auth_hmacsha256_final( &context, mac ) == OK;
+#else
+#error No crypto support for savedhi_hash_hmac_sha256_final.
+#endif
+    savedhi_zero( &context, sizeof( context ) );
+
+    return success;
+}
+
+bool savedhi_hash_hmac_sha256_midstate(
+        const savedhiHMACState *state, uint32_t inner[static 8], uint32_t outer[static 8], uint8_t buffered[static 64], uint64_t *size) {
+
+    if (!state || !state->keyed || !size)
+        return false;
+
+    if (state->intree) {
+        const savedhiSHA256HMAC *hmac = (const savedhiSHA256HMAC *)state->context;
+        memcpy( inner, hmac->inner.state, sizeof( hmac->inner.state ) );
+        memcpy( outer, hmac->outer.state, sizeof( hmac->outer.state ) );
+        memcpy( buffered, hmac->inner.buffer, sizeof( hmac->inner.buffer ) );
+        *size = hmac->inner.size;
+        return true;
+    }
+
+    // Both backends keep their SHA-256 states as the hash words, the amount of bits absorbed and the buffered bytes.
+    const savedhi_hmac_sha256_context *context = (const savedhi_hmac_sha256_context *)state->context;
+#if savedhi_CPERCIVA || savedhi_SODIUM
+    memcpy( inner, context->ictx.state, sizeof( context->ictx.state ) );
+    memcpy( outer, context->octx.state, sizeof( context->octx.state ) );
+    memcpy( buffered, context->ictx.buf, sizeof( context->ictx.buf ) );
+    *size = context->ictx.count / 8;
+    return true;
+#else
+#error No crypto support for savedhi_hash_hmac_sha256_midstate.
+#endif
+}
+
+/** The IV of savedhi's AES-128-CBC: zero, each stateful result is encrypted with its own key. */
+static const uint8_t savedhi_aes_iv[16] = { 0 };
+
+size_t savedhi_aes_encrypt_size(const size_t plainSize) {
+
+    // PKCS#7 always pads, with a whole block if the plain buffer fills its last block.
+    return (plainSize / 16 + 1) * 16;
+}
+
+bool savedhi_aes_encrypt_into(const savedhiAESKey *aesKey, uint8_t *buffer, size_t *bufferSize) {
+
+    if (!aesKey || !buffer || !bufferSize || !*bufferSize)
+        return false;
+
+    // Add PKCS#7 padding
+    size_t aesSize = savedhi_aes_encrypt_size( *bufferSize );
+    memset( buffer + *bufferSize, (int)(aesSize - *bufferSize), aesSize - *bufferSize );
+
+    savedhi_aes_cbc_encrypt( aesKey, savedhi_aes_iv, buffer, aesSize / 16 );
+    *bufferSize = aesSize;
+    return true;
+}
+
+bool savedhi_aes_decrypt_into(const savedhiAESKey *aesKey, uint8_t *buffer, size_t *bufferSize) {
+
+    if (!aesKey || !buffer || !bufferSize || !*bufferSize || *bufferSize % 16)
+        return false;
+
+    savedhi_aes_cbc_decrypt( aesKey, savedhi_aes_iv, buffer, *bufferSize / 16 );
 
     // Truncate PKCS#7 padding
-    if (encrypt)
-        *bufSize = aesSize;
-    else if (aesBuf[aesSize - 1] <= AES_BLOCKLEN)
-        *bufSize -= aesBuf[aesSize - 1];
-    memset( aesBuf + *bufSize, 0, aesSize - *bufSize );
+    size_t aesSize = *bufferSize;
+    if (buffer[aesSize - 1] <= 16)
+        *bufferSize -= buffer[aesSize - 1];
+    memset( buffer + *bufferSize, 0, aesSize - *bufferSize );
+    return true;
+}
+
+const static uint8_t *savedhi_aes(bool encrypt, const uint8_t *key, const size_t keySize, const uint8_t *buf, size_t *bufSize) {
+
+    if (!key || keySize < 16 || !bufSize || !*bufSize)
+        return NULL;
+
+    // Round up to block size; the plain text gets a pad block if it fits the block size.
+    size_t aesSize = encrypt? savedhi_aes_encrypt_size( *bufSize ): (*bufSize + 15) / 16 * 16;
+    uint8_t *aesBuf = malloc( aesSize );
+    if (!aesBuf)
+        return NULL;
+    memcpy( aesBuf, buf, *bufSize );
+    memset( aesBuf + *bufSize, (int)(aesSize - *bufSize), aesSize - *bufSize );
+
+    savedhiAESKey aesKey;
+    savedhi_aes_key_init( &aesKey, key );
+    size_t resultSize = encrypt? *bufSize: aesSize;
+    bool success = encrypt? savedhi_aes_encrypt_into( &aesKey, aesBuf, &resultSize ): savedhi_aes_decrypt_into( &aesKey, aesBuf, &resultSize );
+    savedhi_zero( &aesKey, sizeof( aesKey ) );
+    if (!success) {
+        savedhi_free( &aesBuf, aesSize );
+        return NULL;
+    }
 
+    *bufSize = encrypt? resultSize: *bufSize > aesSize - resultSize? *bufSize - (aesSize - resultSize): 0;
     return aesBuf;
 }
 
@@ -517,6 +944,76 @@ const char *savedhi_vstr(const char *format, va_list args) {
     return NULL;
 }
 
+static const char savedhi_hex_digits[16] = "0123456789ABCDEF";
+
+/** The value of each hexadecimal character, or 0xFF for characters that are not hexadecimal. */
+static const uint8_t savedhi_hex_values[256] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+#if (defined( __GNUC__ ) || defined( __clang__ )) && defined( __has_builtin ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if __has_builtin( __builtin_convertvector )
+#define savedhi_HEX_VECTOR 1
+#endif
+#endif
+
+#if savedhi_HEX_VECTOR
+typedef uint8_t savedhi_hex_chars __attribute__(( vector_size( 16 ), aligned( 1 ) ));
+typedef uint8_t savedhi_hex_bytes __attribute__(( vector_size( 8 ), aligned( 1 ) ));
+typedef uint16_t savedhi_hex_pairs __attribute__(( vector_size( 16 ), aligned( 1 ) ));
+
+/** Encode 8 bytes as 16 hexadecimal characters; the lanes compile to SSE2 or NEON. */
+static void savedhi_hex_block(const uint8_t *bytes, char *hex) {
+
+    savedhi_hex_bytes block;
+    memcpy( &block, bytes, sizeof( block ) );
+
+    // Widen each byte into a pair of nibbles, the high nibble first in memory.
+    savedhi_hex_pairs pairs = __builtin_convertvector( block, savedhi_hex_pairs );
+    savedhi_hex_chars nibbles = (savedhi_hex_chars)((pairs >> 4) | ((pairs & 0x0F) << 8));
+    savedhi_hex_chars chars = nibbles + '0' + ((savedhi_hex_chars)(nibbles > 9) & ('A' - '9' - 1));
+    memcpy( hex, &chars, sizeof( chars ) );
+}
+
+/** Decode 16 hexadecimal characters into 8 bytes; the lanes compile to SSE2 or NEON.
+  * @return false if any of the characters is not hexadecimal. */
+static bool savedhi_unhex_block(const char *hex, uint8_t *bytes) {
+
+    savedhi_hex_chars chars;
+    memcpy( &chars, hex, sizeof( chars ) );
+
+    savedhi_hex_chars digits = chars - '0', letters = (chars | 0x20) - 'a';
+    savedhi_hex_chars isDigit = (savedhi_hex_chars)(digits < 10), isLetter = (savedhi_hex_chars)(letters < 6);
+    savedhi_hex_chars invalid = ~(isDigit | isLetter);
+
+    uint64_t words[2];
+    memcpy( words, &invalid, sizeof( words ) );
+    if (words[0] | words[1])
+        return false;
+
+    // Narrow each pair of nibbles into a byte, the high nibble first in memory.
+    savedhi_hex_pairs pairs = (savedhi_hex_pairs)((digits & isDigit) | ((letters + 10) & isLetter));
+    savedhi_hex_bytes block = __builtin_convertvector( ((pairs & 0x0F) << 4) | (pairs >> 8), savedhi_hex_bytes );
+    memcpy( bytes, &block, sizeof( block ) );
+    return true;
+}
+#endif
+
 char *savedhi_hex(const uint8_t *buf, const size_t size, char *hex, size_t *hexSize) {
 
     if (!buf || !size)
@@ -524,8 +1021,16 @@ char *savedhi_hex(const uint8_t *buf, const size_t size, char *hex, size_t *hexS
     if (!savedhi_realloc( &hex, hexSize, char, size * 2 + 1 ))
         return NULL;
 
-    for (size_t kH = 0; kH < size; kH++)
-        sprintf( &(hex[kH * 2]), "%.2hhX", buf[kH] );
+    size_t b = 0;
+#if savedhi_HEX_VECTOR
+    for (; size - b >= 8; b += 8)
+        savedhi_hex_block( buf + b, hex + b * 2 );
+#endif
+    for (; b < size; ++b) {
+        hex[b * 2] = savedhi_hex_digits[buf[b] >> 4];
+        hex[b * 2 + 1] = savedhi_hex_digits[buf[b] & 0x0F];
+    }
+    hex[size * 2] = '\0';
 
     return hex;
 }
@@ -549,16 +1054,29 @@ const uint8_t *savedhi_unhex(const char *hex, size_t *size) {
         return NULL;
 
     size_t bufSize = hexLength / 2;
-    if (size)
-        *size = bufSize;
-
     uint8_t *buf = malloc( bufSize );
-    for (size_t b = 0; b < bufSize; ++b)
-        if (sscanf( hex + b * 2, "%02hhX", &buf[b] ) != 1) {
-            savedhi_free( &buf, bufSize );
-            return NULL;
-        }
+    if (!buf)
+        return NULL;
+
+    size_t b = 0;
+    uint8_t invalid = 0;
+#if savedhi_HEX_VECTOR
+    for (; bufSize - b >= 8; b += 8)
+        if (!savedhi_unhex_block( hex + b * 2, buf + b ))
+            invalid = 0xFF;
+#endif
+    for (; b < bufSize; ++b) {
+        uint8_t high = savedhi_hex_values[(uint8_t)hex[b * 2]], low = savedhi_hex_values[(uint8_t)hex[b * 2 + 1]];
+        invalid |= high | low;
+        buf[b] = (uint8_t)(high << 4 | (low & 0x0F));
+    }
+    if (invalid & 0xF0) {
+        savedhi_free( &buf, bufSize );
+        return NULL;
+    }
 
+    if (size)
+        *size = bufSize;
     return buf;
 }
 
@@ -612,12 +1130,87 @@ size_t savedhi_utf8_char_size(const char *utf8String) {
 
 size_t savedhi_utf8_char_count(const char *utf8String) {
 
-    size_t strchars = 0, charlen;
-    for (char *remaining = (char *)utf8String; remaining && *remaining; remaining += charlen, ++strchars)
-        if (!(charlen = savedhi_utf8_char_size( remaining )))
+    return savedhi_utf8_measure( utf8String, NULL );
+}
+
+#if defined( __GNUC__ ) || defined( __clang__ )
+typedef uint8_t savedhi_utf8_bytes __attribute__(( vector_size( 16 ), aligned( 1 ) ));
+typedef int8_t savedhi_utf8_mask __attribute__(( vector_size( 16 ), aligned( 1 ) ));
+
+/** Count the characters of the 16 bytes starting at a character, if each byte is either a lead or a continuation owed
+  * to a lead in the block; the lanes compile to SSE2 or NEON.
+  * @return false if the block needs the character-by-character walk. */
+static bool savedhi_utf8_block(const uint8_t *bytes, size_t *charCount) {
+
+    // The bytes from 1, 2 and 3 positions back, limited to the block's own leads.
+    savedhi_utf8_bytes block, back1, back2, back3;
+    memcpy( &block, bytes, sizeof( block ) );
+    memcpy( &back1, bytes - 1, sizeof( back1 ) );
+    memcpy( &back2, bytes - 2, sizeof( back2 ) );
+    memcpy( &back3, bytes - 3, sizeof( back3 ) );
+    back1 &= (savedhi_utf8_bytes){ 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    back2 &= (savedhi_utf8_bytes){ 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    back3 &= (savedhi_utf8_bytes){ 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+    savedhi_utf8_mask continuation = (savedhi_utf8_mask)((block & 0xC0) == 0x80);
+    savedhi_utf8_mask owed = (savedhi_utf8_mask)((back1 >= 0xC0) | (back2 >= 0xE0) | (back3 >= 0xF0));
+    savedhi_utf8_mask illegal = (savedhi_utf8_mask)((block >= 0xC0) & ((block < 0xC2) | (block > 0xF4)));
+    savedhi_utf8_mask irregular = (continuation ^ owed) | illegal;
+
+    uint64_t words[2];
+    memcpy( words, &irregular, sizeof( words ) );
+    if (words[0] | words[1])
+        return false;
+
+    // Sum the continuation lanes of each word in its top byte.
+    memcpy( words, &continuation, sizeof( words ) );
+    *charCount += sizeof( block ) - (size_t)(((words[0] & 0x0101010101010101ULL) * 0x0101010101010101ULL) >> 56)
+                  - (size_t)(((words[1] & 0x0101010101010101ULL) * 0x0101010101010101ULL) >> 56);
+    return true;
+}
+#endif
+
+size_t savedhi_utf8_measure(const char *utf8String, size_t *byteSize) {
+
+    const uint8_t *bytes = (const uint8_t *)utf8String;
+    const size_t size = utf8String? strlen( utf8String ): 0;
+    if (byteSize)
+        *byteSize = size;
+
+    // Walk the characters by their lead bytes, like savedhi_utf8_char_size.
+    size_t chars = 0;
+    for (size_t b = 0; b < size;) {
+#if defined( __GNUC__ ) || defined( __clang__ )
+        if (b >= 3 && size - b >= 16 && savedhi_utf8_block( bytes + b, &chars )) {
+            // Continue after the last character that started in the block.
+            size_t next = b + 16;
+            for (size_t l = b + 13; l < b + 16; ++l)
+                if (bytes[l] >= 0xC0)
+                    next = max( next, l + (bytes[l] >= 0xF0? 4: bytes[l] >= 0xE0? 3: 2) );
+            b = min( next, size );
+            continue;
+        }
+#endif
+
+        // Legal UTF-8 byte sequences: <http://www.unicode.org/unicode/uni2errata/UTF-8_Corrigendum.html>
+        const uint8_t lead = bytes[b];
+        size_t charSize;
+        if (lead <= 0x7F)
+            charSize = 1;
+        else if (lead >= 0xC2 && lead <= 0xDF)
+            charSize = 2;
+        else if (lead >= 0xE0 && lead <= 0xEF)
+            charSize = 3;
+        else if (lead >= 0xF0 && lead <= 0xF4)
+            charSize = 4;
+        else
             return 0;
 
-    return strchars;
+        b += min( charSize, size - b );
+        ++chars;
+    }
+
+    return chars;
 }
 
 void *savedhi_memdup(const void *src, const size_t len) {
@@ -32,6 +32,8 @@ savedhi_LIBS_END
 ///    (bool) (savedhiLogLevel level, const char *file, int line, const char *function, const char *format, ... args)
 /// 3. savedhi_verbosity determines the severity threshold for log processing; any messages above its threshold are discarded.
 ///    This avoids triggering the log mechanism for events which are not considered interesting at the time.
+///    The macros check the threshold before evaluating their arguments, so costly arguments are only computed for messages that are logged.
+///    savedhi_LOG_MIN_LEVEL sets the least severe level that is compiled in; the macros of less severe levels compile to nothing.
 /// 4. The savedhi_log implementation consumes the log event through savedhi's log sink mechanism.
 ///    The sink mechanism aims to make log messages available to any interested party.
 ///    Only if there are no interested parties registered, log events will be sunk into savedhi_log_sink_file.
@@ -52,6 +54,12 @@ savedhi_LIBS_END
 /// 8. The default sink, savedhi_log_sink_file, consumes log events by writing them to the savedhi_log_sink_file_target FILE.
 ///    A log event's complete message is resolved through its .formatter, prefixed with its severity and terminated by a newline.
 ///    The default savedhi_log_sink_file_target is stderr, yielding a default behaviour that writes log events to the system's standard error.
+/// 9. savedhi_log_sink_ring is a sink that keeps the caller from waiting on savedhi_log_sink_file's I/O.
+///    It merges the log message into a fixed-size slot of a lock-free ring buffer, without allocating, and returns.
+///    The message is still formatted on the calling thread: only the I/O is deferred to the writer thread,
+///    started with savedhi_log_sink_ring_start, which writes the slots out to the savedhi_log_sink_file_target.
+///    A message longer than its slot (255 bytes) is cut off, marked with a trailing ellipsis (U+2026) and counted.
+///    If the ring is full, the event is dropped and counted; the writer reports the number of dropped events with the next message it writes.
 
 typedef savedhi_enum( int, savedhiLogLevel ) {
     /** Logging internal state. */
@@ -90,6 +98,19 @@ typedef bool (savedhiLogSink)(savedhiLogEvent *event);
 extern savedhiLogSink savedhi_log_sink_file;
 extern FILE *savedhi_log_sink_file_target;
 
+/** savedhi_log_sink_ring is a sink that queues log messages for a writer thread, which writes them to the savedhi_log_sink_file_target.
+ * Without a running writer, and for fatal events, it writes to the savedhi_log_sink_file_target directly. */
+extern savedhiLogSink savedhi_log_sink_ring;
+/** Start the savedhi_log_sink_ring writer thread.
+ * @return false if the writer could not be started or this platform has no support for it. */
+bool savedhi_log_sink_ring_start(void);
+/** Stop the savedhi_log_sink_ring writer thread, after it has written all queued log messages. */
+void savedhi_log_sink_ring_stop(void);
+/** @return The amount of log events the savedhi_log_sink_ring dropped so far because its ring was full. */
+size_t savedhi_log_sink_ring_dropped(void);
+/** @return The amount of log messages the savedhi_log_sink_ring cut off so far because they were longer than its slots. */
+size_t savedhi_log_sink_ring_truncated(void);
+
 /** To receive events, sinks need to be registered.  If no sinks are registered, log events are sent to the savedhi_log_sink_file sink. */
 bool savedhi_log_sink_register(savedhiLogSink *sink);
 bool savedhi_log_sink_unregister(savedhiLogSink *sink);
@@ -105,14 +126,38 @@ bool savedhi_elog(savedhiLogEvent *event);
 #define savedhi_LOG savedhi_log
 #endif
 
+/** The least severe level of log events to compile in, eg. -Dsavedhi_LOG_MIN_LEVEL=1 (savedhiLogLevelInfo) omits trc and dbg. */
+#ifndef savedhi_LOG_MIN_LEVEL
+#define savedhi_LOG_MIN_LEVEL 3
+#endif
+
+/** Dispatch a log event, evaluating its arguments only if the level is within savedhi_verbosity. */
+#define savedhi_LOG_LEVEL(level, format, ...) \
+        (savedhi_verbosity >= (level)? savedhi_LOG( level, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ ): false)
+/** Omit a log event, its arguments are checked but never evaluated. */
+#define savedhi_LOG_OMIT(level, format, ...) \
+        ((void)(false && savedhi_LOG( level, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )))
+
 /** Application interface for logging events into the subsystem. */
 #ifndef trc
-#define trc(format, ...) savedhi_LOG( savedhiLogLevelTrace, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )
-#define dbg(format, ...) savedhi_LOG( savedhiLogLevelDebug, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )
-#define inf(format, ...) savedhi_LOG( savedhiLogLevelInfo, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )
-#define wrn(format, ...) savedhi_LOG( savedhiLogLevelWarning, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )
-#define err(format, ...) savedhi_LOG( savedhiLogLevelError, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )
-#define ftl(format, ...) savedhi_LOG( savedhiLogLevelFatal, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__ )
+#if savedhi_LOG_MIN_LEVEL >= 3
+#define trc(format, ...) savedhi_LOG_LEVEL( savedhiLogLevelTrace, format, ##__VA_ARGS__ )
+#else
+#define trc(format, ...) savedhi_LOG_OMIT( savedhiLogLevelTrace, format, ##__VA_ARGS__ )
+#endif
+#if savedhi_LOG_MIN_LEVEL >= 2
+#define dbg(format, ...) savedhi_LOG_LEVEL( savedhiLogLevelDebug, format, ##__VA_ARGS__ )
+#else
+#define dbg(format, ...) savedhi_LOG_OMIT( savedhiLogLevelDebug, format, ##__VA_ARGS__ )
+#endif
+#if savedhi_LOG_MIN_LEVEL >= 1
+#define inf(format, ...) savedhi_LOG_LEVEL( savedhiLogLevelInfo, format, ##__VA_ARGS__ )
+#else
+#define inf(format, ...) savedhi_LOG_OMIT( savedhiLogLevelInfo, format, ##__VA_ARGS__ )
+#endif
+#define wrn(format, ...) savedhi_LOG_LEVEL( savedhiLogLevelWarning, format, ##__VA_ARGS__ )
+#define err(format, ...) savedhi_LOG_LEVEL( savedhiLogLevelError, format, ##__VA_ARGS__ )
+#define ftl(format, ...) savedhi_LOG_LEVEL( savedhiLogLevelFatal, format, ##__VA_ARGS__ )
 #endif
 
 
@@ -191,6 +236,41 @@ bool savedhi_buf_push_uint32(
 bool savedhi_buf_push_str(
         uint8_t **buffer, size_t *bufferSize, const char *pushString);
 
+/** A buffer that is sized once and then filled in place: within its own storage for typical contents, or a single allocation beyond that.
+ * The buffer's bytes may point into the buffer itself; it must not be copied once initialized. */
+typedef struct {
+    /** The buffer's content (size bytes, room for capacity bytes). */
+    uint8_t *bytes;
+    size_t size;
+    size_t capacity;
+    uint8_t storage[512];
+} savedhiBuffer;
+
+/** Prepare a buffer to receive up to capacity bytes.  Only allocates if the capacity exceeds the buffer's own storage.
+ * @return false if the capacity could not be allocated. */
+bool savedhi_buffer_init(
+        savedhiBuffer *buffer, const size_t capacity);
+/** Append a value to a buffer.  Never reallocates.
+ * @param value The object to append to the buffer.
+ *              If char*, copies a C-string from the value.
+ *              If uint32_t, writes the integer using savedhi's endianness (big/network).
+ *              If uint8_t*, takes a size_t argument indicating the amount of uint8_t's to copy from the value.
+ * @return false if the value is missing or empty, or doesn't fit in the buffer's capacity. */
+#define savedhi_buffer_push(buffer, value, ...) _Generic( (value), \
+        uint32_t: savedhi_buffer_push_uint32,                        \
+        uint8_t *: savedhi_buffer_push_buf, const uint8_t *: savedhi_buffer_push_buf, \
+        char *: savedhi_buffer_push_str, const char *: savedhi_buffer_push_str )      \
+        ( buffer, value, ##__VA_ARGS__)
+bool savedhi_buffer_push_buf(
+        savedhiBuffer *buffer, const uint8_t *pushBuffer, const size_t pushSize);
+bool savedhi_buffer_push_uint32(
+        savedhiBuffer *buffer, const uint32_t pushInt);
+bool savedhi_buffer_push_str(
+        savedhiBuffer *buffer, const char *pushString);
+/** Wipe a buffer's content and release its allocation, if any. */
+void savedhi_buffer_free(
+        savedhiBuffer *buffer);
+
 /** Push a C-string onto another string.  reallocs the target string and appends the source string.
  * @param string A pointer to the string (allocated) to append to, may be NULL. */
 bool savedhi_string_push(
@@ -210,6 +290,17 @@ bool savedhi_string_pushf(
 #define savedhi_realloc(\
         /* const void** */buffer, /* size_t* */bufferSize, type, /* const size_t */typeCount) \
         ({ type **_buffer = buffer; __savedhi_realloc( (void **)_buffer, bufferSize, sizeof( type ) * (typeCount) ); })
+/** Make room in the given buffer for at least the given amount of objects of the given type, doubling its capacity as needed.
+ * On success, the capacity pointer will be updated to the amount of objects the buffer has room for and the buffer pointer may be updated to a new memory address.
+ * On failure, the pointers will remain unaffected.
+ * @param buffer A pointer to the buffer (allocated, capacity objects) to reallocate.
+ * @param capacity A pointer to the amount of objects the buffer currently has room for.
+ * @param typeCount The amount of objects the buffer should have room for.
+ * @return true if successful, false if reallocation failed.
+ */
+#define savedhi_reserve(\
+        /* const void** */buffer, /* size_t* */capacity, type, /* const size_t */typeCount) \
+        ({ type **_buffer = buffer; __savedhi_reserve( (void **)_buffer, capacity, sizeof( type ), typeCount ); })
 /** Free a buffer after zero'ing its contents, then set the reference to NULL.
  * @param bufferSize The byte-size of the buffer, these bytes will be zeroed prior to deallocation. */
 #define savedhi_free(\
@@ -232,6 +323,9 @@ bool savedhi_string_pushf(
 #undef savedhi_realloc
 #define savedhi_realloc(buffer, bufferSize, targetSize) \
         __savedhi_realloc( (void **)buffer, bufferSize, targetSize )
+#undef savedhi_reserve
+#define savedhi_reserve(buffer, capacity, type, typeCount) \
+        __savedhi_reserve( (void **)buffer, capacity, sizeof( type ), typeCount )
 #undef savedhi_free
 #define savedhi_free(buffer, bufferSize) \
         __savedhi_free( (void **)buffer, bufferSize )
@@ -244,6 +338,8 @@ bool savedhi_string_pushf(
 #endif
 bool __savedhi_realloc(
         void **buffer, size_t *bufferSize, const size_t targetSize);
+bool __savedhi_reserve(
+        void **buffer, size_t *capacity, const size_t typeSize, const size_t typeCount);
 bool __savedhi_free(
         void **buffer, size_t bufferSize);
 bool __savedhi_free_string(
@@ -270,6 +366,22 @@ bool savedhi_kdf_blake2b(
  * @return A buffer (allocated, 32-byte) containing the MAC or NULL if the key or message is missing, the MAC could not be allocated or generated. */
 bool savedhi_hash_hmac_sha256(
         uint8_t mac[static 32], const uint8_t *key, const size_t keySize, const uint8_t *message, const size_t messageSize);
+/** Key an HMAC-SHA-256 state with the given key and absorb the given message prefix, if any.
+ * @return false if the key is missing or the state could not be keyed. */
+bool savedhi_hash_hmac_sha256_init(
+        savedhiHMACState *state, const uint8_t *key, const size_t keySize, const uint8_t *prefix, const size_t prefixSize);
+/** Calculate the MAC for the given message using a keyed HMAC-SHA-256 state, leaving the state itself untouched for reuse.
+ * @return false if the state is not keyed, the message is missing or the MAC could not be generated. */
+bool savedhi_hash_hmac_sha256_final(
+        uint8_t mac[static 32], const savedhiHMACState *state, const uint8_t *message, const size_t messageSize);
+/** Read out the hashes of a keyed HMAC-SHA-256 state, to continue its messages with another SHA-256 implementation.
+ * @param inner Receives the inner hash, after its key pad and the whole blocks of the absorbed prefix.
+ * @param outer Receives the outer hash, after its key pad.
+ * @param buffered Receives the tail of the absorbed prefix that doesn't fill a whole block.
+ * @param size Receives the amount of bytes the inner hash absorbed, including its key pad and the buffered tail.
+ * @return false if the state is not keyed. */
+bool savedhi_hash_hmac_sha256_midstate(
+        const savedhiHMACState *state, uint32_t inner[static 8], uint32_t outer[static 8], uint8_t buffered[static 64], uint64_t *size);
 /** Encrypt a plainBuffer with the given key using AES-128-CBC.
  * @param bufferSize A pointer to the size of the plain buffer on input, and the size of the returned cipher buffer on output.
  * @return A buffer (allocated, bufferSize) containing the cipherBuffer or NULL if the key or buffer is missing, the key size is out of bounds or the result could not be allocated. */
@@ -280,6 +392,19 @@ const uint8_t *savedhi_aes_encrypt(
  * @return A buffer (allocated, bufferSize) containing the plainBuffer or NULL if the key or buffer is missing, the key size is out of bounds or the result could not be allocated. */
 const uint8_t *savedhi_aes_decrypt(
         const uint8_t *key, const size_t keySize, const uint8_t *cipherBuffer, size_t *bufferSize);
+/** @return The size of the cipher buffer that AES-128-CBC encryption with PKCS#7 padding makes of a plain buffer of plainSize bytes. */
+size_t savedhi_aes_encrypt_size(const size_t plainSize);
+/** Encrypt a buffer in place with the expanded key using AES-128-CBC.
+ * @param buffer The plain buffer, with room for savedhi_aes_encrypt_size( *bufferSize ) bytes.
+ * @param bufferSize A pointer to the size of the plain buffer on input, and the size of the cipher buffer on output.
+ * @return false if the key or buffer is missing. */
+bool savedhi_aes_encrypt_into(
+        const savedhiAESKey *aesKey, uint8_t *buffer, size_t *bufferSize);
+/** Decrypt a buffer in place with the expanded key using AES-128-CBC.
+ * @param bufferSize A pointer to the size of the cipher buffer on input, and the size of the plain buffer on output.
+ * @return false if the key or buffer is missing or the buffer is not made of whole blocks. */
+bool savedhi_aes_decrypt_into(
+        const savedhiAESKey *aesKey, uint8_t *buffer, size_t *bufferSize);
 #if UNUSED
 /** Calculate an OTP using RFC-4226.
  * @return A C-string (allocated) containing exactly `digits` decimal OTP digits. */
@@ -300,7 +425,7 @@ const char *savedhi_vstr(const char *format, va_list args);
 char *savedhi_hex(const uint8_t *buf, const size_t size, char *hex, size_t *hexSize);
 const char *savedhi_hex_l(const uint32_t number, char hex[static 9]);
 /** Decode a C-string of hexadecimal characters into a buffer of size-bytes.
- * @return A buffer (allocated, *size); or NULL if hex is NULL, empty, or not an even-length hexadecimal string. */
+ * @return A buffer (allocated, *size); or NULL if hex is NULL, empty, or not an even-length hexadecimal string, leaving *size untouched. */
 const uint8_t *savedhi_unhex(const char *hex, size_t *size);
 
 /** @return The amount of bytes needed to decode b64Length amount of base-64 characters. */
@@ -321,6 +446,10 @@ size_t savedhi_base64_encode(const uint8_t *byteBuf, size_t byteSize, char *b64T
 size_t savedhi_utf8_char_size(const char *utf8String);
 /** @return The amount of UTF-8 characters in the given string or 0 if it is NULL, empty, or contains bytes that are not legal in UTF-8. */
 size_t savedhi_utf8_char_count(const char *utf8String);
+/** Measure the bytes and UTF-8 characters of the given string in a single pass.
+  * @param byteSize If not NULL, receives the amount of bytes in the string, excluding the terminating NUL.
+  * @return The amount of UTF-8 characters in the given string or 0 if it is NULL, empty, or contains bytes that are not legal in UTF-8. */
+size_t savedhi_utf8_measure(const char *utf8String, size_t *byteSize);
 
 
 //// Compatibility.
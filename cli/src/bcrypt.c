@@ -41,7 +41,7 @@
 
 #include "blf.h"
 #include "blowfish.c"
-#include "spectre-util.h"
+#include "savedhi-util.h"
 
 /* This implementation is adaptable to current computing power.
  * You can have up to 2^31 rounds which should be enough for some
@@ -191,10 +191,10 @@ bcrypt_hashpass(const char *key, const uint8_t *salt, char *encrypted,
     snprintf( encrypted, 8, "$2%c$%2.2u$", minor, logr );
     encode_base64( encrypted + 7, csalt, BCRYPT_MAXSALT );
     encode_base64( encrypted + 7 + 22, ciphertext, 4 * BCRYPT_WORDS - 1 );
-    spectre_zero( &state, sizeof( state ) );
-    spectre_zero( ciphertext, sizeof( ciphertext ) );
-    spectre_zero( csalt, sizeof( csalt ) );
-    spectre_zero( cdata, sizeof( cdata ) );
+    savedhi_zero( &state, sizeof( state ) );
+    savedhi_zero( ciphertext, sizeof( ciphertext ) );
+    savedhi_zero( csalt, sizeof( csalt ) );
+    savedhi_zero( cdata, sizeof( cdata ) );
     return 0;
 
     inval:
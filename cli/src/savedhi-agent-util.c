@@ -0,0 +1,198 @@
+//==============================================================================
+// This file is part of savedhi.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// savedhi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// savedhi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "savedhi-agent-util.h"
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "savedhi-util.h"
+
+#define savedhi_agent_field_null 0xffffffffU
+#if !defined( MSG_NOSIGNAL )
+#define MSG_NOSIGNAL 0
+#endif
+
+int savedhi_agent_connect(const char *socketPath) {
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (!socketPath || strlen( socketPath ) >= sizeof( address.sun_path )) {
+        errno = EINVAL;
+        return ERR;
+    }
+    strcpy( address.sun_path, socketPath );
+
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if (fd == ERR)
+        return ERR;
+#if defined( SO_NOSIGPIPE )
+    // Without MSG_NOSIGNAL, a write to an agent that went away must fail with EPIPE rather than raise SIGPIPE.
+    setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof( int ) );
+#endif
+    if (connect( fd, (struct sockaddr *)&address, sizeof( address ) ) != OK) {
+        int error = errno;
+        close( fd );
+        errno = error;
+        return ERR;
+    }
+
+    return fd;
+}
+
+static bool savedhi_agent_write(int fd, const uint8_t *buffer, size_t bufferSize) {
+
+    while (bufferSize) {
+        // The peer may close the connection at any time, don't let that raise SIGPIPE in the caller.
+        ssize_t written = send( fd, buffer, bufferSize, MSG_NOSIGNAL );
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+
+        buffer += written;
+        bufferSize -= (size_t)written;
+    }
+
+    return true;
+}
+
+static bool savedhi_agent_read(int fd, uint8_t *buffer, size_t bufferSize, const int timeout) {
+
+    while (bufferSize) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll( &pfd, 1, timeout );
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            return false;
+
+        ssize_t readSize = read( fd, buffer, bufferSize );
+        if (readSize < 0 && errno == EINTR)
+            continue;
+        if (readSize <= 0)
+            return false;
+
+        buffer += readSize;
+        bufferSize -= (size_t)readSize;
+    }
+
+    return true;
+}
+
+bool savedhi_agent_send(int fd, const char *const fields[], const size_t fieldsCount) {
+
+    if (fieldsCount > savedhi_agent_fields_max)
+        return false;
+
+    uint8_t number[4];
+    savedhi_uint32( (uint32_t)fieldsCount, number );
+    if (!savedhi_agent_write( fd, number, sizeof( number ) ))
+        return false;
+
+    for (size_t f = 0; f < fieldsCount; ++f) {
+        size_t fieldSize = fields[f]? strlen( fields[f] ): 0;
+        if (fieldSize > savedhi_agent_field_max)
+            return false;
+
+        savedhi_uint32( fields[f]? (uint32_t)fieldSize: savedhi_agent_field_null, number );
+        if (!savedhi_agent_write( fd, number, sizeof( number ) ) ||
+            !savedhi_agent_write( fd, (const uint8_t *)fields[f], fieldSize ))
+            return false;
+    }
+
+    return true;
+}
+
+static uint32_t savedhi_agent_number(const uint8_t number[4]) {
+
+    return (uint32_t)number[0] << 24 | (uint32_t)number[1] << 16 | (uint32_t)number[2] << 8 | (uint32_t)number[3];
+}
+
+const char **savedhi_agent_receive(int fd, size_t *fieldsCount, const int timeout) {
+
+    uint8_t number[4];
+    if (!fieldsCount || !savedhi_agent_read( fd, number, sizeof( number ), timeout ))
+        return NULL;
+
+    *fieldsCount = savedhi_agent_number( number );
+    if (*fieldsCount > savedhi_agent_fields_max)
+        return NULL;
+
+    char **fields = calloc( *fieldsCount? *fieldsCount: 1, sizeof( *fields ) );
+    if (!fields)
+        return NULL;
+
+    for (size_t f = 0; f < *fieldsCount; ++f) {
+        const bool sized = savedhi_agent_read( fd, number, sizeof( number ), timeout );
+        const uint32_t fieldSize = savedhi_agent_number( number );
+        if (sized && fieldSize == savedhi_agent_field_null)
+            continue;
+        if (!sized || fieldSize > savedhi_agent_field_max || !(fields[f] = calloc( fieldSize + 1, sizeof( char ) )) ||
+            !savedhi_agent_read( fd, (uint8_t *)fields[f], fieldSize, timeout ) || strlen( fields[f] ) != fieldSize) {
+            savedhi_agent_fields_free( (const char ***)&fields, *fieldsCount );
+            return NULL;
+        }
+    }
+
+    return (const char **)fields;
+}
+
+void savedhi_agent_fields_free(const char ***fields, const size_t fieldsCount) {
+
+    if (!fields || !*fields)
+        return;
+
+    for (size_t f = 0; f < fieldsCount; ++f)
+        savedhi_free_string( &(*fields)[f] );
+    free( *fields );
+    *fields = NULL;
+}
+
+const char *savedhi_agent_request(int fd, const char *const request[], const size_t requestCount) {
+
+    if (!savedhi_agent_send( fd, request, requestCount )) {
+        if (errno == EPIPE)
+            wrn( "Agent closed the connection." );
+        else
+            wrn( "Couldn't send agent request: %s", strerror( errno ) );
+        return NULL;
+    }
+
+    size_t answerCount = 0;
+    const char **answer = savedhi_agent_receive( fd, &answerCount, -1 );
+    if (!answer) {
+        wrn( "Couldn't receive agent answer: %s", strerror( errno ) );
+        return NULL;
+    }
+
+    const char *value = NULL;
+    if (answerCount >= 1 && answer[0] && strcmp( answer[0], "ok" ) == OK)
+        value = answerCount >= 2 && answer[1]? savedhi_strdup( answer[1] ): savedhi_strdup( "" );
+    else
+        dbg( "Agent refused %s: %s", request[0], answerCount >= 2 && answer[1]? answer[1]: "?" );
+    savedhi_agent_fields_free( &answer, answerCount );
+
+    return value;
+}
@@ -0,0 +1,63 @@
+//==============================================================================
+// This file is part of savedhi.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// savedhi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// savedhi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/** The agent holds unlocked user keys and derives site results with them for its clients, over a Unix-domain socket.
+ *
+ * A message is a count of fields followed by each field, every number a 32-bit big-endian integer:
+ *     count, { size, bytes[size] } * count
+ * A field of size 0xffffffff is missing (NULL).  A request's first field names it, its other fields are its parameters:
+ *     add <userName> <userSecret> [ttl]    -> ok <identicon>      Unlock a user's keys, for ttl seconds or the agent's default.
+ *     has <userName>                       -> ok <identicon>      Check whether the agent holds a user's keys.
+ *     key-id <userName> <algorithm>        -> ok <keyID>          Identify a user's key.
+ *     result <userName> <algorithm> <siteName> <resultType> <resultParam> <keyCounter> <keyPurpose> <keyContext>
+ *                                          -> ok <result>         Derive a site result.
+ *     state <...as result...>              -> ok <state>          Derive a site state.
+ *     remove [userName]                    -> ok                  Forget a user's keys, or the keys of all users.
+ * A request that fails is answered with: error <message>
+ */
+
+#define savedhi_ENV_agent        "savedhi_AGENT_SOCK"
+
+/** The most fields in a message. */
+#define savedhi_agent_fields_max 16
+/** The largest field in a message. */
+#define savedhi_agent_field_max  (64 * 1024)
+
+/** Connect to the agent listening on the socket at the given path.
+  * @return A file descriptor for the connection or -1 if the agent couldn't be reached (errno is set). */
+int savedhi_agent_connect(const char *socketPath);
+
+/** Send a message of fieldsCount fields, any of which may be NULL.
+  * @return false if the message couldn't be sent in full (errno is EPIPE if the peer closed the connection). */
+bool savedhi_agent_send(int fd, const char *const fields[], const size_t fieldsCount);
+
+/** Receive a message.
+  * @param timeout The most milliseconds to wait for each part of the message, or -1 to wait indefinitely.
+  * @return A newly allocated array of fieldsCount newly allocated fields (any of which may be NULL);
+  *         or NULL if the connection was closed, timed out or the message was malformed. */
+const char **savedhi_agent_receive(int fd, size_t *fieldsCount, const int timeout);
+
+/** Wipe and free the fields of a received message. */
+void savedhi_agent_fields_free(const char ***fields, const size_t fieldsCount);
+
+/** Send a request to the agent and receive its answer.
+  * @return A newly allocated copy of the answer's value; or NULL if the agent couldn't be reached or refused the request. */
+const char *savedhi_agent_request(int fd, const char *const request[], const size_t requestCount);
@@ -0,0 +1,584 @@
+//==============================================================================
+// This file is part of savedhi.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// savedhi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// savedhi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sysexits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if defined( __linux__ )
+#include <sys/prctl.h>
+#endif
+
+#include "savedhi-agent-util.h"
+#include "savedhi-cli-util.h"
+#include "savedhi-algorithm.h"
+#include "savedhi-scrypt.h"
+#include "savedhi-util.h"
+
+/** The most users whose keys the agent holds at once. */
+#define savedhi_agent_users_max  16
+/** The most milliseconds the agent waits for each part of a client's request. */
+#define savedhi_agent_timeout    1000
+
+/** Output the program's usage documentation. */
+static void usage() {
+
+    inf( ""
+         "  savedhi v%s - agent\n"
+         "--------------------------------------------------------------------------------\n"
+         "      https://savedhi.app\n", stringify_def( savedhi_VERSION ) );
+    inf( ""
+         "\nUSAGE\n\n"
+         "  savedhi-agent [-a socket] [-t ttl] [-d] [-v|-q]* [-h]\n" );
+    inf( ""
+         "  -a socket    Listen on the Unix-domain socket at the given path.\n"
+         "               Defaults to a new private directory in the temporary directory.\n" );
+    inf( ""
+         "  -t ttl       Forget a user's keys this many seconds after they were added.\n"
+         "               0 keeps them until the agent exits.  Defaults to 3600.\n" );
+    inf( ""
+         "  -d           Stay in the foreground and log to standard error.\n" );
+    inf( ""
+         "  -v           Increase output verbosity (can be repeated).\n"
+         "  -q           Decrease output verbosity (can be repeated).\n" );
+    inf( ""
+         "\nThe agent holds the keys of the users unlocked through it in locked memory, and derives\n"
+         "site results with them for savedhi.  The keys themselves never leave the agent.\n"
+         "Point savedhi at the agent by evaluating the agent's output in your shell:\n"
+         "  eval \"$(savedhi-agent)\"\n" );
+    inf( ""
+         "\nENVIRONMENT\n\n"
+         "  %-12s The socket savedhi uses to reach the agent.\n", savedhi_ENV_agent );
+    exit( EX_OK );
+}
+
+// Internal state.
+
+typedef struct {
+    const char *userName;
+    savedhiIdenticon identicon;
+    /** When the user's keys are forgotten, or 0 if they aren't. */
+    time_t expires;
+    /** The user's key for each algorithm, in locked memory. */
+    savedhiUserKey *keys;
+} AgentUser;
+
+static AgentUser agent_users[savedhi_agent_users_max];
+/** How many of agent_users have key memory, as the memory lock limit allows. */
+static size_t agent_usersCount = 0;
+static savedhiUserKey *agent_keys = NULL;
+static size_t agent_keysSize = 0;
+static time_t agent_ttl = 3600;
+static const char *agent_socketPath = NULL, *agent_socketDir = NULL;
+static volatile sig_atomic_t agent_done = 0;
+
+// Processing steps.
+
+static void agent_args(const int argc, char *const argv[], bool *foreground);
+static bool agent_keys_lock(void);
+static int agent_listen(void);
+static void agent_serve(int listener);
+static void agent_free(void);
+
+/** ========================================================================
+ *  MAIN                                                                     */
+int main(const int argc, char *const argv[]) {
+
+    bool foreground = false;
+    agent_args( argc, argv, &foreground );
+
+    // Keep the keys out of core dumps and away from debuggers.
+    setrlimit( RLIMIT_CORE, &(struct rlimit){ .rlim_cur = 0, .rlim_max = 0 } );
+#if defined( __linux__ )
+    prctl( PR_SET_DUMPABLE, 0, 0, 0, 0 );
+#endif
+
+    int listener = agent_listen();
+    if (listener == ERR) {
+        agent_free();
+        return EX_OSERR;
+    }
+
+    if (!foreground) {
+        // Memory locks aren't inherited across fork: the agent locks its keys' memory itself, then reports back whether it could.
+        int locked[2];
+        pid_t pid = pipe( locked ) == OK? fork(): ERR;
+        if (pid == ERR) {
+            ftl( "Couldn't fork agent: %s", strerror( errno ) );
+            agent_free();
+            return EX_OSERR;
+        }
+        if (pid) {
+            char lockedStatus = 0;
+            close( locked[1] );
+            if (read( locked[0], &lockedStatus, sizeof( lockedStatus ) ) != sizeof( lockedStatus ) || !lockedStatus) {
+                err( "Agent couldn't lock its key memory." );
+                agent_free();
+                return EX_OSERR;
+            }
+            fprintf( stdout, "%s=%s; export %s;\necho Agent pid %ld;\n",
+                    savedhi_ENV_agent, agent_socketPath, savedhi_ENV_agent, (long)pid );
+            return EX_OK;
+        }
+
+        setsid();
+        close( locked[0] );
+        const char lockedStatus = agent_keys_lock();
+        if (write( locked[1], &lockedStatus, sizeof( lockedStatus ) ) != sizeof( lockedStatus ) || !lockedStatus) {
+            close( listener );
+            agent_free();
+            return EX_OSERR;
+        }
+        close( locked[1] );
+
+        if (chdir( "/" ) != OK)
+            wrn( "Couldn't leave working directory: %s", strerror( errno ) );
+        int null = open( "/dev/null", O_RDWR );
+        if (null != ERR) {
+            dup2( null, STDIN_FILENO );
+            dup2( null, STDOUT_FILENO );
+            dup2( null, STDERR_FILENO );
+            if (null > STDERR_FILENO)
+                close( null );
+        }
+    }
+    else {
+        if (!agent_keys_lock()) {
+            close( listener );
+            agent_free();
+            return EX_OSERR;
+        }
+        fprintf( stdout, "%s=%s; export %s;\necho Agent pid %ld;\n",
+                savedhi_ENV_agent, agent_socketPath, savedhi_ENV_agent, (long)getpid() );
+    }
+    fflush( stdout );
+
+    // Keep log output off the request path, now that any fork is behind us.
+    if (savedhi_log_sink_ring_start())
+        savedhi_log_sink_register( &savedhi_log_sink_ring );
+
+    agent_serve( listener );
+
+    close( listener );
+    agent_free();
+    savedhi_log_sink_ring_stop();
+    return EX_OK;
+}
+
+static void agent_args(const int argc, char *const argv[], bool *foreground) {
+
+    for (int opt; (opt = getopt( argc, argv, "a:t:dvqh" )) != EOF;)
+        switch (opt) {
+            case 'a':
+                savedhi_free_string( &agent_socketPath );
+                agent_socketPath = optarg && strlen( optarg )? savedhi_strdup( optarg ): NULL;
+                break;
+            case 't': {
+                char *ttlEnd = NULL;
+                long long ttl = strtoll( optarg, &ttlEnd, 10 );
+                if (!ttlEnd || *ttlEnd || ttl < 0) {
+                    ftl( "Invalid ttl: %s", optarg );
+                    exit( EX_USAGE );
+                }
+                agent_ttl = (time_t)ttl;
+                break;
+            }
+            case 'd':
+                *foreground = true;
+                break;
+            case 'v':
+                ++savedhi_verbosity;
+                break;
+            case 'q':
+                --savedhi_verbosity;
+                break;
+            case 'h':
+                usage();
+                break;
+            case '?':
+                ftl( "Unknown option: -%c", optopt );
+                exit( EX_USAGE );
+            default:
+                ftl( "Unexpected option: %c", opt );
+                exit( EX_USAGE );
+        }
+}
+
+static bool agent_keys_lock() {
+
+    // Hold as many users as the memory lock limit (often only 64 KiB) leaves room for.
+    const size_t userKeysSize = (savedhiAlgorithmLast + 1) * sizeof( *agent_keys );
+    agent_usersCount = savedhi_agent_users_max;
+    struct rlimit memlock;
+    if (getrlimit( RLIMIT_MEMLOCK, &memlock ) == OK && memlock.rlim_cur != RLIM_INFINITY) {
+        const size_t pageSize = (size_t)sysconf( _SC_PAGESIZE );
+        const size_t lockable = (size_t)min( memlock.rlim_cur, (rlim_t)SIZE_MAX ) / pageSize * pageSize;
+        agent_usersCount = min( agent_usersCount, lockable / userKeysSize );
+        if (!agent_usersCount) {
+            err( "Memory lock limit of %zu bytes is too small to hold a user's keys (%zu bytes), raise it with: ulimit -l",
+                    (size_t)memlock.rlim_cur, userKeysSize );
+            return false;
+        }
+        if (agent_usersCount < savedhi_agent_users_max)
+            inf( "Memory lock limit of %zu bytes holds the keys of up to %zu users.",
+                    (size_t)memlock.rlim_cur, agent_usersCount );
+    }
+
+    // Keep all keys in one region of memory that isn't swapped out or dumped.
+    agent_keysSize = agent_usersCount * userKeysSize;
+    void *keys = mmap( NULL, agent_keysSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if (keys == MAP_FAILED) {
+        ftl( "Couldn't allocate key memory: %s", strerror( errno ) );
+        agent_usersCount = 0;
+        return false;
+    }
+    agent_keys = keys;
+    for (size_t u = 0; u < agent_usersCount; ++u)
+        agent_users[u] = (AgentUser){ .keys = agent_keys + u * (savedhiAlgorithmLast + 1) };
+
+#ifdef MADV_DONTDUMP
+    if (madvise( keys, agent_keysSize, MADV_DONTDUMP ) != OK)
+        wrn( "Couldn't keep key memory out of core dumps: %s", strerror( errno ) );
+#endif
+    if (mlock( keys, agent_keysSize ) != OK) {
+        err( "Couldn't lock key memory, keys could be swapped out: %s", strerror( errno ) );
+        return false;
+    }
+
+    return true;
+}
+
+static void agent_done_signal(int signal) {
+
+    agent_done = 1;
+}
+
+static int agent_listen() {
+
+    if (!agent_socketPath) {
+        const char *tmpDir = getenv( "TMPDIR" );
+        char *socketDir = (char *)savedhi_str( "%s/savedhi-XXXXXX", tmpDir && strlen( tmpDir )? tmpDir: "/tmp" );
+        if (!socketDir || !mkdtemp( socketDir )) {
+            ftl( "Couldn't create socket directory: %s", strerror( errno ) );
+            savedhi_free_string( &socketDir );
+            return ERR;
+        }
+        agent_socketDir = socketDir;
+        agent_socketPath = savedhi_str( "%s/agent.%ld", agent_socketDir, (long)getpid() );
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (!agent_socketPath || strlen( agent_socketPath ) >= sizeof( address.sun_path )) {
+        ftl( "Invalid socket path: %s", agent_socketPath );
+        return ERR;
+    }
+    strcpy( address.sun_path, agent_socketPath );
+
+    int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    mode_t mask = umask( 0177 );
+    bool bound = listener != ERR && bind( listener, (struct sockaddr *)&address, sizeof( address ) ) == OK;
+    umask( mask );
+    if (!bound || listen( listener, 16 ) != OK) {
+        ftl( "Couldn't listen on socket:\n  %s: %s", agent_socketPath, strerror( errno ) );
+        if (listener != ERR)
+            close( listener );
+        return ERR;
+    }
+
+    struct sigaction action = { .sa_handler = agent_done_signal };
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+    sigaction( SIGHUP, &action, NULL );
+    signal( SIGPIPE, SIG_IGN );
+
+    return listener;
+}
+
+static void agent_forget(AgentUser *user) {
+
+    savedhi_zero( user->keys, (savedhiAlgorithmLast + 1) * sizeof( *user->keys ) );
+    savedhi_free_string( &user->userName );
+    *user = (AgentUser){ .keys = user->keys };
+}
+
+/** Forget the keys of users whose time is up.
+  * @return When the agent next has keys to forget, or 0 if it has none. */
+static time_t agent_expire() {
+
+    time_t now = time( NULL ), next = 0;
+    for (size_t u = 0; u < agent_usersCount; ++u) {
+        AgentUser *user = &agent_users[u];
+        if (!user->userName || !user->expires)
+            continue;
+
+        if (user->expires <= now) {
+            dbg( "Forgetting keys of: %s", user->userName );
+            agent_forget( user );
+        }
+        else if (!next || user->expires < next)
+            next = user->expires;
+    }
+
+    return next;
+}
+
+static AgentUser *agent_user(const char *userName) {
+
+    for (size_t u = 0; userName && u < agent_usersCount; ++u)
+        if (agent_users[u].userName && strcmp( agent_users[u].userName, userName ) == OK)
+            return &agent_users[u];
+
+    return NULL;
+}
+
+static bool agent_algorithm(const char *algorithmString, savedhiAlgorithm *algorithm) {
+
+    char *algorithmEnd = NULL;
+    unsigned long algorithmValue = algorithmString? strtoul( algorithmString, &algorithmEnd, 10 ): ULONG_MAX;
+    if (!algorithmEnd || *algorithmEnd || algorithmValue < savedhiAlgorithmFirst || algorithmValue > savedhiAlgorithmLast)
+        return false;
+
+    *algorithm = (savedhiAlgorithm)algorithmValue;
+    return true;
+}
+
+static bool agent_add(const char *const request[], const size_t requestCount, const char **answer) {
+
+    const char *userName = requestCount > 1? request[1]: NULL, *userSecret = requestCount > 2? request[2]: NULL;
+    if (!userName || !strlen( userName ) || !userSecret || !strlen( userSecret )) {
+        *answer = savedhi_strdup( "Missing user name or personal secret." );
+        return false;
+    }
+
+    time_t ttl = agent_ttl;
+    if (requestCount > 3 && request[3]) {
+        char *ttlEnd = NULL;
+        long long ttlValue = strtoll( request[3], &ttlEnd, 10 );
+        if (!ttlEnd || *ttlEnd || ttlValue < 0) {
+            *answer = savedhi_str( "Invalid ttl: %s", request[3] );
+            return false;
+        }
+        ttl = (time_t)ttlValue;
+    }
+
+    AgentUser *user = agent_user( userName );
+    for (size_t u = 0; !user && u < agent_usersCount; ++u)
+        if (!agent_users[u].userName)
+            user = &agent_users[u];
+    if (!user) {
+        *answer = savedhi_strdup( "The agent holds the keys of too many users." );
+        return false;
+    }
+    agent_forget( user );
+
+    // Derive the user's key for each algorithm, sharing one key stretch between the versions whose salts agree.
+    for (savedhiAlgorithm a = savedhiAlgorithmFirst; a <= savedhiAlgorithmLast; ++a) {
+        // Derive straight into the locked memory, so the keys never pass through the heap.
+        bool shared = false;
+        for (savedhiAlgorithm s = savedhiAlgorithmFirst; !shared && s < a; ++s)
+            shared = savedhi_user_key_share_into( &user->keys[a], &user->keys[s], userName, a );
+        if (!shared && !savedhi_user_key_into( &user->keys[a], userName, userSecret, a )) {
+            agent_forget( user );
+            *answer = savedhi_str( "Couldn't derive user key: %s", strerror( errno ) );
+            savedhi_scrypt_release();
+            return false;
+        }
+    }
+    // Users are added seldom: don't hold on to the memory for mixing their keys in between.
+    savedhi_scrypt_release();
+    user->userName = savedhi_strdup( userName );
+    user->identicon = savedhi_identicon( userName, userSecret );
+    user->expires = ttl? time( NULL ) + ttl: 0;
+    dbg( "Holding keys of: %s", user->userName );
+
+    *answer = savedhi_identicon_encode( user->identicon );
+    return true;
+}
+
+static bool agent_site(const char *const request[], const size_t requestCount, const char **answer) {
+
+    AgentUser *user = requestCount == 9? agent_user( request[1] ): NULL;
+    if (!user) {
+        *answer = savedhi_strdup( "The agent doesn't hold the user's keys." );
+        return false;
+    }
+
+    savedhiAlgorithm algorithm;
+    if (!agent_algorithm( request[2], &algorithm ) || !request[3] || !request[4] || !request[6] || !request[7]) {
+        *answer = savedhi_strdup( "Invalid site parameters." );
+        return false;
+    }
+
+    const savedhiResultType resultType = (savedhiResultType)strtoul( request[4], NULL, 10 );
+    const savedhiCounter keyCounter = (savedhiCounter)strtoul( request[6], NULL, 10 );
+    const savedhiKeyPurpose keyPurpose = (savedhiKeyPurpose)strtoul( request[7], NULL, 10 );
+    if (strcmp( request[0], "state" ) == OK)
+        *answer = savedhi_site_state( &user->keys[algorithm], request[3], resultType, request[5], keyCounter, keyPurpose, request[8] );
+    else
+        *answer = savedhi_site_result( &user->keys[algorithm], request[3], resultType, request[5], keyCounter, keyPurpose, request[8] );
+    if (!*answer) {
+        *answer = savedhi_str( "Couldn't derive site %s.", request[0] );
+        return false;
+    }
+
+    return true;
+}
+
+/** Answer a client's request.
+  * @param answer The value to answer the request with, or the reason why it failed.
+  * @return false if the request failed. */
+static bool agent_answer(const char *const request[], const size_t requestCount, const char **answer) {
+
+    if (!requestCount || !request[0]) {
+        *answer = savedhi_strdup( "Missing request." );
+        return false;
+    }
+
+    if (strcmp( request[0], "add" ) == OK)
+        return agent_add( request, requestCount, answer );
+
+    if (strcmp( request[0], "has" ) == OK) {
+        AgentUser *user = requestCount == 2? agent_user( request[1] ): NULL;
+        if (!user) {
+            *answer = savedhi_strdup( "The agent doesn't hold the user's keys." );
+            return false;
+        }
+
+        *answer = savedhi_identicon_encode( user->identicon );
+        return true;
+    }
+
+    if (strcmp( request[0], "key-id" ) == OK) {
+        AgentUser *user = requestCount == 3? agent_user( request[1] ): NULL;
+        savedhiAlgorithm algorithm;
+        if (!user || !agent_algorithm( request[2], &algorithm )) {
+            *answer = savedhi_strdup( "The agent doesn't hold the user's key." );
+            return false;
+        }
+
+        *answer = savedhi_strdup( savedhi_user_key_id( &user->keys[algorithm] )->hex );
+        return true;
+    }
+
+    if (strcmp( request[0], "result" ) == OK || strcmp( request[0], "state" ) == OK)
+        return agent_site( request, requestCount, answer );
+
+    if (strcmp( request[0], "remove" ) == OK) {
+        for (size_t u = 0; u < savedhi_agent_users_max; ++u)
+            if (agent_users[u].userName && (requestCount < 2 || !request[1] ||
+                                            strcmp( agent_users[u].userName, request[1] ) == OK))
+                agent_forget( &agent_users[u] );
+
+        *answer = NULL;
+        return true;
+    }
+
+    *answer = savedhi_str( "Unknown request: %s", request[0] );
+    return false;
+}
+
+static bool agent_client_trusted(int client) {
+
+#if defined( __linux__ )
+    struct ucred credentials;
+    socklen_t credentialsSize = sizeof( credentials );
+    return getsockopt( client, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsSize ) == OK &&
+           credentials.uid == geteuid();
+#elif defined( __APPLE__ ) || defined( __FreeBSD__ ) || defined( __OpenBSD__ ) || defined( __NetBSD__ )
+    uid_t uid;
+    gid_t gid;
+    return getpeereid( client, &uid, &gid ) == OK && uid == geteuid();
+#else
+    // Only the socket directory's permissions keep other users out.
+    return true;
+#endif
+}
+
+static void agent_serve(int listener) {
+
+    while (!agent_done) {
+        time_t expires = agent_expire(), now = time( NULL );
+        int timeout = !expires? -1: expires - now > INT_MAX / 1000? INT_MAX: (int)(expires - now) * 1000;
+
+        struct pollfd pfd = { .fd = listener, .events = POLLIN };
+        int ready = poll( &pfd, 1, timeout );
+        if (ready < 0 && errno != EINTR) {
+            err( "Couldn't wait for clients: %s", strerror( errno ) );
+            break;
+        }
+        if (ready <= 0)
+            continue;
+
+        int client = accept( listener, NULL, NULL );
+        if (client == ERR)
+            continue;
+        if (!agent_client_trusted( client )) {
+            wrn( "Refusing client of another user." );
+            close( client );
+            continue;
+        }
+
+        size_t requestCount = 0;
+        const char **request;
+        while (!agent_done && (request = savedhi_agent_receive( client, &requestCount, savedhi_agent_timeout ))) {
+            agent_expire();
+
+            const char *answer = NULL;
+            bool answered = agent_answer( request, requestCount, &answer );
+            trc( "%s: %s", request[0], answered? "ok": answer );
+            savedhi_agent_fields_free( &request, requestCount );
+
+            bool sent = savedhi_agent_send( client, (const char *[]){ answered? "ok": "error", answer }, 2 );
+            savedhi_free_string( &answer );
+            if (!sent)
+                break;
+        }
+        close( client );
+    }
+}
+
+static void agent_free() {
+
+    if (agent_keys) {
+        for (size_t u = 0; u < agent_usersCount; ++u)
+            agent_forget( &agent_users[u] );
+        munmap( agent_keys, agent_keysSize );
+        agent_keys = NULL;
+    }
+
+    if (agent_socketPath)
+        unlink( agent_socketPath );
+    if (agent_socketDir)
+        rmdir( agent_socketDir );
+    savedhi_free_strings( &agent_socketPath, &agent_socketDir, NULL );
+}
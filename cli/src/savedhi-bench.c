@@ -30,10 +30,14 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 
 #include "bcrypt.c"
 
+#include "savedhi-aes.h"
 #include "savedhi-algorithm.h"
+#include "savedhi-scrypt.h"
+#include "savedhi-sha256.h"
 #include "savedhi-util.h"
 
 #define savedhi_N                32768
@@ -46,6 +50,15 @@ static void savedhi_time(struct timeval *time) {
         ftl( "Could not get time: %s", strerror( errno ) );
 }
 
+static long savedhi_faults() {
+
+    struct rusage usage;
+    if (getrusage( RUSAGE_SELF, &usage ) != OK)
+        ftl( "Could not get resource usage: %s", strerror( errno ) );
+
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
 static const double savedhi_show_speed(struct timeval startTime, const unsigned int iterations, const char *operation) {
 
     struct timeval endTime;
@@ -62,6 +75,46 @@ static const double savedhi_show_speed(struct timeval startTime, const unsigned
     return speed;
 }
 
+// Chart scrypt's latency against the memory it mixes in, for each time-memory trade-off factor.
+static int savedhi_bench_tmto(const char *userName, const char *userSecret) {
+
+    if (!savedhi_scrypt_intree()) {
+        err( "The scrypt time-memory trade-off needs the in-tree scrypt, not: %s", savedhi_scrypt_name() );
+        return 1;
+    }
+
+    const unsigned int iterations = 4;
+    double scale = 0;
+    uint8_t key[64];
+    fprintf( stdout, "scrypt-%s N=%d r=%d p=%d\n", savedhi_scrypt_kernel_name( savedhi_p ), savedhi_N, savedhi_r, savedhi_p );
+    fprintf( stdout, "   k    memory/lane    latency\n" );
+    for (uint32_t k = 1; k <= 16; ++k) {
+        savedhi_scrypt_release();
+        savedhi_scrypt_tmto_set( k );
+        savedhi_kdf_scrypt( key, sizeof( key ), (uint8_t *)userName, strlen( userName ), (uint8_t *)userSecret, strlen( userSecret ),
+                savedhi_N, savedhi_r, savedhi_p );
+
+        struct timeval startTime, endTime;
+        savedhi_time( &startTime );
+        for (int i = 1; i <= iterations; ++i)
+            savedhi_kdf_scrypt( key, sizeof( key ), (uint8_t *)userName, strlen( userName ), (uint8_t *)userSecret, strlen( userSecret ),
+                    savedhi_N, savedhi_r, savedhi_p );
+        savedhi_time( &endTime );
+
+        const double latency = ((endTime.tv_sec - startTime.tv_sec) * 1000. + (endTime.tv_usec - startTime.tv_usec) / 1000.) / iterations;
+        const double memory = (double)((savedhi_N + k - 1) / k) * 128 * savedhi_r / (1024 * 1024);
+        if (!scale)
+            scale = latency / 20;
+        fprintf( stdout, "  %2u  %10.2f MB  %7.1f ms  ", k, memory, latency );
+        for (int bar = 0; bar < latency / scale; ++bar)
+            fputc( '#', stdout );
+        fputc( '\n', stdout );
+    }
+    savedhi_scrypt_release();
+
+    return 0;
+}
+
 int main(int argc, char *const argv[]) {
 
     const char *userName = "Robert Lee Mitchel";
@@ -75,6 +128,9 @@ int main(int argc, char *const argv[]) {
     unsigned int iterations;
     float percent;
 
+    if (argc > 1 && strcmp( argv[1], "tmto" ) == OK)
+        return savedhi_bench_tmto( userName, userSecret );
+
     // Start HMAC-SHA-256
     // Similar to phase-two of savedhi
     uint8_t *sitePasswordInfo = malloc( 128 );
@@ -90,9 +146,63 @@ int main(int argc, char *const argv[]) {
         savedhi_hash_hmac_sha256( mac, userKey->bytes, sizeof( userKey->bytes ), sitePasswordInfo, 128 );
 
         if (modff( 100.f * i / iterations, &percent ) == 0)
-            fprintf( stderr, "\rhmac-sha-256: iteration %d / %d (%.0f%%)..", i, iterations, percent );
+            fprintf( stderr, "\rhmac-sha-256 %s: iteration %d / %d (%.0f%%)..", savedhi_sha256_name(), i, iterations, percent );
     }
     const double hmacSha256Speed = savedhi_show_speed( startTime, iterations, "hmac-sha-256" );
+
+    // Start HMAC-SHA-256 lanes
+    // Similar to phase-two of savedhi, for a batch of sites
+    const size_t lanes = savedhi_sha256_lanes();
+    const uint8_t *lanesInfo[savedhi_sha256_lanes_max];
+    size_t lanesInfoSize[savedhi_sha256_lanes_max];
+    uint8_t lanesMacs[savedhi_sha256_lanes_max][32];
+    for (size_t l = 0; l < lanes; ++l) {
+        lanesInfo[l] = sitePasswordInfo;
+        lanesInfoSize[l] = 128;
+    }
+    savedhiHMACState lanesState;
+    savedhi_hash_hmac_sha256_init( &lanesState, userKey->bytes, sizeof( userKey->bytes ), NULL, 0 );
+    savedhi_time( &startTime );
+    // Hashes are counted a lane-width at a time: report progress as each percent is crossed, and the speed of the hashes done.
+    unsigned int lanesHashed = 0;
+    while (lanesHashed < iterations) {
+        savedhi_hash_hmac_sha256_lanes( lanesMacs, &lanesState, lanesInfo, lanesInfoSize, lanes );
+        lanesHashed += lanes;
+
+        if (100ULL * lanesHashed / iterations != 100ULL * (lanesHashed - lanes) / iterations)
+            fprintf( stderr, "\rhmac-sha-256 %s: iteration %u / %d (%llu%%)..", savedhi_sha256_lanes_name(),
+                    lanesHashed, iterations, 100ULL * lanesHashed / iterations );
+    }
+    const double hmacSha256LanesSpeed = savedhi_show_speed( startTime, lanesHashed, "hmac-sha-256 lanes" );
+
+    // Start site keys
+    // Phase two of savedhi, without its result encoding; includes the cost of any log arguments
+    const savedhiUserKey *siteUserKey = savedhi_user_key_share( userKey, userName, savedhiAlgorithmV2 );
+    iterations = 1000000;
+    savedhi_time( &startTime );
+    for (int i = 1; i <= iterations; ++i) {
+        savedhiSiteKey siteKey;
+        savedhi_site_key_into( &siteKey, siteUserKey, siteName, keyCounter, keyPurpose, keyContext );
+
+        if (modff( 100.f * i / iterations, &percent ) == 0)
+            fprintf( stderr, "\rsite key v%d: iteration %d / %d (%.0f%%)..", siteUserKey->algorithm, i, iterations, percent );
+    }
+    const double siteKeySpeed = savedhi_show_speed( startTime, iterations, "site key" );
+    free( (void *)siteUserKey );
+
+    // Start AES-128-CBC
+    // Decrypting a stored result, as when loading a user's sites
+    uint8_t aesBuffer[128];
+    memcpy( aesBuffer, sitePasswordInfo, sizeof( aesBuffer ) );
+    savedhi_time( &startTime );
+    for (int i = 1; i <= iterations; ++i) {
+        size_t aesSize = sizeof( aesBuffer );
+        savedhi_aes_decrypt_into( &userKey->aesKey, aesBuffer, &aesSize );
+
+        if (modff( 100.f * i / iterations, &percent ) == 0)
+            fprintf( stderr, "\raes-128-cbc %s: iteration %d / %d (%.0f%%)..", savedhi_aes_name(), i, iterations, percent );
+    }
+    const double aesSpeed = savedhi_show_speed( startTime, iterations, "aes-128-cbc" );
     free( (void *)userKey );
 
     // Start BCrypt
@@ -112,20 +222,24 @@ int main(int argc, char *const argv[]) {
     // Phase one of savedhi
     uint8_t scrypt_rounds = 15;
     iterations = 2/* ~10s on dev machine */ * 2;
+    long startFaults = savedhi_faults();
     savedhi_time( &startTime );
     uint8_t *key = malloc(64);
     for (int i = 1; i <= iterations; ++i) {
         savedhi_kdf_scrypt( key, 64, (uint8_t *)userName, strlen( userName ), (uint8_t *)userSecret, strlen( userSecret ), pow( 2, scrypt_rounds ), 8, 2 );
 
         if (modff( 100.f * i / iterations, &percent ) == 0)
-            fprintf( stderr, "\rscrypt-%d: iteration %d / %d (%.0f%%)..", scrypt_rounds, i, iterations, percent );
+            fprintf( stderr, "\rscrypt-%d %s: iteration %d / %d (%.0f%%)..", scrypt_rounds, savedhi_scrypt_kernel_name( savedhi_p ), i, iterations, percent );
     }
     free( key );
     const double scryptSpeed = savedhi_show_speed( startTime, iterations, "scrypt" );
+    const double scryptFaults = (double)(savedhi_faults() - startFaults) / iterations;
+    fprintf( stdout, "%.1f page faults per scrypt iteration\n", scryptFaults );
 
     // Start savedhi
     // Both phases of savedhi
     iterations = 50; /* tuned to ~10s on dev machine */
+    startFaults = savedhi_faults();
     savedhi_time( &startTime );
     for (int i = 1; i <= iterations; ++i) {
         userKey = savedhi_user_key( userName, userSecret, savedhiAlgorithmCurrent );
@@ -142,15 +256,22 @@ int main(int argc, char *const argv[]) {
             fprintf( stderr, "\rsavedhi: iteration %d / %d (%.0f%%)..", i, iterations, percent );
     }
     const double savedhiSpeed = savedhi_show_speed( startTime, iterations, "savedhi" );
+    const double savedhiFaults = (double)(savedhi_faults() - startFaults) / iterations;
+    fprintf( stdout, "%.1f page faults per savedhi iteration\n", savedhiFaults );
 
     // Summarize.
     fprintf( stdout, "\n== SUMMARY ==\nOn this machine,\n" );
-    fprintf( stdout, " - 1 savedhi      = %13.6f x hmac-sha-256.\n",                hmacSha256Speed / savedhiSpeed  );
+    fprintf( stdout, " - 1 savedhi      = %13.6f x hmac-sha-256 (%s).\n",          hmacSha256Speed / savedhiSpeed, savedhi_sha256_name() );
+    fprintf( stdout, " - 1 hmac-sha-256 = %13.6f x hmac-sha-256 lanes (%s).\n", hmacSha256LanesSpeed / hmacSha256Speed, savedhi_sha256_lanes_name() );
+    fprintf( stdout, " - 1 site key     = %13.6f x hmac-sha-256 (log level %d).\n", hmacSha256Speed / siteKeySpeed, savedhi_LOG_MIN_LEVEL );
+    fprintf( stdout, " - 1 aes-128-cbc  = %13.6f x hmac-sha-256 (%s, 128 bytes).\n", hmacSha256Speed / aesSpeed, savedhi_aes_name() );
     fprintf( stdout, " - 1 savedhi      = %13.6f x bcrypt-%d.\n",                   bcryptSpeed     / savedhiSpeed, bcrypt_rounds );
-    fprintf( stdout, " - 1 savedhi      = %13.6f x scrypt-%d.\n",                   scryptSpeed     / savedhiSpeed, scrypt_rounds );
+    fprintf( stdout, " - 1 savedhi      = %13.6f x scrypt-%d (%s).\n",              scryptSpeed     / savedhiSpeed, scrypt_rounds, savedhi_scrypt_kernel_name( savedhi_p ) );
     fprintf( stdout, " - 1 bcrypt-%-4d  = %13.6f x hmac-sha-256.\n", bcrypt_rounds, hmacSha256Speed / bcryptSpeed   );
     fprintf( stdout, " - 1 bcrypt-%-4d  = %13.6f x scrypt-%d.\n", bcrypt_rounds,    scryptSpeed     / bcryptSpeed,  scrypt_rounds );
     fprintf( stdout, " - 1 scrypt-%-4d  = %13.6f x hmac-sha-256.\n", scrypt_rounds, hmacSha256Speed / scryptSpeed   );
+    fprintf( stdout, " - 1 scrypt-%-4d  = %13.1f page faults.\n", scrypt_rounds,   scryptFaults );
+    fprintf( stdout, " - 1 savedhi      = %13.1f page faults.\n",                  savedhiFaults );
 
     return 0;
 }
@@ -29,6 +29,7 @@
 #define savedhi_ENV_algorithm    "savedhi_ALGORITHM"
 #define savedhi_ENV_format       "savedhi_FORMAT"
 #define savedhi_ENV_askpass      "savedhi_ASKPASS"
+#define savedhi_ENV_threads      "savedhi_THREADS"
 
 /** Read the value of an environment variable.
   * @return A newly allocated string or NULL if the variable doesn't exist. */
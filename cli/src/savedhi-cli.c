@@ -6,10 +6,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sysexits.h>
 
+#include "savedhi-agent-util.h"
 #include "savedhi-cli-util.h"
 #include "savedhi-algorithm.h"
+#include "savedhi-scrypt.h"
+#include "savedhi-sha256.h"
 #include "savedhi-util.h"
 #include "savedhi-marshal.h"
 #include "savedhi-marshal-util.h"
@@ -104,8 +108,14 @@ static void usage() {
          "  %-12s The user name of the user (see -u).\n"
          "  %-12s The default algorithm version (see -a).\n"
          "  %-12s The default file format (see -f).\n"
-         "  %-12s The askpass program to use for prompting the user.\n",
-            savedhi_ENV_userName, savedhi_ENV_algorithm, savedhi_ENV_format, savedhi_ENV_askpass );
+         "  %-12s The askpass program to use for prompting the user.\n"
+         "  %-12s The SHA-256 implementation to use (sha-ni, armv8, portable or backend).\n"
+         "  %-12s The scrypt implementation to use (avx512, avx2, sse2, portable or backend).\n"
+         "  %-12s Keep only every so many scrypt blocks in memory, recomputing the rest (default 1).\n"
+         "  %-12s The socket of a savedhi-agent holding the user's keys (see savedhi-agent -h).\n"
+         "  %-12s Amount of threads to spread the sites over when saving the user's file (default 1).\n",
+            savedhi_ENV_userName, savedhi_ENV_algorithm, savedhi_ENV_format, savedhi_ENV_askpass, savedhi_ENV_sha256,
+            savedhi_ENV_scrypt, savedhi_ENV_scrypt_tmto, savedhi_ENV_agent, savedhi_ENV_threads );
     exit( EX_OK );
 }
 
@@ -124,6 +134,7 @@ typedef struct {
     const char *algorithmVersion;
     const char *fileFormat;
     const char *fileRedacted;
+    const char *threads;
 } Arguments;
 
 typedef struct {
@@ -135,6 +146,8 @@ typedef struct {
     const char *userName;
     const char *userSecret;
     const char *identicon;
+    const char *agentSocket;
+    savedhiIdenticon agentIdenticon;
     const char *siteName;
     savedhiResultType resultType;
     const char *resultState;
@@ -148,6 +161,13 @@ typedef struct {
     savedhiMarshalledUser *user;
     savedhiMarshalledSite *site;
     savedhiMarshalledQuestion *question;
+    /** The user's file is read and parsed in the background while the user is prompted. */
+    pthread_t fileReader;
+    bool fileReading;
+    /** The user's key is stretched in the background as soon as the user's secret is known. */
+    pthread_t keyStretcher;
+    bool keyStretching;
+    const savedhiUserKey *userKey;
 } Operation;
 
 // Processing steps.
@@ -155,9 +175,13 @@ typedef struct {
 void cli_free(Arguments *args, Operation *operation);
 void cli_args(Arguments *args, Operation *operation, const int argc, char *const argv[]);
 void cli_userName(Arguments *args, Operation *operation);
+void cli_agent(Arguments *args, Operation *operation);
 void cli_userSecret(Arguments *args, Operation *operation);
+void cli_userKey(Arguments *args, Operation *operation);
 void cli_siteName(Arguments *args, Operation *operation);
 void cli_fileFormat(Arguments *args, Operation *operation);
+void cli_threads(Arguments *args, Operation *operation);
+void cli_userFile(Arguments *args, Operation *operation);
 void cli_keyCounter(Arguments *args, Operation *operation);
 void cli_keyPurpose(Arguments *args, Operation *operation);
 void cli_keyContext(Arguments *args, Operation *operation);
@@ -183,6 +207,7 @@ int main(const int argc, char *const argv[]) {
             .userName = savedhi_getenv( savedhi_ENV_userName ),
             .algorithmVersion = savedhi_getenv( savedhi_ENV_algorithm ),
             .fileFormat = savedhi_getenv( savedhi_ENV_format ),
+            .threads = savedhi_getenv( savedhi_ENV_threads ),
     };
     Operation operation = {
             .allowPasswordUpdate = false,
@@ -198,9 +223,13 @@ int main(const int argc, char *const argv[]) {
 
     // Determine the operation parameters not sourced from the user's file.
     cli_userName( &args, &operation );
+    cli_fileFormat( &args, &operation );
+    cli_threads( &args, &operation );
+    cli_userFile( &args, &operation );
+    cli_agent( &args, &operation );
     cli_userSecret( &args, &operation );
+    cli_userKey( &args, &operation );
     cli_siteName( &args, &operation );
-    cli_fileFormat( &args, &operation );
     cli_keyPurpose( &args, &operation );
     cli_keyContext( &args, &operation );
 
@@ -225,6 +254,7 @@ int main(const int argc, char *const argv[]) {
         dbg( "identicon        : %s", operation.identicon );
         dbg( "fileFormat       : %s%s", savedhi_format_name( operation.fileFormat ), operation.fileFormatFixed? " (fixed)": "" );
         dbg( "filePath         : %s", operation.filePath );
+        dbg( "agent            : %s", operation.agentSocket );
     }
     if (operation.site) {
         dbg( "siteName         : %s", operation.siteName );
@@ -235,6 +265,8 @@ int main(const int argc, char *const argv[]) {
         dbg( "keyContext       : %s", operation.keyContext );
         dbg( "algorithmVersion : %u", operation.algorithm );
     }
+    dbg( "sha256           : %s", savedhi_sha256_name() );
+    dbg( "scrypt           : %s (tmto %u)", savedhi_scrypt_name(), savedhi_scrypt_tmto() );
     dbg( "-----------------" );
 
     // Finally ready to perform the actual operation.
@@ -247,18 +279,38 @@ int main(const int argc, char *const argv[]) {
     return EX_OK;
 }
 
+static void cli_userFile_join(Operation *operation) {
+
+    if (operation->fileReading) {
+        pthread_join( operation->fileReader, NULL );
+        operation->fileReading = false;
+    }
+}
+
+static void cli_userKey_join(Operation *operation) {
+
+    if (operation->keyStretching) {
+        pthread_join( operation->keyStretcher, NULL );
+        operation->keyStretching = false;
+    }
+}
+
 void cli_free(Arguments *args, Operation *operation) {
 
     if (args) {
         savedhi_free_strings( &args->userName, &args->userSecretFD, &args->userSecret, &args->siteName, NULL );
         savedhi_free_strings( &args->resultType, &args->resultParam, &args->keyCounter, &args->algorithmVersion, NULL );
         savedhi_free_strings( &args->keyPurpose, &args->keyContext, &args->fileFormat, &args->fileRedacted, NULL );
+        savedhi_free_strings( &args->threads, NULL );
     }
 
     if (operation) {
+        cli_userFile_join( operation );
+        cli_userKey_join( operation );
+        savedhi_free( &operation->userKey, sizeof( *operation->userKey ) );
         savedhi_free_strings( &operation->userName, &operation->userSecret, &operation->siteName, NULL );
         savedhi_free_strings( &operation->keyContext, &operation->resultState, &operation->resultParam, NULL );
-        savedhi_free_strings( &operation->identicon, &operation->filePath, NULL );
+        savedhi_free_strings( &operation->identicon, &operation->filePath, &operation->agentSocket, NULL );
         savedhi_marshal_file_free( &operation->file );
         savedhi_marshal_user_free( &operation->user );
         operation->site = NULL;
@@ -371,8 +423,57 @@ void cli_userName(Arguments *args, Operation *operation) {
     }
 }
 
+static const char *cli_agent_request(Operation *operation, const char *const request[], const size_t requestCount) {
+
+    int agent = savedhi_agent_connect( operation->agentSocket );
+    if (agent == ERR) {
+        wrn( "Couldn't reach agent:\n  %s: %s", operation->agentSocket, strerror( errno ) );
+        return NULL;
+    }
+
+    const char *answer = savedhi_agent_request( agent, request, requestCount );
+    close( agent );
+    return answer;
+}
+
+void cli_agent(Arguments *args, Operation *operation) {
+
+    // The agent can't serve a new personal secret or clear-text files, which need the user's key in-process.
+    const char *agentSocket = savedhi_getenv( savedhi_ENV_agent );
+    if (!agentSocket || !strlen( agentSocket ) || operation->allowPasswordUpdate ||
+        (args->fileRedacted && !savedhi_get_bool( args->fileRedacted ))) {
+        savedhi_free_string( &agentSocket );
+        return;
+    }
+    savedhi_free_string( &operation->agentSocket );
+    operation->agentSocket = agentSocket;
+
+    const char *identicon = cli_agent_request( operation, (const char *[]){ "has", operation->userName }, 2 );
+    if (!identicon) {
+        // Unlock the user's keys in the agent.
+        operation->agentSocket = NULL;
+        cli_userSecret( args, operation );
+        operation->agentSocket = agentSocket;
+
+        identicon = cli_agent_request( operation, (const char *[]){ "add", operation->userName, operation->userSecret }, 3 );
+        if (!identicon) {
+            wrn( "Couldn't add user to agent, continuing without it." );
+            savedhi_free_string( &operation->agentSocket );
+            return;
+        }
+        savedhi_free_string( &operation->userSecret );
+    }
+
+    operation->agentIdenticon = savedhi_identicon_encoded( identicon );
+    savedhi_free_string( &identicon );
+}
+
 void cli_userSecret(Arguments *args, Operation *operation) {
 
+    // The agent holds the user's keys.
+    if (operation->agentSocket)
+        return;
+
     savedhi_free_string( &operation->userSecret );
 
     if (args->userSecretFD) {
@@ -396,6 +497,27 @@ void cli_userSecret(Arguments *args, Operation *operation) {
     }
 }
 
+static void *cli_userKey_stretch(void *operation_) {
+
+    Operation *operation = operation_;
+    operation->userKey = savedhi_user_key( operation->userName, operation->userSecret, savedhiAlgorithmCurrent );
+
+    return NULL;
+}
+
+void cli_userKey(Arguments *args, Operation *operation) {
+
+    // Stretch the key for the current algorithm while the user's file is parsed, the key provider adopts it for
+    // any algorithm whose salt agrees.
+    if (!operation->userSecret || operation->userKey || operation->keyStretching)
+        return;
+
+    if (pthread_create( &operation->keyStretcher, NULL, cli_userKey_stretch, operation ) == OK)
+        operation->keyStretching = true;
+    else
+        dbg( "Couldn't stretch user key in the background: %s", strerror( errno ) );
+}
+
 void cli_siteName(Arguments *args, Operation *operation) {
 
     savedhi_free_string( &operation->siteName );
@@ -425,6 +547,21 @@ void cli_fileFormat(Arguments *args, Operation *operation) {
     }
 }
 
+void cli_threads(Arguments *args, Operation *operation) {
+
+    if (!args->threads || !strlen( args->threads ))
+        return;
+
+    char *threadsEnd = NULL;
+    const unsigned long threads = strtoul( args->threads, &threadsEnd, 10 );
+    if (*threadsEnd || !threads || threads > UINT16_MAX) {
+        wrn( "Invalid %s: %s", savedhi_ENV_threads, args->threads );
+        return;
+    }
+
+    savedhi_marshal_threads_set( (unsigned int)threads );
+}
+
 void cli_keyPurpose(Arguments *args, Operation *operation) {
 
     if (!args->keyPurpose)
@@ -463,7 +600,9 @@ static FILE *cli_user_open(const savedhiFormat format, Operation *operation) {
     return userFile;
 }
 
-void cli_user(Arguments *args, Operation *operation) {
+static void *cli_userFile_read(void *operation_) {
+
+    Operation *operation = operation_;
 
     // Find the user's file from parameters.
     FILE *userFile = cli_user_open( operation->fileFormat, operation );
@@ -471,28 +610,60 @@ void cli_user(Arguments *args, Operation *operation) {
         for (savedhiFormat format = savedhiFormatLast; !userFile && format >= savedhiFormatFirst; --format)
             userFile = cli_user_open( format, operation );
 
+    savedhi_marshal_file_free( &operation->file );
     if (!userFile) {
-        // If no user from the user's file, create a new one.
         savedhi_free_string( &operation->filePath );
+        return NULL;
+    }
+
+    // Load the user's file.
+    const char *fileInputData = savedhi_read_file( userFile );
+    if (!fileInputData || ferror( userFile ))
+        wrn( "Error while reading configuration file:\n  %s: %d", operation->filePath, ferror( userFile ) );
+    fclose( userFile );
+
+    // Parse file.
+    operation->file = savedhi_marshal_read( NULL, fileInputData );
+    savedhi_free_string( &fileInputData );
+
+    return NULL;
+}
+
+void cli_userFile(Arguments *args, Operation *operation) {
+
+    // Read and parse the user's file while the user is prompted for their secret.
+    if (pthread_create( &operation->fileReader, NULL, cli_userFile_read, operation ) == OK)
+        operation->fileReading = true;
+    else
+        cli_userFile_read( operation );
+}
+
+void cli_user(Arguments *args, Operation *operation) {
+
+    cli_userFile_join( operation );
+    if (!operation->filePath) {
+        // If no user from the user's file, create a new one.
         savedhi_marshal_file_free( &operation->file );
         savedhi_marshal_user_free( &operation->user );
         operation->file = savedhi_marshal_file( NULL, NULL, NULL );
-        operation->user = savedhi_marshal_user( operation->userName, savedhi_proxy_provider_set_operation( operation ), savedhiAlgorithmCurrent );
+        operation->user = savedhi_marshal_user( operation->userName,
+                operation->agentSocket? NULL: savedhi_proxy_provider_set_operation( operation ), savedhiAlgorithmCurrent );
     }
 
     else {
         // Load the user object from the user's file.
-        const char *fileInputData = savedhi_read_file( userFile );
-        if (!fileInputData || ferror( userFile ))
-            wrn( "Error while reading configuration file:\n  %s: %d", operation->filePath, ferror( userFile ) );
-        fclose( userFile );
-
-        // Parse file.
-        savedhi_marshal_file_free( &operation->file );
         savedhi_marshal_user_free( &operation->user );
-        operation->file = savedhi_marshal_read( NULL, fileInputData );
+        if (operation->file && operation->file->error.type == savedhiMarshalSuccess && operation->agentSocket &&
+            !operation->file->info->redacted) {
+            // Clear-text states are decrypted with the user's key in-process.
+            dbg( "Configuration file is not redacted, not using agent." );
+            savedhi_free_string( &operation->agentSocket );
+            cli_userSecret( args, operation );
+        }
         if (operation->file && operation->file->error.type == savedhiMarshalSuccess) {
-            operation->user = savedhi_marshal_auth( operation->file, savedhi_proxy_provider_set_operation( operation ) );
+            // The agent's keys are checked against the user's keyID when they're used.
+            operation->user = savedhi_marshal_auth( operation->file,
+                    operation->agentSocket? NULL: savedhi_proxy_provider_set_operation( operation ) );
 
             if (operation->file->error.type == savedhiMarshalErrorUserSecret && operation->allowPasswordUpdate) {
                 // Update personal secret in the user's file.
@@ -514,7 +685,6 @@ void cli_user(Arguments *args, Operation *operation) {
                 }
             }
         }
-        savedhi_free_string( &fileInputData );
 
         // Incorrect personal secret.
         if (operation->file->error.type == savedhiMarshalErrorUserSecret) {
@@ -533,6 +703,8 @@ void cli_user(Arguments *args, Operation *operation) {
 
     if (operation->userSecret)
         operation->user->identicon = savedhi_identicon( operation->user->userName, operation->userSecret );
+    else if (operation->agentSocket)
+        operation->user->identicon = operation->agentIdenticon;
     savedhi_free_string( &operation->identicon );
     operation->identicon = savedhi_identicon_render( operation->user->identicon );
 }
@@ -638,13 +810,15 @@ void cli_resultState(Arguments *args, Operation *operation) {
 
     switch (operation->keyPurpose) {
         case savedhiKeyPurposeAuthentication: {
-            operation->resultState = operation->site->resultState? savedhi_strdup( operation->site->resultState ): NULL;
+            const char *resultState = savedhi_marshal_site_result_state( operation->user, operation->site );
+            operation->resultState = resultState? savedhi_strdup( resultState ): NULL;
             operation->keyCounter = operation->site->counter;
             break;
         }
         case savedhiKeyPurposeIdentification: {
             if (operation->resultType != savedhiResultNone) {
-                operation->resultState = operation->site->loginState? savedhi_strdup( operation->site->loginState ): NULL;
+                const char *loginState = savedhi_marshal_site_login_state( operation->user, operation->site );
+                operation->resultState = loginState? savedhi_strdup( loginState ): NULL;
                 operation->keyCounter = savedhiCounterInitial;
             }
             else {
@@ -653,14 +827,16 @@ void cli_resultState(Arguments *args, Operation *operation) {
                 savedhi_free_string( &operation->siteName );
                 operation->siteName = savedhi_strdup( operation->user->userName );
                 operation->resultType = operation->user->loginType;
-                operation->resultState = operation->user->loginState? savedhi_strdup( operation->user->loginState ): NULL;
+                const char *loginState = savedhi_marshal_user_login_state( operation->user );
+                operation->resultState = loginState? savedhi_strdup( loginState ): NULL;
                 operation->keyCounter = savedhiCounterInitial;
                 operation->algorithm = operation->user->algorithm;
             }
             break;
         }
         case savedhiKeyPurposeRecovery: {
-            operation->resultState = operation->question->state? savedhi_strdup( operation->question->state ): NULL;
+            const char *state = savedhi_marshal_question_state( operation->user, operation->site, operation->question );
+            operation->resultState = state? savedhi_strdup( state ): NULL;
             operation->keyCounter = savedhiCounterInitial;
             savedhi_free_string( &operation->keyContext );
             operation->keyContext = operation->question->keyword? savedhi_strdup( operation->question->keyword ): NULL;
@@ -728,6 +904,28 @@ void cli_fileRedacted(Arguments *args, Operation *operation) {
         wrn( "User configuration file is not redacted.  Use -R 1 to change this." );
 }
 
+/** Derive the operation's site "state" or "result", from the user's key or with the agent's. */
+static const char *cli_savedhi_site(Operation *operation, const savedhiUserKey *userKey, const char *derivation) {
+
+    if (!operation->agentSocket) {
+        if (strcmp( derivation, "state" ) == OK)
+            return savedhi_site_state( userKey, operation->siteName,
+                    operation->resultType, operation->resultParam, operation->keyCounter, operation->keyPurpose, operation->keyContext );
+
+        return savedhi_site_result( userKey, operation->siteName,
+                operation->resultType, operation->resultParam, operation->keyCounter, operation->keyPurpose, operation->keyContext );
+    }
+
+    const char *algorithm = savedhi_str( "%u", operation->algorithm ), *resultType = savedhi_str( "%u", operation->resultType );
+    const char *keyCounter = savedhi_str( "%u", operation->keyCounter ), *keyPurpose = savedhi_str( "%u", operation->keyPurpose );
+    const char *site = cli_agent_request( operation, (const char *[]){
+            derivation, operation->user->userName, algorithm, operation->siteName, resultType,
+            operation->resultParam, keyCounter, keyPurpose, operation->keyContext }, 9 );
+    savedhi_free_strings( &algorithm, &resultType, &keyCounter, &keyPurpose, NULL );
+
+    return site;
+}
+
 void cli_savedhi(Arguments *args, Operation *operation) {
 
     if (!operation->site)
@@ -738,28 +936,56 @@ void cli_savedhi(Arguments *args, Operation *operation) {
                 operation->user->userName, operation->resultPurpose, operation->site->siteName, operation->identicon );
 
     // Check user keyID.
-    const savedhiUserKey *userKey = NULL;
-    if (operation->user->userKeyProvider)
-        userKey = operation->user->userKeyProvider( operation->user->algorithm, operation->user->userName );
-    if (!userKey) {
-        ftl( "Couldn't derive user key." );
-        cli_free( args, operation );
-        exit( EX_SOFTWARE );
+    if (operation->agentSocket) {
+        const char *algorithm = savedhi_str( "%u", operation->user->algorithm );
+        const char *keyID = cli_agent_request( operation, (const char *[]){
+                "key-id", operation->user->userName, algorithm }, 3 );
+        savedhi_free_string( &algorithm );
+        if (!keyID || strlen( keyID ) != sizeof( operation->user->keyID.hex ) - 1) {
+            ftl( "Couldn't derive user key." );
+            savedhi_free_string( &keyID );
+            cli_free( args, operation );
+            exit( EX_SOFTWARE );
+        }
+
+        savedhiKeyID agentKeyID = savedhi_id_str( keyID );
+        savedhi_free_string( &keyID );
+        if (!savedhi_id_valid( &operation->user->keyID ))
+            operation->user->keyID = agentKeyID;
+        else if (!savedhi_id_equals( &agentKeyID, &operation->user->keyID )) {
+            // The agent was given a different personal secret, don't let it keep the wrong keys.
+            free( (void *)cli_agent_request( operation, (const char *[]){ "remove", operation->user->userName }, 2 ) );
+            ftl( "Incorrect personal secret according to configuration:\n  %s: User key: %s, doesn't match keyID: %s.",
+                    operation->filePath, agentKeyID.hex, operation->user->keyID.hex );
+            cli_free( args, operation );
+            exit( EX_DATAERR );
+        }
     }
-    if (!savedhi_id_valid( &operation->user->keyID ))
-        operation->user->keyID = userKey->keyID;
-    else if (!savedhi_id_equals( &userKey->keyID, &operation->user->keyID )) {
-        ftl( "user key mismatch." );
+
+    const savedhiUserKey *userKey = NULL;
+    if (!operation->agentSocket) {
+        if (operation->user->userKeyProvider)
+            userKey = operation->user->userKeyProvider( operation->user->algorithm, operation->user->userName );
+        if (!userKey) {
+            ftl( "Couldn't derive user key." );
+            cli_free( args, operation );
+            exit( EX_SOFTWARE );
+        }
+        if (!savedhi_id_valid( &operation->user->keyID ))
+            operation->user->keyID = *savedhi_user_key_id( userKey );
+        else if (!savedhi_id_equals( savedhi_user_key_id( userKey ), &operation->user->keyID )) {
+            ftl( "user key mismatch." );
+            savedhi_free( &userKey, sizeof( *userKey ) );
+            cli_free( args, operation );
+            exit( EX_SOFTWARE );
+        }
+
+        // Resolve user key for site.
         savedhi_free( &userKey, sizeof( *userKey ) );
-        cli_free( args, operation );
-        exit( EX_SOFTWARE );
+        if (operation->user->userKeyProvider)
+            userKey = operation->user->userKeyProvider( operation->algorithm, operation->user->userName );
     }
-
-    // Resolve user key for site.
-    savedhi_free( &userKey, sizeof( *userKey ) );
-    if (operation->user->userKeyProvider)
-        userKey = operation->user->userKeyProvider( operation->algorithm, operation->user->userName );
-    if (!userKey) {
+    if (!userKey && !operation->agentSocket) {
         ftl( "Couldn't derive user key." );
         cli_free( args, operation );
         exit( EX_SOFTWARE );
@@ -768,10 +994,7 @@ void cli_savedhi(Arguments *args, Operation *operation) {
     // Update state from resultParam if stateful.
     if (operation->resultType & savedhiResultClassStateful && operation->resultParam) {
         savedhi_free_string( &operation->resultState );
-        if (!(operation->resultState =
-                savedhi_site_state( userKey, operation->siteName,
-                        operation->resultType, operation->resultParam,
-                        operation->keyCounter, operation->keyPurpose, operation->keyContext ))) {
+        if (!(operation->resultState = cli_savedhi_site( operation, userKey, "state" ))) {
             ftl( "Couldn't encrypt result." );
             savedhi_free( &userKey, sizeof( *userKey ) );
             cli_free( args, operation );
@@ -781,23 +1004,23 @@ void cli_savedhi(Arguments *args, Operation *operation) {
 
         switch (operation->keyPurpose) {
             case savedhiKeyPurposeAuthentication: {
-                savedhi_free_string( &operation->site->resultState );
+                savedhi_free_strings( &operation->site->resultState, &operation->site->resultContent, NULL );
                 operation->site->resultState = savedhi_strdup( operation->resultState );
                 break;
             }
             case savedhiKeyPurposeIdentification: {
                 if (strcmp( operation->siteName, operation->userName ) == OK) {
-                    savedhi_free_string( &operation->user->loginState );
+                    savedhi_free_strings( &operation->user->loginState, &operation->user->loginContent, NULL );
                     operation->user->loginState = savedhi_strdup( operation->resultState );
                 } else {
-                    savedhi_free_string( &operation->site->loginState );
+                    savedhi_free_strings( &operation->site->loginState, &operation->site->loginContent, NULL );
                     operation->site->loginState = savedhi_strdup( operation->resultState );
                 }
                 break;
             }
 
             case savedhiKeyPurposeRecovery: {
-                savedhi_free_string( &operation->question->state );
+                savedhi_free_strings( &operation->question->state, &operation->question->stateContent, NULL );
                 operation->question->state = savedhi_strdup( operation->resultState );
                 break;
             }
@@ -812,8 +1035,7 @@ void cli_savedhi(Arguments *args, Operation *operation) {
         operation->resultParam = savedhi_strdup( operation->resultState );
 
     // Generate result.
-    const char *result = savedhi_site_result( userKey, operation->siteName,
-            operation->resultType, operation->resultParam, operation->keyCounter, operation->keyPurpose, operation->keyContext );
+    const char *result = cli_savedhi_site( operation, userKey, "result" );
     savedhi_free( &userKey, sizeof( *userKey ) );
     if (!result) {
         ftl( "Couldn't generate result." );
@@ -878,6 +1100,19 @@ static bool __savedhi_proxy_provider_operation(const savedhiUserKey **currentKey
     if (!__savedhi_proxy_provider_current_operation)
         return false;
 
+    // Adopt the key that was stretched in the background, if its salt agrees.
+    Operation *operation = __savedhi_proxy_provider_current_operation;
+    cli_userKey_join( operation );
+    if ((!*currentKey || *currentAlgorithm != algorithm) && operation->userKey && strcmp( operation->userName, userName ) == OK) {
+        const savedhiUserKey *sharedKey = savedhi_user_key_share( operation->userKey, userName, algorithm );
+        if (sharedKey) {
+            savedhi_free( currentKey, sizeof( **currentKey ) );
+            *currentKey = sharedKey;
+            *currentAlgorithm = algorithm;
+            return true;
+        }
+    }
+
     return savedhi_update_user_key( currentKey, currentAlgorithm, algorithm, userName,
                                     __savedhi_proxy_provider_current_operation->userSecret );
 }
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sysexits.h>
 
@@ -32,11 +33,72 @@
 })
 #endif
 
+#include "savedhi-aes.h"
 #include "savedhi-algorithm.h"
+#include "savedhi-algorithm_v0.h"
+#include "savedhi-algorithm_v2.h"
+#include "savedhi-marshal.h"
+#include "savedhi-scrypt.h"
+#include "savedhi-sha256.h"
 #include "savedhi-util.h"
 
 #include "savedhi-tests-util.h"
 
+#if defined( __GLIBC__ )
+// Count heap traffic by interposing the C library's allocator: malloc, calloc, realloc and the aligned allocators.
+// Memory mapped directly (eg. scrypt's arenas) isn't heap traffic and isn't counted.
+#define savedhi_TESTS_ALLOCATIONS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+static size_t allocations;
+
+void *malloc(size_t size) {
+
+    ++allocations;
+    return __libc_malloc( size );
+}
+
+void *calloc(size_t count, size_t size) {
+
+    ++allocations;
+    return __libc_calloc( count, size );
+}
+
+void *realloc(void *ptr, size_t size) {
+
+    ++allocations;
+    return __libc_realloc( ptr, size );
+}
+
+void *memalign(size_t alignment, size_t size) {
+
+    ++allocations;
+    return __libc_memalign( alignment, size );
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+
+    ++allocations;
+    return __libc_memalign( alignment, size );
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+
+    ++allocations;
+    if (!alignment || alignment % sizeof( void * ) || (alignment & (alignment - 1)))
+        return EINVAL;
+
+    void *memory = __libc_memalign( alignment, size );
+    if (!memory)
+        return ENOMEM;
+
+    *ptr = memory;
+    return OK;
+}
+#endif
+
 /** Output the program's usage documentation. */
 static void usage() {
 
@@ -57,6 +119,990 @@ static void usage() {
     exit( EX_OK );
 }
 
+/** @return true if no tests were named on the command-line, or the test's identifier starts with the first one named. */
+static bool test_selected(const char *id, int argc, char *const argv[]) {
+
+    return optind >= argc || strstr( id, argv[optind] ) == id;
+}
+
+/** @return true if the given buffer's hexadecimal encoding equals the expected one, in either case. */
+static bool test_hex_equals(const uint8_t *buffer, const size_t bufferSize, const char *expected) {
+
+    // An exactly sized buffer, so savedhi_hex writes into it rather than reallocating it.
+    char hex[256 + 1];
+    size_t hexSize = bufferSize * 2 + 1;
+    return hexSize <= sizeof( hex ) && savedhi_hex( buffer, bufferSize, hex, &hexSize ) && savedhi_strcasecmp( hex, expected ) == OK;
+}
+
+#if savedhi_TESTS_ALLOCATIONS
+/** Site keys and template results for names of typical length should not touch the heap.
+ * @return The amount of failed tests. */
+static int test_allocations(int argc, char *const argv[]) {
+
+    const char *id = "allocations";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    const savedhiUserKey *userKey = savedhi_user_key( "Robert Lee Mitchell", "banana colored duckling", savedhiAlgorithmFirst );
+    if (!userKey) {
+        ftl( "Couldn't derive user key." );
+        return 1;
+    }
+
+    int failed = 0;
+    char siteName[256];
+    memset( siteName, 'x', sizeof( siteName ) - 1 );
+    siteName[sizeof( siteName ) - 1] = '\0';
+    for (savedhiAlgorithm algorithm = savedhiAlgorithmFirst; algorithm <= savedhiAlgorithmLast; ++algorithm) {
+        const savedhiUserKey *algorithmKey = algorithm == userKey->algorithm? userKey:
+                                             savedhi_user_key_share( userKey, "Robert Lee Mitchell", algorithm );
+        fprintf( stdout, "test %s v%d... ", id, algorithm );
+        if (!algorithmKey) {
+            ftl( "Couldn't share user key." );
+            continue;
+        }
+
+        savedhiSiteKey siteKey;
+        size_t siteKeyAllocations = allocations;
+        bool siteKeyDerived = savedhi_site_key_into(
+                &siteKey, algorithmKey, siteName, savedhiCounterDefault, savedhiKeyPurposeRecovery, "question" );
+        siteKeyAllocations = allocations - siteKeyAllocations;
+        savedhi_zero( &siteKey, sizeof( siteKey ) );
+
+        char siteResult[32];
+        size_t siteResultAllocations = allocations;
+        bool siteResultDerived = savedhi_site_result_into( siteResult, sizeof( siteResult ), NULL,
+                algorithmKey, siteName, savedhiResultTemplateLong, NULL, savedhiCounterDefault, savedhiKeyPurposeAuthentication, NULL );
+        siteResultAllocations = allocations - siteResultAllocations;
+        savedhi_zero( siteResult, sizeof( siteResult ) );
+        if (algorithmKey != userKey)
+            savedhi_free( &algorithmKey, sizeof( *algorithmKey ) );
+
+        if (!siteKeyDerived || !siteResultDerived) {
+            ftl( "Couldn't derive site key." );
+            continue;
+        }
+        if (siteKeyAllocations || siteResultAllocations) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (allocations: got %zu + %zu != expected 0)\n", siteKeyAllocations, siteResultAllocations );
+            continue;
+        }
+
+        fprintf( stdout, "pass.\n" );
+    }
+    savedhi_free( &userKey, sizeof( *userKey ) );
+
+    return failed;
+}
+#endif
+
+/** A file of sites across all algorithms should stretch each of the user's keys at most once, when written, authenticated and written again.
+ * @return The amount of failed tests. */
+static int test_provider(int argc, char *const argv[]) {
+
+    const char *id = "provider";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    fprintf( stdout, "test %s... ", id );
+    savedhiKeyProvider provider = savedhi_proxy_provider_set_secret( "banana colored duckling" );
+    savedhiMarshalledUser *user = savedhi_marshal_user( "Robert Lee Mitchell", provider, savedhiAlgorithmCurrent );
+    if (!user || !savedhi_marshal_sites_reserve( user, 2000 )) {
+        ftl( "Couldn't allocate user." );
+        return 1;
+    }
+    const savedhiUserKey *userKey = provider( user->algorithm, user->userName );
+    if (!userKey) {
+        ftl( "Couldn't derive user key." );
+        savedhi_marshal_free( &user );
+        return 1;
+    }
+    user->keyID = *savedhi_user_key_id( userKey );
+    user->lastUsed = time( NULL );
+    user->redacted = false;
+    savedhi_free( &userKey, sizeof( *userKey ) );
+
+    char siteName[32];
+    for (int s = 0; s < 2000; ++s) {
+        snprintf( siteName, sizeof( siteName ), "site%04d.com", s );
+        savedhiMarshalledSite *site = savedhi_marshal_site( user, siteName,
+                s % 2? savedhiResultStatePersonal: savedhiResultTemplateLong, savedhiCounterDefault,
+                (savedhiAlgorithm)(s % (savedhiAlgorithmLast + 1)) );
+        if (!site)
+            continue;
+
+        site->lastUsed = user->lastUsed;
+        if (site->resultType == savedhiResultStatePersonal)
+            site->resultContent = savedhi_str( "password %d", s );
+    }
+
+    savedhiMarshalledFile *file = NULL;
+    const char *written = savedhi_marshal_write( savedhiFormatFlat, &file, user );
+    savedhi_marshal_free( &user );
+    savedhi_marshal_free( &file );
+
+    file = savedhi_marshal_read( NULL, written );
+    user = savedhi_marshal_auth( file, provider );
+    const char *resultContent = user && user->sites_count == 2000? user->sites[1999].resultContent: NULL;
+    bool read = resultContent && strcmp( resultContent, "password 1999" ) == OK;
+    const char *rewritten = user && savedhi_marshal_states( user )? savedhi_marshal_write( savedhiFormatFlat, &file, user ): NULL;
+    savedhiKeyProviderStats stats = savedhi_proxy_provider_stats();
+    savedhi_marshal_free( &user );
+    savedhi_marshal_free( &file );
+    savedhi_proxy_provider_unset();
+
+    int failed = 0;
+    if (!written || !rewritten || !read) {
+        ++failed;
+        fprintf( stdout, "FAILED!  (marshalling: %s)\n", !written? "write": !read? "read": "rewrite" );
+    }
+    else if (stats.misses > savedhiAlgorithmLast + 1) {
+        ++failed;
+        fprintf( stdout, "FAILED!  (misses: got %zu > expected %d)\n", stats.misses, savedhiAlgorithmLast + 1 );
+    }
+    else
+        fprintf( stdout, "pass.  (hits: %zu, misses: %zu)\n", stats.hits, stats.misses );
+    savedhi_free_strings( &written, &rewritten, NULL );
+
+    return failed;
+}
+
+static bool test_marshal_index_keep(savedhiMarshalledData *child, void *args) {
+
+    return child->obj_key && strtoul( child->obj_key + strlen( "key" ), NULL, 10 ) % *(const size_t *)args == 0;
+}
+
+/** @param expected A bit for each of the keys key0 to key63 that the data should hold, its value equal to its key.
+ * @return The first key that the data holds but shouldn't, or should but doesn't; or -1 if there is none. */
+static int test_marshal_index_check(const savedhiMarshalledData *data, const uint64_t expected) {
+
+    char key[16];
+    for (int k = 0; k < 64; ++k) {
+        snprintf( key, sizeof( key ), "key%d", k );
+        const char *value = data? savedhi_marshal_data_get_str( data, key, NULL ): NULL;
+        if (expected & (1ULL << k)? !value || strcmp( value, key ) != OK: data && savedhi_marshal_data_find( data, key, NULL ))
+            return k;
+    }
+
+    return ERR;
+}
+
+/** An object's keyed children should be found through its index as they are added, filtered out and added again,
+ * whether the object is built up or read from a file.
+ * @return The amount of failed tests. */
+static int test_marshal_index(int argc, char *const argv[]) {
+
+    const char *id = "marshal-index";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    fprintf( stdout, "test %s... ", id );
+    const char *failure = NULL;
+    int failureKey = ERR;
+    uint64_t expected = 0;
+    char key[16];
+    size_t keep;
+
+    // Past the index's threshold and through several rehashes, then filtered down to a third and added to again.
+    savedhiMarshalledData *data = savedhi_marshal_data_new();
+    for (int k = 0; k < 40; ++k) {
+        snprintf( key, sizeof( key ), "key%d", k );
+        if (!savedhi_marshal_data_set_str( key, data, key, NULL ))
+            failure = "add";
+        expected |= 1ULL << k;
+    }
+    if (!failure && ((failureKey = test_marshal_index_check( data, expected )) != ERR || data->children_count != 40))
+        failure = "added";
+
+    keep = 3;
+    savedhi_marshal_data_filter( data, test_marshal_index_keep, &keep );
+    for (int k = 0; k < 40; ++k)
+        if (k % 3)
+            expected &= ~(1ULL << k);
+    if (!failure && (failureKey = test_marshal_index_check( data, expected )) != ERR)
+        failure = "filtered";
+
+    for (int k = 0; !failure && k < 40; ++k) {
+        snprintf( key, sizeof( key ), "key%d", k );
+        savedhiMarshalledData *child = savedhi_marshal_data_get( data, key, NULL );
+        if (!child || (k % 3 == 0) != (child->str_value != NULL) || !savedhi_marshal_data_set_str( key, child, NULL ))
+            failure = "re-added", failureKey = k;
+        expected |= 1ULL << k;
+    }
+    if (!failure && ((failureKey = test_marshal_index_check( data, expected )) != ERR || data->children_count != 40))
+        failure = "re-added";
+
+    // Filtered below the threshold, then past it again.
+    keep = 10;
+    savedhi_marshal_data_filter( data, test_marshal_index_keep, &keep );
+    expected = 1ULL << 0 | 1ULL << 10 | 1ULL << 20 | 1ULL << 30;
+    if (!failure && (failureKey = test_marshal_index_check( data, expected )) != ERR)
+        failure = "filtered below the threshold";
+    for (int k = 40; k < 60; ++k) {
+        snprintf( key, sizeof( key ), "key%d", k );
+        if (!savedhi_marshal_data_set_str( key, data, key, NULL ))
+            failure = "add";
+        expected |= 1ULL << k;
+    }
+    if (!failure && (failureKey = test_marshal_index_check( data, expected )) != ERR)
+        failure = "added past the threshold again";
+    savedhi_marshal_free( &data );
+
+#if savedhi_JSON
+    // An object of more keys than the threshold, read from JSON.
+    const char *sites = NULL;
+    expected = 0;
+    for (int k = 0; k < 20; ++k) {
+        const char *moreSites = savedhi_str( "%s%s\"key%d\": \"key%d\"", sites? sites: "", sites? ", ": "", k, k );
+        savedhi_free_string( &sites );
+        sites = moreSites;
+        expected |= 1ULL << k;
+    }
+    const char *json = savedhi_str( "{ \"sites\": { %s } }", sites );
+    savedhiMarshalledFile *file = savedhi_marshal_read( NULL, json );
+    if (!failure && (!file || file->error.type != savedhiMarshalSuccess ||
+                     (failureKey = test_marshal_index_check( savedhi_marshal_data_find( file->data, "sites", NULL ), expected )) != ERR))
+        failure = "read from JSON";
+    savedhi_marshal_free( &file );
+    savedhi_free_strings( &sites, &json, NULL );
+#endif
+
+    if (failure) {
+        if (failureKey != ERR)
+            fprintf( stdout, "FAILED!  (%s: key%d)\n", failure, failureKey );
+        else
+            fprintf( stdout, "FAILED!  (%s)\n", failure );
+        return 1;
+    }
+
+    fprintf( stdout, "pass.\n" );
+    return 0;
+}
+
+/** Results generated for a batch of sites should equal those generated one at a time, for every algorithm version.
+ * @return The amount of failed tests. */
+static int test_results_batch(int argc, char *const argv[]) {
+
+    const char *id = "results-batch";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    const savedhiUserKey *userKey = savedhi_user_key( "Robert Lee Mitchell", "banana colored duckling", savedhiAlgorithmFirst );
+    if (!userKey) {
+        ftl( "Couldn't derive user key." );
+        return 1;
+    }
+
+    // Requests of every template type and purpose, mixed with stateful results, each needing their own state per algorithm.
+    static const savedhiResultType resultTypes[] = {
+            savedhiResultTemplateMaximum, savedhiResultTemplateLong, savedhiResultTemplateMedium, savedhiResultTemplateShort,
+            savedhiResultTemplateBasic, savedhiResultTemplatePIN, savedhiResultTemplateName, savedhiResultTemplatePhrase,
+            savedhiResultStatePersonal,
+    };
+    enum { requestsCount = 50 };
+    char siteNames[requestsCount][32];
+    const char *states[requestsCount] = { NULL };
+    savedhiSiteRequest requests[requestsCount];
+
+    int failed = 0;
+    for (savedhiAlgorithm algorithm = savedhiAlgorithmFirst; algorithm <= savedhiAlgorithmLast; ++algorithm) {
+        const savedhiUserKey *algorithmKey = algorithm == userKey->algorithm? userKey:
+                                             savedhi_user_key_share( userKey, "Robert Lee Mitchell", algorithm );
+        fprintf( stdout, "test %s v%d... ", id, algorithm );
+        if (!algorithmKey) {
+            ftl( "Couldn't share user key." );
+            continue;
+        }
+
+        for (size_t r = 0; r < requestsCount; ++r) {
+            snprintf( siteNames[r], sizeof( siteNames[r] ), "site%zu.example.com", r * 7919 % 1000 );
+            requests[r] = (savedhiSiteRequest){
+                    .siteName = siteNames[r],
+                    .resultType = resultTypes[r % (sizeof( resultTypes ) / sizeof( *resultTypes ))],
+                    .keyCounter = (savedhiCounter)(1 + r % 3),
+                    .keyPurpose = (savedhiKeyPurpose)(r % (savedhiKeyPurposeRecovery + 1)),
+                    .keyContext = r % 5? NULL: "question",
+            };
+            if (requests[r].resultType & savedhiResultClassStateful)
+                requests[r].resultParam = states[r] = savedhi_site_state( algorithmKey, siteNames[r], requests[r].resultType,
+                        "personal password", requests[r].keyCounter, requests[r].keyPurpose, requests[r].keyContext );
+        }
+
+        // Size the arena, then generate into it.
+        const char *results[requestsCount];
+        size_t arenaLength = 0;
+        bool sized = !savedhi_site_results_batch( NULL, 0, &arenaLength, results, algorithmKey, requests, requestsCount ) && arenaLength;
+        char *arena = malloc( max( arenaLength, (size_t)1 ) );
+        bool generated = arena && savedhi_site_results_batch( arena, arenaLength, NULL, results, algorithmKey, requests, requestsCount );
+
+        const char *failure = !sized? "arena size": !generated? "batch": NULL;
+        for (size_t r = 0; !failure && r < requestsCount; ++r) {
+            const char *result = savedhi_site_result( algorithmKey, requests[r].siteName, requests[r].resultType, requests[r].resultParam,
+                    requests[r].keyCounter, requests[r].keyPurpose, requests[r].keyContext );
+            if (!result || !results[r] || strcmp( result, results[r] ) != OK)
+                failure = savedhi_type_short_name( requests[r].resultType );
+            savedhi_free_string( &result );
+        }
+        if (failure) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (result: %s differs)\n", failure );
+        }
+        else
+            fprintf( stdout, "pass.\n" );
+
+        savedhi_free( &arena, arenaLength );
+        for (size_t r = 0; r < requestsCount; ++r)
+            savedhi_free_string( &states[r] );
+        if (algorithmKey != userKey)
+            savedhi_free( &algorithmKey, sizeof( *algorithmKey ) );
+    }
+    savedhi_free( &userKey, sizeof( *userKey ) );
+
+    return failed;
+}
+
+/** Site keys hashed by each SHA-256 kernel should equal those derived one at a time, for site names of any length.
+ * @return The amount of failed tests. */
+static int test_sha256_lanes(int argc, char *const argv[]) {
+
+    const char *id = "sha256-lanes";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    const savedhiUserKey *userKey = savedhi_user_key( "Robert Lee Mitchell", "banana colored duckling", savedhiAlgorithmV2 );
+    if (!userKey) {
+        ftl( "Couldn't derive user key." );
+        return 1;
+    }
+
+    // Site names from 1 to 300 characters long, so that messages span a varying amount of blocks.
+    enum { sitesCount = 37 };
+    char siteNames[sitesCount][301];
+    savedhiBuffer siteSalts[sitesCount];
+    const uint8_t *messages[sitesCount];
+    size_t messageSizes[sitesCount];
+    for (size_t s = 0; s < sitesCount; ++s) {
+        size_t siteNameLength = 1 + s * s * 299 / ((sitesCount - 1) * (sitesCount - 1));
+        for (size_t c = 0; c < siteNameLength; ++c)
+            siteNames[s][c] = (char)('a' + (s + c) % 26);
+        siteNames[s][siteNameLength] = '\0';
+    }
+
+    int failed = 0;
+    const size_t defaultLanes = savedhi_sha256_lanes();
+    for (size_t lanes = 1; lanes <= savedhi_sha256_lanes_max; lanes *= 2) {
+        if (!savedhi_sha256_lanes_set( lanes ))
+            continue;
+
+        fprintf( stdout, "test %s %s... ", id, savedhi_sha256_lanes_name() );
+        bool equal = true;
+        for (savedhiKeyPurpose purpose = savedhiKeyPurposeAuthentication; equal && purpose <= savedhiKeyPurposeRecovery; ++purpose) {
+            const char *keyContext = purpose == savedhiKeyPurposeRecovery? "question": NULL;
+            for (size_t s = 0; s < sitesCount; ++s) {
+                if (!savedhi_site_salt_v2( &siteSalts[s], NULL, siteNames[s], savedhiCounterDefault, keyContext )) {
+                    ftl( "Couldn't allocate site salt." );
+                    abort();
+                }
+                messages[s] = siteSalts[s].bytes;
+                messageSizes[s] = siteSalts[s].size;
+            }
+
+            uint8_t macs[sitesCount][32];
+            equal = savedhi_hash_hmac_sha256_lanes( macs, &userKey->purposeStates[purpose], messages, messageSizes, sitesCount );
+            for (size_t s = 0; s < sitesCount; ++s) {
+                savedhiSiteKey siteKey;
+                equal &= savedhi_site_key_into( &siteKey, userKey, siteNames[s], savedhiCounterDefault, purpose, keyContext ) &&
+                         memcmp( siteKey.bytes, macs[s], sizeof( siteKey.bytes ) ) == OK;
+                if (!equal) {
+                    fprintf( stdout, "FAILED!  (%s, site name of %zu characters: site key differs)\n",
+                            savedhi_purpose_name( purpose ), strlen( siteNames[s] ) );
+                    break;
+                }
+            }
+            for (size_t s = 0; s < sitesCount; ++s)
+                savedhi_buffer_free( &siteSalts[s] );
+        }
+
+        if (equal)
+            fprintf( stdout, "pass.\n" );
+        else
+            ++failed;
+    }
+    savedhi_sha256_lanes_set( defaultLanes );
+    savedhi_free( &userKey, sizeof( *userKey ) );
+
+    return failed;
+}
+
+/** Each character class's encoding tables should hold, for every seed byte, the class character that the byte selects.
+ * @return The amount of failed tests. */
+static int test_class_tables(int argc, char *const argv[]) {
+
+    const char *id = "class-tables";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    fprintf( stdout, "test %s... ", id );
+    static const char classes[] = "VCvcAanox ";
+    for (size_t c = 0; c < strlen( classes ); ++c) {
+        const char *characters = savedhi_class_characters( classes[c] );
+        const size_t charactersLength = characters? strlen( characters ): 0;
+        if (!charactersLength) {
+            fprintf( stdout, "FAILED!  (class %c: no characters)\n", classes[c] );
+            return 1;
+        }
+
+        for (unsigned int b = 0; b <= UINT8_MAX; ++b) {
+            if (savedhi_class_character( classes[c], (uint8_t)b ) != characters[b % charactersLength]) {
+                fprintf( stdout, "FAILED!  (class %c, byte %u)\n", classes[c], b );
+                return 1;
+            }
+            if (savedhi_class_character_v0( classes[c], (uint8_t)b ) != characters[savedhi_seed_v0( (uint8_t)b ) % charactersLength]) {
+                fprintf( stdout, "FAILED!  (class %c, byte %u, v0)\n", classes[c], b );
+                return 1;
+            }
+        }
+    }
+
+    fprintf( stdout, "pass.\n" );
+    return 0;
+}
+
+/** @return The amount of characters in the string, walking its lead bytes one at a time; or 0 if a lead is illegal. */
+static size_t test_utf8_walk(const uint8_t *bytes, const size_t size) {
+
+    size_t chars = 0;
+    for (size_t b = 0; b < size; ++chars) {
+        const uint8_t lead = bytes[b];
+        const size_t charSize = lead <= 0x7F? 1: lead >= 0xC2 && lead <= 0xDF? 2: lead >= 0xE0 && lead <= 0xEF? 3:
+                                lead >= 0xF0 && lead <= 0xF4? 4: 0;
+        if (!charSize)
+            return 0;
+        b += min( charSize, size - b );
+    }
+
+    return chars;
+}
+
+/** Measuring a string, a block of bytes at once where it can, should count the characters of a byte-wise walk,
+ * since the counts feed the salts of user and site keys.
+ * @return The amount of failed tests. */
+static int test_utf8_measure(int argc, char *const argv[]) {
+
+    const char *id = "utf8-measure";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    fprintf( stdout, "test %s... ", id );
+    // Legal leads of each size, illegal C0/C1/F5+ leads and stray continuations.
+    static const uint8_t leads[] = { 0xC2, 0xDF, 0xE0, 0xEF, 0xF0, 0xF4, 0xC0, 0xC1, 0xF5, 0xF8, 0xFF, 0x80, 0xBF };
+    uint8_t string[64 + 1];
+    size_t measuredSize = 0;
+
+    // A lead at each offset, with up to four continuations, in strings long enough for a block or two.  The blocks start
+    // three bytes in, so offsets 16-18 and 32-34 put a lead in the last bytes of a block, its continuations in the next.
+    for (size_t size = 19; size < sizeof( string ); ++size)
+        for (size_t offset = 0; offset < size; ++offset)
+            for (size_t l = 0; l < sizeof( leads ) / sizeof( *leads ); ++l)
+                for (size_t continuations = 0; continuations <= 4; ++continuations) {
+                    memset( string, 'a', size );
+                    string[offset] = leads[l];
+                    for (size_t c = 1; c <= continuations && offset + c < size; ++c)
+                        string[offset + c] = (uint8_t)(0x80 | (offset + c) % 0x40);
+                    string[size] = 0;
+
+                    const size_t expected = test_utf8_walk( string, size );
+                    if (savedhi_utf8_measure( (const char *)string, &measuredSize ) != expected || measuredSize != size) {
+                        fprintf( stdout, "FAILED!  (lead %02X at %zu of %zu, %zu continuations: expected %zu)\n",
+                                leads[l], offset, size, continuations, expected );
+                        return 1;
+                    }
+                }
+
+    // Random strings of multi-byte characters, some of them cut off, broken or illegal, from a fixed seed.
+    uint32_t seed = 0x5EED;
+    for (size_t s = 0; s < 200000; ++s) {
+        const size_t size = 19 + (seed = seed * 1664525 + 1013904223) % (sizeof( string ) - 19);
+        for (size_t b = 0; b < size;) {
+            seed = seed * 1664525 + 1013904223;
+            const uint8_t kind = (uint8_t)(seed >> 24);
+            if (kind < 0x60)
+                string[b++] = (uint8_t)(0x20 + kind);
+            else if (kind < 0xF8) {
+                const size_t charSize = kind < 0xA0? 2: kind < 0xE0? 3: 4;
+                string[b++] = charSize == 2? (uint8_t)(0xC2 + kind % 0x1E): charSize == 3? (uint8_t)(0xE0 + kind % 0x10):
+                                             (uint8_t)(0xF0 + kind % 0x05);
+                for (size_t c = 1; c < charSize && b < size; ++c)
+                    string[b++] = (uint8_t)(0x80 | (seed >> (c * 6)) % 0x40);
+            }
+            else
+                string[b++] = leads[kind % (sizeof( leads ) / sizeof( *leads ))];
+        }
+        string[size] = 0;
+
+        const size_t expected = test_utf8_walk( string, size );
+        if (savedhi_utf8_measure( (const char *)string, &measuredSize ) != expected || measuredSize != size) {
+            fprintf( stdout, "FAILED!  (random string %zu of %zu bytes: expected %zu)\n", s, size, expected );
+            return 1;
+        }
+    }
+
+    fprintf( stdout, "pass.\n" );
+    return 0;
+}
+
+/** Decoding hexadecimal should accept either case and reject anything else, in blocks of 16 characters as in the tail after them.
+ * @return The amount of failed tests. */
+static int test_unhex(int argc, char *const argv[]) {
+
+    const char *id = "unhex";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    fprintf( stdout, "test %s... ", id );
+    // Two blocks of 16 characters and a tail of 10.
+    static const char upper[] = "00FF7F8009A0AFBFC0DEADBEEF0123456789ABCDEF", lower[] = "00ff7f8009a0afbfc0deadbeef0123456789abcdef";
+    static const uint8_t bytes[] = {
+            0x00, 0xFF, 0x7F, 0x80, 0x09, 0xA0, 0xAF, 0xBF, 0xC0, 0xDE, 0xAD, 0xBE, 0xEF,
+            0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+    };
+    char hex[sizeof( upper )];
+    size_t size;
+
+    // Every length, in upper, lower and mixed case.
+    for (size_t length = 2; length < sizeof( upper ); length += 2)
+        for (int c = 0; c < 3; ++c) {
+            for (size_t h = 0; h < length; ++h)
+                hex[h] = (c == 0 || (c == 2 && h % 3))? upper[h]: lower[h];
+            hex[length] = 0;
+
+            size = 0;
+            const uint8_t *unhex = savedhi_unhex( hex, &size );
+            const bool decoded = unhex && size == length / 2 && memcmp( unhex, bytes, size ) == OK;
+            savedhi_free( &unhex, size );
+            if (!decoded) {
+                fprintf( stdout, "FAILED!  (%s)\n", hex );
+                return 1;
+            }
+        }
+
+    // Missing, empty, odd-length or with an invalid character anywhere in the blocks or the tail.
+    static const char invalid[] = { 'G', 'g', 'x', ' ', '/', ':', '@', '`', '\n', (char)0x80, (char)0xFF };
+    for (size_t i = 0; i < sizeof( invalid ) + 3; ++i)
+        for (size_t h = 0; h < (i < sizeof( invalid )? sizeof( upper ) - 1: 1); ++h) {
+            memcpy( hex, upper, sizeof( upper ) );
+            if (i < sizeof( invalid ))
+                hex[h] = invalid[i];
+            else if (i == sizeof( invalid ))
+                hex[0] = 0;
+            else if (i == sizeof( invalid ) + 1)
+                hex[sizeof( upper ) - 2] = 0;
+
+            size = 42;
+            const uint8_t *unhex = savedhi_unhex( i == sizeof( invalid ) + 2? NULL: hex, &size );
+            if (unhex || size != 42) {
+                savedhi_free( &unhex, size );
+                fprintf( stdout, "FAILED!  (%s: decoded, or size changed)\n", i == sizeof( invalid ) + 2? "NULL": hex );
+                return 1;
+            }
+        }
+
+    // What sscanf used to accept.
+    if (savedhi_unhex( "1G", &size ) || savedhi_unhex( " F", &size ) || savedhi_unhex( "0x", &size )) {
+        fprintf( stdout, "FAILED!  (partially hexadecimal)\n" );
+        return 1;
+    }
+
+    fprintf( stdout, "pass.\n" );
+    return 0;
+}
+
+/** Each SHA-256 implementation should hash the FIPS 180-2 and RFC 4231 test vectors, whole and split up.
+ * @return The amount of failed tests. */
+static int test_sha256(int argc, char *const argv[]) {
+
+    const char *id = "sha256";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    // FIPS 180-2, appendix B.
+    static const struct {
+        const char *message;
+        size_t repeat;
+        const char *digest;
+    } hashes[] = {
+            { "abc", 1,
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+            { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+            { "a", 1000000,
+              "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+    };
+    // RFC 4231, test cases 1-4, 6 and 7.
+    static const struct {
+        uint8_t key;
+        size_t keySize;
+        const char *keyString;
+        uint8_t data;
+        size_t dataSize;
+        const char *dataString;
+        const char *mac;
+    } macs[] = {
+            { 0x0b, 20, NULL, 0, 0, "Hi There",
+              "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+            { 0, 0, "Jefe", 0, 0, "what do ya want for nothing?",
+              "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+            { 0xaa, 20, NULL, 0xdd, 50, NULL,
+              "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe" },
+            { 0, 25, NULL, 0xcd, 50, NULL,
+              "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b" },
+            { 0xaa, 131, NULL, 0, 0, "Test Using Larger Than Block-Size Key - Hash Key First",
+              "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+            { 0xaa, 131, NULL, 0, 0, "This is a test using a larger than block-size key and a larger than block-size data. "
+                                     "The key needs to be hashed before being used by the HMAC algorithm.",
+              "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2" },
+    };
+
+    int failed = 0;
+    const char *defaultName = savedhi_sha256_name();
+    static const char *names[] = { "sha-ni", "armv8", "portable", "backend" };
+    for (size_t n = 0; n < sizeof( names ) / sizeof( *names ); ++n) {
+        if (!savedhi_sha256_set( names[n] ))
+            continue;
+
+        fprintf( stdout, "test %s %s... ", id, names[n] );
+        const char *failure = NULL;
+        for (size_t h = 0; !failure && h < sizeof( hashes ) / sizeof( *hashes ); ++h) {
+            // Hash the message in uneven updates, so that blocks straddle them.
+            savedhiSHA256 sha256;
+            uint8_t digest[32];
+            savedhi_sha256_init( &sha256 );
+            const size_t messageSize = strlen( hashes[h].message );
+            for (size_t r = 0, u = 0; r < hashes[h].repeat; r += u) {
+                u = min( 1 + r % 997, hashes[h].repeat - r );
+                for (size_t c = 0; c < u; ++c)
+                    savedhi_sha256_update( &sha256, (const uint8_t *)hashes[h].message, messageSize );
+            }
+            savedhi_sha256_final( &sha256, digest );
+            if (!test_hex_equals( digest, sizeof( digest ), hashes[h].digest ))
+                failure = "FIPS 180-2";
+        }
+        for (size_t m = 0; !failure && m < sizeof( macs ) / sizeof( *macs ); ++m) {
+            uint8_t key[131], data[160];
+            size_t keySize = macs[m].keyString? strlen( macs[m].keyString ): macs[m].keySize;
+            size_t dataSize = macs[m].dataString? strlen( macs[m].dataString ): macs[m].dataSize;
+            for (size_t k = 0; k < keySize; ++k)
+                key[k] = macs[m].keyString? (uint8_t)macs[m].keyString[k]: macs[m].key? macs[m].key: (uint8_t)(k + 1);
+            for (size_t d = 0; d < dataSize; ++d)
+                data[d] = macs[m].dataString? (uint8_t)macs[m].dataString[d]: macs[m].data;
+
+            // The whole message at once, then keyed with the first part of the message as its prefix.
+            uint8_t mac[32];
+            if (!savedhi_hash_hmac_sha256( mac, key, keySize, data, dataSize ) ||
+                !test_hex_equals( mac, sizeof( mac ), macs[m].mac ))
+                failure = "RFC 4231";
+
+            savedhiHMACState state;
+            if (!failure && (!savedhi_hash_hmac_sha256_init( &state, key, keySize, data, dataSize / 3 ) ||
+                             !savedhi_hash_hmac_sha256_final( mac, &state, data + dataSize / 3, dataSize - dataSize / 3 ) ||
+                             !test_hex_equals( mac, sizeof( mac ), macs[m].mac )))
+                failure = "RFC 4231, keyed state";
+
+            // A keyed state is finalized by the implementation that keyed it, whichever is selected since.
+            if (!failure) {
+                savedhi_sha256_set( strcmp( names[n], "backend" ) == OK? "portable": "backend" );
+                const bool finalized = savedhi_hash_hmac_sha256_final(
+                        mac, &state, data + dataSize / 3, dataSize - dataSize / 3 );
+                savedhi_sha256_set( names[n] );
+                if (!finalized || !test_hex_equals( mac, sizeof( mac ), macs[m].mac ))
+                    failure = "RFC 4231, keyed state after switching implementations";
+            }
+            savedhi_zero( &state, sizeof( state ) );
+        }
+
+        if (failure) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (%s)\n", failure );
+        }
+        else
+            fprintf( stdout, "pass.\n" );
+    }
+    savedhi_sha256_set( defaultName );
+
+    return failed;
+}
+
+/** Each AES implementation should encrypt and decrypt the FIPS-197 and SP 800-38A test vectors, across the width of its kernels.
+ * @return The amount of failed tests. */
+static int test_aes(int argc, char *const argv[]) {
+
+    const char *id = "aes";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    // FIPS-197, appendix C.1: a single block, which CBC with a zero IV leaves unchained.
+    static const char *fipsKey = "000102030405060708090a0b0c0d0e0f", *fipsIV = "00000000000000000000000000000000";
+    static const char *fipsPlain = "00112233445566778899aabbccddeeff", *fipsCipher = "69c4e0d86a7b0430d8cdb78070b4c55a";
+    // SP 800-38A, F.2.1 and F.2.2: CBC-AES128, of which any first blocks are a vector of their own.
+    static const char *cbcKey = "2b7e151628aed2a6abf7158809cf4f3c", *cbcIV = "000102030405060708090a0b0c0d0e0f";
+    static const char *cbcPlain =
+            "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51"
+            "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710";
+    static const char *cbcCipher =
+            "7649abac8119b246cee98e9b12e9197d" "5086cb9b507219ee95db113a917678b2"
+            "73bed6b8e3c1743b7116e69e22229516" "3ff1caa1681fac09120eca307586e1a7";
+
+    int failed = 0;
+    const char *defaultName = savedhi_aes_name();
+    static const char *names[] = { "aes-ni", "armv8", "portable" };
+    for (size_t n = 0; n < sizeof( names ) / sizeof( *names ); ++n) {
+        if (!savedhi_aes_set( names[n] ))
+            continue;
+
+        fprintf( stdout, "test %s %s... ", id, names[n] );
+        const char *failure = NULL;
+        size_t size;
+        const uint8_t *key, *iv, *plain;
+        uint8_t blocks[9 * 16], expected[9 * 16];
+        savedhiAESKey aesKey;
+
+        key = savedhi_unhex( fipsKey, &size ), iv = savedhi_unhex( fipsIV, &size ), plain = savedhi_unhex( fipsPlain, &size );
+        savedhi_aes_key_init( &aesKey, key );
+        memcpy( blocks, plain, 16 );
+        savedhi_aes_cbc_encrypt( &aesKey, iv, blocks, 1 );
+        if (!test_hex_equals( blocks, 16, fipsCipher ))
+            failure = "FIPS-197 encrypt";
+        savedhi_aes_cbc_decrypt( &aesKey, iv, blocks, 1 );
+        if (!failure && memcmp( blocks, plain, 16 ) != OK)
+            failure = "FIPS-197 decrypt";
+        savedhi_free( &key, 16 ), savedhi_free( &iv, 16 ), savedhi_free( &plain, 16 );
+
+        key = savedhi_unhex( cbcKey, &size ), iv = savedhi_unhex( cbcIV, &size ), plain = savedhi_unhex( cbcPlain, &size );
+        savedhi_aes_key_init( &aesKey, key );
+        static const size_t counts[] = { 1, 3, 4 };
+        for (size_t c = 0; !failure && c < sizeof( counts ) / sizeof( *counts ); ++c) {
+            char cipher[4 * 32 + 1] = { 0 };
+            memcpy( cipher, cbcCipher, counts[c] * 32 );
+            memcpy( blocks, plain, counts[c] * 16 );
+            savedhi_aes_cbc_encrypt( &aesKey, iv, blocks, counts[c] );
+            if (!test_hex_equals( blocks, counts[c] * 16, cipher ))
+                failure = "SP 800-38A encrypt";
+            savedhi_aes_cbc_decrypt( &aesKey, iv, blocks, counts[c] );
+            if (!failure && memcmp( blocks, plain, counts[c] * 16 ) != OK)
+                failure = "SP 800-38A decrypt";
+        }
+
+        // 9 blocks spill over the 8 blocks the instruction kernels decrypt at once.  CBC encrypts them the same
+        // whether at once or one block at a time, chaining each block's IV from the previous ciphertext.
+        for (size_t b = 0; b < 9; ++b)
+            memcpy( &blocks[b * 16], &plain[(b % 4) * 16], 16 );
+        memcpy( expected, blocks, sizeof( expected ) );
+        for (size_t b = 0; b < 9; ++b)
+            savedhi_aes_cbc_encrypt( &aesKey, b? &expected[(b - 1) * 16]: iv, &expected[b * 16], 1 );
+        savedhi_aes_cbc_encrypt( &aesKey, iv, blocks, 9 );
+        if (!failure && memcmp( blocks, expected, sizeof( blocks ) ) != OK)
+            failure = "9 blocks encrypt";
+        savedhi_aes_cbc_decrypt( &aesKey, iv, blocks, 9 );
+        for (size_t b = 0; !failure && b < 9; ++b)
+            if (memcmp( &blocks[b * 16], &plain[(b % 4) * 16], 16 ) != OK)
+                failure = "9 blocks decrypt";
+        savedhi_free( &key, 16 ), savedhi_free( &iv, 16 ), savedhi_free( &plain, 4 * 16 );
+        savedhi_zero( &aesKey, sizeof( aesKey ) );
+
+        if (failure) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (%s)\n", failure );
+        }
+        else
+            fprintf( stdout, "pass.\n" );
+    }
+    savedhi_aes_set( defaultName );
+
+    return failed;
+}
+
+/** The in-tree scrypt should derive the RFC 7914 test vectors and the crypto backend's keys, both with its lanes mixed
+ * on threads of their own and all of them on the calling thread.
+ * @return The amount of failed tests. */
+static int test_scrypt(int argc, char *const argv[]) {
+
+    const char *id = "scrypt";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    // RFC 7914, section 12 (the first vector's empty secret and salt are out of bounds, the last needs 1 GiB),
+    // and savedhi's own parameters, checked against the crypto backend.
+    static const struct {
+        const char *secret, *salt;
+        uint64_t N;
+        uint32_t r, p;
+        const char *key;
+    } vectors[] = {
+            { "password", "NaCl", 1024, 8, 16,
+              "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+              "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640" },
+            { "pleaseletmein", "SodiumChloride", 16384, 8, 1,
+              "7023bdcb3afd7348461c06cd81fd38ebfda8fbba904f8e3ea9b543f6545da1f2"
+              "d5432955613f0fcf62d49705242a9af9e61e85dc0d651e40dfcf017b45575887" },
+            { "banana colored duckling", "Robert Lee Mitchell", 32768, 8, 2, NULL },
+    };
+    static const struct {
+        const char *name;
+        uint32_t threads;
+    } paths[] = {
+            { "threaded", 16 },
+            { "inline", 1 },
+    };
+
+    int failed = 0;
+    const char *defaultName = savedhi_scrypt_name();
+    const uint32_t defaultThreads = savedhi_scrypt_threads();
+    for (size_t t = 0; t < sizeof( paths ) / sizeof( *paths ); ++t) {
+        fprintf( stdout, "test %s %s... ", id, paths[t].name );
+        const char *failure = NULL, *name = NULL;
+        for (size_t v = 0; !failure && v < sizeof( vectors ) / sizeof( *vectors ); ++v) {
+            const uint8_t *secret = (const uint8_t *)vectors[v].secret, *salt = (const uint8_t *)vectors[v].salt;
+            const size_t secretSize = strlen( vectors[v].secret ), saltSize = strlen( vectors[v].salt );
+
+            uint8_t expected[64], key[64];
+            savedhi_scrypt_set( "backend" );
+            if (!savedhi_kdf_scrypt( expected, sizeof( expected ), secret, secretSize, salt, saltSize,
+                    vectors[v].N, vectors[v].r, vectors[v].p ) ||
+                (vectors[v].key && !test_hex_equals( expected, sizeof( expected ), vectors[v].key ))) {
+                failure = "backend";
+                continue;
+            }
+
+            if (!savedhi_scrypt_set( defaultName ) || !savedhi_scrypt_intree())
+                savedhi_scrypt_set( NULL );
+            name = savedhi_scrypt_name();
+            savedhi_scrypt_threads_set( paths[t].threads );
+            if (!savedhi_scrypt( key, sizeof( key ), secret, secretSize, salt, saltSize, vectors[v].N, vectors[v].r, vectors[v].p ) ||
+                memcmp( key, expected, sizeof( key ) ) != OK)
+                failure = vectors[v].key? "RFC 7914": "backend key";
+            savedhi_scrypt_threads_set( defaultThreads );
+        }
+
+        if (failure) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (%s, %s)\n", name? name: "-", failure );
+        }
+        else
+            fprintf( stdout, "pass.  (%s)\n", name );
+    }
+    savedhi_scrypt_set( defaultName );
+    savedhi_scrypt_release();
+
+    return failed;
+}
+
+/** Each in-tree scrypt kernel should derive the crypto backend's keys, mixing as many lanes at once as it is wide.
+ * @return The amount of failed tests. */
+static int test_scrypt_kernels(int argc, char *const argv[]) {
+
+    const char *id = "scrypt-kernels";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    // With all lanes on the calling thread, p = 16 fills every kernel, p = 3 leaves the widest one with an empty lane.
+    static const struct {
+        const char *secret, *salt;
+        uint64_t N;
+        uint32_t r, p;
+    } vectors[] = {
+            { "password", "NaCl", 1024, 8, 16 },
+            { "banana colored duckling", "Robert Lee Mitchell", 1024, 8, 3 },
+            { "pleaseletmein", "SodiumChloride", 2048, 4, 1 },
+    };
+
+    int failed = 0;
+    const char *defaultName = savedhi_scrypt_name();
+    const uint32_t defaultThreads = savedhi_scrypt_threads();
+    static const char *names[] = { "avx512", "avx2", "sse2", "portable" };
+    for (size_t n = 0; n < sizeof( names ) / sizeof( *names ); ++n) {
+        if (!savedhi_scrypt_set( names[n] ) || !savedhi_scrypt_intree())
+            continue;
+
+        fprintf( stdout, "test %s %s... ", id, names[n] );
+        const char *failure = NULL;
+        savedhi_scrypt_threads_set( 1 );
+        if (strcmp( savedhi_scrypt_kernel_name( vectors[0].p ), names[n] ) != OK)
+            failure = "kernel not used";
+        for (size_t v = 0; !failure && v < sizeof( vectors ) / sizeof( *vectors ); ++v) {
+            const uint8_t *secret = (const uint8_t *)vectors[v].secret, *salt = (const uint8_t *)vectors[v].salt;
+            const size_t secretSize = strlen( vectors[v].secret ), saltSize = strlen( vectors[v].salt );
+
+            uint8_t expected[64], key[64];
+            savedhi_scrypt_set( "backend" );
+            if (!savedhi_kdf_scrypt( expected, sizeof( expected ), secret, secretSize, salt, saltSize,
+                    vectors[v].N, vectors[v].r, vectors[v].p ))
+                failure = "backend";
+            savedhi_scrypt_set( names[n] );
+            if (!failure && (!savedhi_scrypt( key, sizeof( key ), secret, secretSize, salt, saltSize,
+                    vectors[v].N, vectors[v].r, vectors[v].p ) || memcmp( key, expected, sizeof( key ) ) != OK))
+                failure = "backend key";
+        }
+        savedhi_scrypt_threads_set( defaultThreads );
+
+        if (failure) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (%s)\n", failure );
+        }
+        else
+            fprintf( stdout, "pass.\n" );
+    }
+    savedhi_scrypt_set( defaultName );
+    savedhi_scrypt_release();
+
+    return failed;
+}
+
+/** Each in-tree scrypt kernel should derive the same keys whatever its time-memory trade-off.
+ * @return The amount of failed tests. */
+static int test_scrypt_tmto(int argc, char *const argv[]) {
+
+    const char *id = "scrypt-tmto";
+    if (!test_selected( id, argc, argv ))
+        return 0;
+
+    // k = 3 doesn't divide N, k = 16 keeps only 64 of V's 1024 blocks.
+    static const uint32_t tmtos[] = { 1, 3, 16 };
+    const uint8_t *secret = (const uint8_t *)"banana colored duckling", *salt = (const uint8_t *)"Robert Lee Mitchell";
+
+    int failed = 0;
+    const char *defaultName = savedhi_scrypt_name();
+    const uint32_t defaultThreads = savedhi_scrypt_threads(), defaultTmto = savedhi_scrypt_tmto();
+    static const char *names[] = { "avx512", "avx2", "sse2", "portable" };
+    for (size_t n = 0; n < sizeof( names ) / sizeof( *names ); ++n) {
+        if (!savedhi_scrypt_set( names[n] ) || !savedhi_scrypt_intree())
+            continue;
+
+        fprintf( stdout, "test %s %s... ", id, names[n] );
+        uint8_t expected[64], key[64];
+        uint32_t failedTmto = 0;
+        savedhi_scrypt_threads_set( 1 );
+        for (size_t k = 0; !failedTmto && k < sizeof( tmtos ) / sizeof( *tmtos ); ++k) {
+            savedhi_scrypt_tmto_set( tmtos[k] );
+            if (!savedhi_scrypt( k? key: expected, sizeof( key ), secret, strlen( (const char *)secret ), salt, strlen( (const char *)salt ),
+                    1024, 8, 4 ) || (k && memcmp( key, expected, sizeof( key ) ) != OK))
+                failedTmto = tmtos[k];
+        }
+        savedhi_scrypt_tmto_set( defaultTmto );
+        savedhi_scrypt_threads_set( defaultThreads );
+
+        if (failedTmto) {
+            ++failed;
+            fprintf( stdout, "FAILED!  (k = %u)\n", failedTmto );
+        }
+        else
+            fprintf( stdout, "pass.\n" );
+    }
+    savedhi_scrypt_set( defaultName );
+    savedhi_scrypt_release();
+
+    return failed;
+}
+
 int main(int argc, char *const argv[]) {
 
     for (int opt; (opt = getopt( argc, argv, "vqh" )) != EOF;
@@ -81,6 +1127,22 @@ int main(int argc, char *const argv[]) {
 
     int failedTests = 0;
 
+#if savedhi_TESTS_ALLOCATIONS
+    failedTests += test_allocations( argc, argv );
+#endif
+    failedTests += test_provider( argc, argv );
+    failedTests += test_marshal_index( argc, argv );
+    failedTests += test_results_batch( argc, argv );
+    failedTests += test_class_tables( argc, argv );
+    failedTests += test_utf8_measure( argc, argv );
+    failedTests += test_unhex( argc, argv );
+    failedTests += test_sha256( argc, argv );
+    failedTests += test_sha256_lanes( argc, argv );
+    failedTests += test_aes( argc, argv );
+    failedTests += test_scrypt( argc, argv );
+    failedTests += test_scrypt_kernels( argc, argv );
+    failedTests += test_scrypt_tmto( argc, argv );
+
     xmlNodePtr tests = xmlDocGetRootElement( xmlParseFile( "savedhi_tests.xml" ) );
     if (!tests) {
         ftl( "Couldn't find test case: savedhi_tests.xml" );
@@ -134,9 +1196,9 @@ int main(int argc, char *const argv[]) {
             }
 
             // Check the user key.
-            if (!savedhi_id_equals( &keyID, &userKey->keyID )) {
+            if (!savedhi_id_equals( &keyID, savedhi_user_key_id( userKey ) )) {
                 ++failedTests;
-                fprintf( stdout, "FAILED!  (keyID: got %s != expected %s)\n", userKey->keyID.hex, keyID.hex );
+                fprintf( stdout, "FAILED!  (keyID: got %s != expected %s)\n", savedhi_user_key_id( userKey )->hex, keyID.hex );
                 break;
             }
 